@@ -0,0 +1,400 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// INTERPRETER BENCHMARK
+// synthetic IL workloads run on every available engine. build from the repository root:
+//   gcc -O2 -Isrc -o bench/bench bench/bench.c src/librelogic_*.c -ldl -pthread
+// and run there (aot builds against src/): bench/bench [-t seconds] [workload ...]
+// instructions/scan is the count of IL instructions executed per scan (unfused),
+// ns/instruction divides the scan time by it for every engine.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+#include "librelogic_jit.h"
+#include "librelogic_aot.h"
+#include "librelogic_parallel.h"
+
+#define BENCH_SRC (1 << 20)
+
+static const uint32_t bench_size[VM_AREAS] = {
+        [VM_I]      = 8,
+        [VM_I_REAL] = 8,
+        [VM_M]      = 256,
+        [VM_M_REAL] = 8,
+        [VM_C]      = 8,
+        [VM_Q]      = 8,
+        [VM_Q_REAL] = 8,
+        [VM_T]      = 64,
+        [VM_B]      = 64,
+};
+
+typedef struct bench_src {
+      char *buf;   //
+    size_t len;    //
+} bench_src_t;
+
+static void emit(bench_src_t *src, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit(bench_src_t *src, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    src->len += vsnprintf(src->buf + src->len, BENCH_SRC - src->len, fmt, ap);
+    va_end(ap);
+}
+
+////////////////////// WORKLOADS //////////////////////
+
+// wide boolean ladder: 200 rungs of contacts and coils
+static void gen_ladder(bench_src_t *src, vm_t *vm) {
+    uint32_t r;
+
+    (void) vm;
+    for (r = 0; r < 200; r++) {
+        emit(src, "LD %%i%u/%u\n", r % 8, r % 64);
+        emit(src, "AND %%i%u/%u\n", (r + 1) % 8, (r * 7) % 64);
+        emit(src, "OR %%q%u/%u\n", r % 8, (r * 3) % 64);
+        emit(src, "AND !%%i%u/%u\n", (r + 3) % 8, (r * 5) % 64);
+        emit(src, "ST %%q%u/%u\n", r % 8, r % 64);
+    }
+}
+
+// deep parenthesis: 20 rungs nested 16 deep
+static void gen_nesting(bench_src_t *src, vm_t *vm) {
+    uint32_t r, d;
+
+    (void) vm;
+    for (r = 0; r < 20; r++) {
+        emit(src, "LD %%i0/%u\n", r);
+        for (d = 0; d < 16; d++)
+            emit(src, "%s( %%i%u/%u\n", d & 1 ? "AND" : "OR", d % 8, (r + d) % 64);
+        for (d = 0; d < 16; d++)
+            emit(src, ")\n");
+        emit(src, "ST %%q0/%u\n", r);
+    }
+}
+
+// arithmetic loop: 100 iterations of add/multiply/compare
+static void gen_arith(bench_src_t *src, vm_t *vm) {
+    vm->m[1] = 100; // limit
+    vm->m[2] = 1;   // step
+    vm->m[3] = 0;   // zero
+    vm->m[5] = 3;   // factor
+
+    emit(src, "LD %%m3\n");
+    emit(src, "ST %%m0\n");
+    emit(src, "loop: LD %%m0\n");
+    emit(src, "ADD %%m2\n");
+    emit(src, "ST %%m0\n");
+    emit(src, "MUL %%m5\n");
+    emit(src, "SUB %%m4\n");
+    emit(src, "ST %%m4\n");
+    emit(src, "LD %%m0\n");
+    emit(src, "LT %%m1\n");
+    emit(src, "JMP? loop\n");
+}
+
+// jump heavy state machine: 64 states selected by compare chains
+static void gen_states(bench_src_t *src, vm_t *vm) {
+    uint32_t k;
+
+    for (k = 0; k < 64; k++)
+        vm->m[16 + k] = k;
+
+    for (k = 0; k < 64; k++) {
+        emit(src, "LD %%m0\n");
+        emit(src, "EQ %%m%u\n", 16 + k);
+        emit(src, "JMP? st%u\n", k);
+    }
+    emit(src, "JMP end\n");
+    for (k = 0; k < 64; k++) {
+        emit(src, "st%u: LD %%i0/%u\n", k, k);
+        emit(src, "JMP!? end\n");
+        emit(src, "LD %%m%u\n", 16 + (k + 1) % 64);
+        emit(src, "ST %%m0\n");
+        emit(src, "JMP end\n");
+    }
+    emit(src, "end: NOP\n");
+}
+
+// timers, counters, edges and blinkers: 32 rungs
+static void gen_timers(bench_src_t *src, vm_t *vm) {
+    uint32_t k;
+
+    for (k = 0; k < 32; k++) {
+        vm->t[k].preset = 5 + k;
+        vm_blinker_set(vm, k, 2 + k);
+
+        emit(src, "LD %%r0/%u\n", k);
+        emit(src, "OR %%f1/%u\n", k);
+        emit(src, "ST %%T%u\n", k);
+        emit(src, "LD %%t%u\n", k);
+        emit(src, "ST %%M%u\n", k);
+        emit(src, "LD %%b%u\n", k);
+        emit(src, "AND %%i2/%u\n", k);
+        emit(src, "ST %%q0/%u\n", k);
+    }
+}
+
+// mostly idle plant: 100 latching rungs of 10 contacts, 1 in 8 reads the inputs
+// changing every scan
+static void gen_sparse(bench_src_t *src, vm_t *vm) {
+    uint32_t r, w, k;
+
+    (void) vm;
+    for (r = 0; r < 100; r++) {
+        w = r % 8 ? 3 + r % 5 : r % 3;
+        emit(src, "LD %%i%u/%u\n", w, r % 50);
+        for (k = 1; k < 8; k++)
+            emit(src, "AND %s%%i%u/%u\n", k & 1 ? "" : "!", w, r % 50 + k);
+        emit(src, "OR %%m%u/0\n", 16 + r);
+        emit(src, "AND %%i%u/%u\n", 3 + (r + 1) % 5, r % 64);
+        emit(src, "AND !%%i%u/%u\n", 3 + (r + 2) % 5, r % 64);
+        emit(src, "ST %%m%u/0\n", 16 + r);
+    }
+}
+
+// independent machine cells: 8 cells of 50 rungs, each on its own input and memory words
+static void gen_cells(bench_src_t *src, vm_t *vm) {
+    uint32_t c, r;
+
+    (void) vm;
+    for (c = 0; c < 8; c++)
+        for (r = 0; r < 50; r++) {
+            emit(src, "LD %%i%u/%u\n", c, r);
+            emit(src, "AND %%m%u/%u\n", 64 + c * 8 + (r + 1) % 8, (r * 3) % 64);
+            emit(src, "OR( %%i%u/%u\n", c, (r * 7) % 64);
+            emit(src, "AND !%%m%u/%u\n", 64 + c * 8 + (r + 2) % 8, r);
+            emit(src, ")\n");
+            emit(src, "ST %%m%u/%u\n", 64 + c * 8 + r % 8, r);
+        }
+}
+
+static const struct {
+    const char *name;
+          void (*gen)(bench_src_t *src, vm_t *vm);
+} workloads[] = {
+        { "ladder",  gen_ladder  },
+        { "nesting", gen_nesting },
+        { "arith",   gen_arith   },
+        { "states",  gen_states  },
+        { "timers",  gen_timers  },
+        { "sparse",  gen_sparse  },
+        { "cells",   gen_cells   },
+};
+
+////////////////////// ENGINES //////////////////////
+
+typedef enum BENCH_ENGINES {
+    BENCH_GOTO,
+    BENCH_FUSED,
+    BENCH_SEGMENT,
+    BENCH_SWITCH,
+    BENCH_CALL,
+    BENCH_JIT,
+    BENCH_AOT,
+    BENCH_PARALLEL,
+    BENCH_ENGINES
+} bench_engines_t;
+
+static const char *engine_name[BENCH_ENGINES] = {
+        "goto", "goto+fused", "fused+seg", "switch", "call", "jit", "aot", "parallel",
+};
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// inputs change every scan, same sequence for every engine
+static inline void bench_inputs(vm_t *vm, uint64_t *x) {
+    uint32_t n;
+
+    for (n = 0; n < 3; n++) {
+        *x ^= *x << 13;
+        *x ^= *x >> 7;
+        *x ^= *x << 17;
+        vm->i[n] = *x;
+    }
+    ++vm->time;
+}
+
+// scans for about sec seconds, returns ns per scan
+static double bench_run(vm_t *vm, double sec, uint64_t *scans) {
+    uint64_t start, end, n = 0, x = 88172645463325252ull;
+    uint32_t k;
+
+    start = now_ns();
+    do {
+        for (k = 0; k < 256; k++) {
+            bench_inputs(vm, &x);
+            vm_execute(vm);
+        }
+        n += 256;
+        end = now_ns();
+    } while (end - start < sec * 1e9);
+
+    *scans = n;
+    return (double) (end - start) / n;
+}
+
+// vm with the workload loaded on an engine, false if the engine can't run it
+static bool bench_setup(vm_t *vm, int w, uint8_t engine, const il_program_t *prg, jit_t *jit, aot_t *aot,
+        parallel_t *par) {
+    bench_src_t dummy = { NULL, 0 };
+    char c_file[256], so_file[256];
+    long cpus;
+
+    vm_init(vm, bench_size);
+    dummy.buf = malloc(BENCH_SRC);
+    workloads[w].gen(&dummy, vm); // memory presets
+    free(dummy.buf);
+    if (vm_load(vm, prg->code, prg->code_len) != VM_OK)
+        return false;
+
+    switch (engine) {
+        case BENCH_FUSED:
+            vm_fuse(vm);
+            break;
+        case BENCH_SEGMENT:
+            vm_fuse(vm);
+            if (vm_segment(vm) != VM_OK)
+                return false;
+            break;
+        case BENCH_SWITCH:
+            vm_select(vm, VM_ENGINE_SWITCH, vm_run_switch);
+            break;
+        case BENCH_CALL:
+            vm_select(vm, VM_ENGINE_CALL, vm_run_call);
+            break;
+        case BENCH_JIT:
+            if (jit_compile(jit, vm) != JIT_OK)
+                return false;
+            vm_select(vm, VM_ENGINE_JIT, jit->fn);
+            break;
+        case BENCH_AOT:
+            snprintf(c_file, sizeof(c_file), "/tmp/librelogic_bench_%s.c", workloads[w].name);
+            snprintf(so_file, sizeof(so_file), "/tmp/librelogic_bench_%s.so", workloads[w].name);
+            if (aot_translate(c_file, prg, "bench_scan") != AOT_OK || aot_build(c_file, so_file, "src") != AOT_OK
+                    || aot_load(aot, so_file, "bench_scan") != AOT_OK)
+                return false;
+            remove(c_file);
+            remove(so_file);
+            vm_select(vm, VM_ENGINE_AOT, aot->fn);
+            break;
+        case BENCH_PARALLEL:
+            // a worker per other online cpu
+            cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            vm_fuse(vm);
+            if (parallel_init(par, vm, cpus > 1 ? cpus - 1 : 0) != PARALLEL_OK)
+                return false;
+            if (parallel_start(par, NULL, 0) != PARALLEL_OK)
+                return false;
+            break;
+    }
+
+    return true;
+}
+
+static void bench(int w, double sec) {
+    bench_src_t src = { malloc(BENCH_SRC), 0 };
+    il_program_t prg;
+    vm_t vm;
+    jit_t jit = { 0 };
+    aot_t aot = { 0 };
+    parallel_t par = { 0 };
+    uint64_t scans;
+    double ns, per_scan = 0;
+    uint8_t e;
+
+    vm_init(&vm, bench_size);
+    workloads[w].gen(&src, &vm);
+    vm_deinit(&vm);
+    if (!compile_il_buffer(src.buf, src.len, &prg)) {
+        printf("%s: assembly failed (line %lu)\n", workloads[w].name,
+                (long unsigned int) (prg.diags_qty ? prg.diags[0].line : 0));
+        il_program_free(&prg);
+        free(src.buf);
+        return;
+    }
+    free(src.buf);
+
+    printf("\n%s: %lu instructions\n", workloads[w].name, (long unsigned int) prg.code_len);
+    printf("  %-12s %14s %14s %14s\n", "engine", "ns/instr", "scans/s", "instr/scan");
+    for (e = 0; e < BENCH_ENGINES; e++) {
+        if (!bench_setup(&vm, w, e, &prg, &jit, &aot, &par)) {
+            printf("  %-12s %14s\n", engine_name[e], "unsupported");
+            parallel_free(&par);
+            vm_deinit(&vm);
+            continue;
+        }
+
+        ns = bench_run(&vm, sec, &scans);
+        // unfused interpreter dispatches = instructions + halt
+        if (e == BENCH_GOTO)
+            per_scan = (double) vm.instructions / scans - 1;
+        printf("  %-12s %14.3f %14.0f %14.1f\n", engine_name[e], per_scan > 0 ? ns / per_scan : 0.0, 1e9 / ns,
+                per_scan);
+
+        parallel_free(&par);
+        vm_deinit(&vm);
+        jit_free(&jit);
+        aot_unload(&aot);
+    }
+    il_program_free(&prg);
+}
+
+int main(int argc, char **argv) {
+    double sec = 0.2;
+    bool any = false;
+    int n, w;
+
+    for (n = 1; n < argc; n++)
+        if (!strcmp(argv[n], "-t") && n + 1 < argc)
+            sec = atof(argv[++n]);
+
+    for (n = 1; n < argc; n++) {
+        if (!strcmp(argv[n], "-t")) {
+            ++n;
+            continue;
+        }
+        for (w = 0; w < (int) (sizeof(workloads) / sizeof(workloads[0])); w++)
+            if (!strcmp(argv[n], workloads[w].name)) {
+                bench(w, sec);
+                any = true;
+            }
+    }
+    if (!any)
+        for (w = 0; w < (int) (sizeof(workloads) / sizeof(workloads[0])); w++)
+            bench(w, sec);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,465 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+#include "librelogic_aot.h"
+
+// same semantics as the interpreter, types fold away where known
+static const char *aot_preamble =
+        "#include <stdint.h>\n"
+        "#include <stdbool.h>\n"
+        "\n"
+        "#include \"librelogic_newvm.h\"\n"
+        "\n"
+        "static inline bool aot_truthy(vm_value_t v) {\n"
+        "    return v.type == T_REAL ? v.r != 0.0 : v.w != 0;\n"
+        "}\n"
+        "\n"
+        "static inline uint64_t aot_to_word(vm_value_t v) {\n"
+        "    return v.type == T_REAL ? (uint64_t) (int64_t) v.r : v.w;\n"
+        "}\n"
+        "\n"
+        "static inline double aot_to_real(vm_value_t v) {\n"
+        "    return v.type == T_REAL ? v.r : (double) (int64_t) v.w;\n"
+        "}\n"
+        "\n"
+        "static inline void aot_negate(vm_value_t *v) {\n"
+        "    if (v->type == T_BOOL)\n"
+        "        v->w = !v->w;\n"
+        "    else if (v->type == T_WORD)\n"
+        "        v->w = ~v->w;\n"
+        "    else\n"
+        "        v->r = -v->r;\n"
+        "}\n"
+        "\n"
+        "static inline void aot_bit(uint64_t *w, int bit, bool v) {\n"
+        "    *w = v ? *w | (uint64_t) 1 << bit : *w & ~((uint64_t) 1 << bit);\n"
+        "}\n"
+        "\n"
+        "static inline uint8_t aot_operate(uint8_t il, vm_value_t *a, vm_value_t b) {\n"
+        "    bool real = a->type == T_REAL || b.type == T_REAL;\n"
+        "    uint8_t type = real ? T_REAL : T_WORD;\n"
+        "    int64_t wa = (int64_t) aot_to_word(*a), wb = (int64_t) aot_to_word(b);\n"
+        "    double ra = aot_to_real(*a), rb = aot_to_real(b);\n"
+        "\n"
+        "    switch (il) {\n"
+        "        case IL_AND: case IL_OR: case IL_XOR:\n"
+        "            type = (a->type == T_BOOL && b.type == T_BOOL) ? T_BOOL : T_WORD;\n"
+        "            a->w = il == IL_AND ? (uint64_t) (wa & wb) : il == IL_OR ? (uint64_t) (wa | wb) : (uint64_t) (wa ^ wb);\n"
+        "            break;\n"
+        "        case IL_ADD: if (real) a->r = ra + rb; else a->w = (uint64_t) wa + (uint64_t) wb; break;\n"
+        "        case IL_SUB: if (real) a->r = ra - rb; else a->w = (uint64_t) wa - (uint64_t) wb; break;\n"
+        "        case IL_MUL: if (real) a->r = ra * rb; else a->w = (uint64_t) wa * (uint64_t) wb; break;\n"
+        "        case IL_DIV:\n"
+        "            if (real) { a->r = ra / rb; break; }\n"
+        "            if (wb == 0) return VM_ERR_DIV_ZERO;\n"
+        "            a->w = wb == -1 ? (uint64_t) 0 - (uint64_t) wa : (uint64_t) (wa / wb);\n"
+        "            break;\n"
+        "        case IL_GT: a->w = real ? ra > rb : wa > wb; type = T_BOOL; break;\n"
+        "        case IL_GE: a->w = real ? ra >= rb : wa >= wb; type = T_BOOL; break;\n"
+        "        case IL_EQ: a->w = real ? ra == rb : wa == wb; type = T_BOOL; break;\n"
+        "        case IL_NE: a->w = real ? ra != rb : wa != wb; type = T_BOOL; break;\n"
+        "        case IL_LE: a->w = real ? ra <= rb : wa <= wb; type = T_BOOL; break;\n"
+        "        case IL_LT: a->w = real ? ra < rb : wa < wb; type = T_BOOL; break;\n"
+        "    }\n"
+        "    a->type = type;\n"
+        "\n"
+        "    return VM_OK;\n"
+        "}\n"
+        "\n"
+        "#define OPERATE(il, a, b) if ((status = aot_operate(il, &(a), b)) != VM_OK) goto halt\n"
+        "\n";
+
+// word areas of integer operands
+static const char *aot_word_area[OP_END] = {
+        [OP_INPUT]   = "i",
+        [OP_MEMORY]  = "m",
+        [OP_PULSEIN] = "m",
+        [OP_COMMAND] = "c",
+        [OP_WRITE]   = "c",
+        [OP_OUTPUT]  = "q",
+        [OP_CONTACT] = "q",
+};
+
+static const char *aot_real_area[OP_END] = {
+        [OP_REAL_INPUT]   = "i_real",
+        [OP_REAL_MEMORY]  = "m_real",
+        [OP_REAL_MEMIN]   = "m_real",
+        [OP_REAL_OUTPUT]  = "q_real",
+        [OP_REAL_CONTACT] = "q_real",
+};
+
+static const char *aot_il_name[IL_POP] = {
+        "IL_NOP", "IL_LD",  "IL_ST",  "IL_S",   "IL_R",   "IL_AND", "IL_OR",
+        "IL_XOR", "IL_NOT", "IL_ADD", "IL_SUB", "IL_MUL", "IL_DIV", "IL_GT",
+        "IL_GE",  "IL_EQ",  "IL_NE",  "IL_LE",  "IL_LT",  "IL_JMP", "IL_CAL",
+};
+
+// v = operand (G applied)
+static bool aot_read(FILE *f, uint32_t ins, const char *v) {
+    uint8_t operand = OPERAND(ins);
+    uint32_t idx = BIT_WORD(ins) ? INSWORD0(ins) : INSBYTE2(ins);
+    uint8_t bit = INSBYTE3(ins);
+    char w[64];
+
+    if (operand == N_OPERANDS) {
+        fprintf(f, "    %s.w = 0; %s.type = T_BOOL;\n", v, v);
+        return true;
+    }
+    if (operand >= OP_END || (!BIT_WORD(ins) && bit > 63))
+        return false;
+
+    switch (operand) {
+        case OP_RISING:
+            snprintf(w, sizeof(w), "vm->i_rise[%u]", idx);
+            break;
+        case OP_FALLING:
+            snprintf(w, sizeof(w), "vm->i_fall[%u]", idx);
+            break;
+        case OP_TIMEOUT:
+            fprintf(f, "    %s.w = vm->t[%u].q; %s.type = T_BOOL;\n", v, idx, v);
+            goto narg;
+        case OP_START:
+            fprintf(f, "    %s.w = vm->t[%u].en; %s.type = T_BOOL;\n", v, idx, v);
+            goto narg;
+        case OP_BLINKOUT:
+            fprintf(f, "    %s.w = vm->b[%u].q; %s.type = T_BOOL;\n", v, idx, v);
+            goto narg;
+        default:
+            if (aot_real_area[operand] != NULL) {
+                fprintf(f, "    %s.r = vm->%s[%u]; %s.type = T_REAL;\n", v, aot_real_area[operand], idx, v);
+                goto narg;
+            }
+            snprintf(w, sizeof(w), "vm->%s[%u]", aot_word_area[operand], idx);
+    }
+
+    if (BIT_WORD(ins))
+        fprintf(f, "    %s.w = %s; %s.type = T_WORD;\n", v, w, v);
+    else
+        fprintf(f, "    %s.w = (%s >> %u) & 1; %s.type = T_BOOL;\n", v, w, bit, v);
+
+    narg:
+    if (BIT_NEGATE_ARG(ins))
+        fprintf(f, "    aot_negate(&%s);\n", v);
+
+    return true;
+}
+
+// operand = v
+static bool aot_write(FILE *f, uint32_t ins, const char *v) {
+    uint8_t operand = OPERAND(ins);
+    uint32_t idx = BIT_WORD(ins) ? INSWORD0(ins) : INSBYTE2(ins);
+    uint8_t bit = INSBYTE3(ins);
+
+    if (operand >= OP_END || (!BIT_WORD(ins) && bit > 63))
+        return false;
+
+    switch (operand) {
+        case N_OPERANDS:
+            return true;
+        case OP_MEMORY:
+        case OP_WRITE:
+        case OP_OUTPUT:
+        case OP_CONTACT:
+            if (BIT_WORD(ins))
+                fprintf(f, "    vm->%s[%u] = aot_to_word(%s);\n", aot_word_area[operand], idx, v);
+            else
+                fprintf(f, "    aot_bit(&vm->%s[%u], %u, aot_truthy(%s));\n", aot_word_area[operand], idx, bit, v);
+            return true;
+        case OP_REAL_MEMORY:
+        case OP_REAL_MEMIN:
+        case OP_REAL_OUTPUT:
+        case OP_REAL_CONTACT:
+            fprintf(f, "    vm->%s[%u] = aot_to_real(%s);\n", aot_real_area[operand], idx, v);
+            return true;
+        case OP_PULSEIN:
+            fprintf(f, "    if (aot_truthy(%s) && !vm->m_pulse[%u])\n        ++vm->m[%u];\n", v, idx, idx);
+            fprintf(f, "    vm->m_pulse[%u] = aot_truthy(%s);\n", idx, v);
+            return true;
+        case OP_START:
+            fprintf(f, "    vm_timer_input(vm, %u, aot_truthy(%s));\n", idx, v);
+            return true;
+    }
+
+    // read only
+    return false;
+}
+
+static void aot_condition(FILE *f, uint32_t ins) {
+    if (!BIT_COND(ins))
+        fprintf(f, "    if (1) {\n");
+    else
+        fprintf(f, "    if (%saot_truthy(acc)) {\n", BIT_NEGATE_INS(ins) ? "!" : "");
+}
+
+uint8_t aot_translate(const char *file, const il_program_t *prg, const char *name) {
+    uint32_t pc, n, ins, idx, depth = 0, max_depth = 0, *depths, *pushes, need[VM_AREAS] = { 0 };
+    bool *target;
+    uint8_t il, status = AOT_OK;
+    FILE *f;
+
+    depths = calloc(prg->code_len + 1, sizeof(uint32_t));
+    pushes = calloc(prg->code_len + 1, sizeof(uint32_t));
+    target = calloc(prg->code_len + 1, sizeof(bool));
+    if (depths == NULL || pushes == NULL || target == NULL) {
+        status = AOT_ERR_MEMORY;
+        goto end;
+    }
+
+    // parenthesis are paired at translation time, jumps can't cross them
+    for (pc = 0; pc < prg->code_len; pc++) {
+        ins = prg->code[pc];
+        il = IL(ins);
+        depths[pc] = depth;
+        if (il > IL_POP) {
+            status = AOT_ERR_UNSUPPORTED;
+            goto end;
+        }
+        if (il >= IL_AND && il <= IL_LT && il != IL_NOT && BIT_PUSH(ins)) {
+            if (++depth > max_depth)
+                max_depth = depth;
+        } else if (il == IL_POP && depth-- == 0) {
+            status = AOT_ERR_UNSUPPORTED;
+            goto end;
+        } else if (il == IL_JMP || il == IL_CAL) {
+            if (depth != 0 || INSWORD2(ins) >= prg->code_len) {
+                status = AOT_ERR_UNSUPPORTED;
+                goto end;
+            }
+            target[INSWORD2(ins)] = true;
+        }
+
+        // area sizes are checked once on entry instead of per access
+        if (il != IL_NOP && il != IL_NOT && il != IL_POP && il != IL_JMP && il != IL_CAL && OPERAND(ins) != N_OPERANDS
+                && OPERAND(ins) < OP_END) {
+            idx = BIT_WORD(ins) ? INSWORD0(ins) : INSBYTE2(ins);
+            if (idx >= need[vm_operand_area[OPERAND(ins)]])
+                need[vm_operand_area[OPERAND(ins)]] = idx + 1;
+        }
+    }
+    if (max_depth > VM_STACK_DEPTH) {
+        status = AOT_ERR_UNSUPPORTED;
+        goto end;
+    }
+    for (pc = 0; pc < prg->code_len; pc++)
+        if (target[pc] && depths[pc] != 0) {
+            status = AOT_ERR_UNSUPPORTED;
+            goto end;
+        }
+
+    f = fopen(file, "w");
+    if (f == NULL) {
+        status = AOT_ERR_OPEN;
+        goto end;
+    }
+
+    fprintf(f, "// generated by librelogic aot_translate(), do not edit\n\n%s", aot_preamble);
+    fprintf(f, "uint8_t %s(vm_t *vm) {\n", name);
+    fprintf(f, "    vm_value_t acc = { .w = 0, .type = T_BOOL }, v");
+    for (n = 0; n < max_depth; n++)
+        fprintf(f, ", s%u", n);
+    fprintf(f, ";\n    void *calls[VM_CALL_DEPTH];\n    uint32_t csp = 0;\n    uint8_t status = VM_OK;\n\n");
+    fprintf(f, "    (void) v;\n    (void) calls;\n    (void) csp;\n\n");
+    for (n = 0; n < VM_AREAS; n++)
+        if (need[n] != 0)
+            fprintf(f, "    if (vm->size[%u] < %u)\n        return VM_ERR_OPERAND;\n", n, need[n]);
+    fprintf(f, "\n");
+
+    depth = 0;
+    for (pc = 0; pc < prg->code_len && status == AOT_OK; pc++) {
+        ins = prg->code[pc];
+        il = IL(ins);
+
+        if (target[pc]) {
+            fprintf(f, "    L%u:", pc);
+            for (n = 0; n < prg->labels_qty; n++)
+                if (prg->labels[n].line - 1 == pc)
+                    fprintf(f, " // %s", prg->labels[n].label);
+            fprintf(f, "\n");
+        }
+
+        if (il >= IL_AND && il <= IL_LT && il != IL_NOT && BIT_PUSH(ins)) {
+            pushes[depth] = ins;
+            fprintf(f, "    s%u = acc;\n", depth++);
+            if (OPERAND(ins) != N_OPERANDS && !aot_read(f, ins, "acc"))
+                status = AOT_ERR_UNSUPPORTED;
+            continue;
+        }
+
+        switch (il) {
+            case IL_NOP:
+                if (BIT_RETURN(ins)) {
+                    aot_condition(f, ins);
+                    fprintf(f, "        if (csp == 0)\n            goto halt;\n        goto *calls[--csp];\n    }\n");
+                }
+                break;
+            case IL_LD:
+                if (!aot_read(f, ins, "acc"))
+                    status = AOT_ERR_UNSUPPORTED;
+                if (BIT_NEGATE_INS(ins))
+                    fprintf(f, "    aot_negate(&acc);\n");
+                break;
+            case IL_ST:
+                fprintf(f, "    v = acc;\n");
+                if (BIT_NEGATE_INS(ins))
+                    fprintf(f, "    aot_negate(&v);\n");
+                if (!aot_write(f, ins, "v"))
+                    status = AOT_ERR_UNSUPPORTED;
+                break;
+            case IL_S:
+            case IL_R:
+                if (OPERAND(ins) == N_OPERANDS)
+                    break;
+                fprintf(f, "    if (aot_truthy(acc)) {\n        v.w = %d; v.type = T_BOOL;\n", il == IL_S);
+                if (!aot_write(f, ins, "v"))
+                    status = AOT_ERR_UNSUPPORTED;
+                fprintf(f, "    }\n");
+                break;
+            case IL_NOT:
+                fprintf(f, "    aot_negate(&acc);\n");
+                break;
+            case IL_JMP:
+                aot_condition(f, ins);
+                fprintf(f, "        goto L%u;\n    }\n", INSWORD2(ins));
+                break;
+            case IL_CAL:
+                aot_condition(f, ins);
+                fprintf(f, "        if (csp == VM_CALL_DEPTH) {\n            status = VM_ERR_CALL;\n            goto halt;\n        }\n");
+                fprintf(f, "        calls[csp++] = &&R%u;\n        goto L%u;\n    }\n    R%u:\n", pc, INSWORD2(ins), pc);
+                break;
+            case IL_POP:
+                ins = pushes[--depth];
+                fprintf(f, "    v = acc;\n");
+                if (BIT_NEGATE_INS(ins))
+                    fprintf(f, "    aot_negate(&v);\n");
+                fprintf(f, "    acc = s%u;\n    OPERATE(%s, acc, v);\n", depth, aot_il_name[IL(ins)]);
+                break;
+            default:
+                if (!aot_read(f, ins, "v"))
+                    status = AOT_ERR_UNSUPPORTED;
+                if (BIT_NEGATE_INS(ins))
+                    fprintf(f, "    aot_negate(&v);\n");
+                fprintf(f, "    OPERATE(%s, acc, v);\n", aot_il_name[il]);
+        }
+    }
+
+    fprintf(f, "\n    halt:\n    vm->acc = acc;\n    return status;\n}\n");
+    if (fclose(f) != 0 && status == AOT_OK)
+        status = AOT_ERR_OPEN;
+
+    end:
+    free(depths);
+    free(pushes);
+    free(target);
+    return status;
+}
+
+#define AOT_CC_ARGS 16 // words of $CC
+
+uint8_t aot_build(const char *c_file, const char *so_file, const char *include_dir) {
+    const char *cc = getenv("CC");
+    char words[512], include[1024], *argv[AOT_CC_ARGS + 8], *save = NULL, *w;
+    int pipefd[2], err, wstatus, n = 0;
+    pid_t pid;
+
+    if (cc == NULL || *cc == '\0')
+        cc = "cc";
+    if (snprintf(words, sizeof(words), "%s", cc) >= (int) sizeof(words)
+            || snprintf(include, sizeof(include), "-I%s", include_dir) >= (int) sizeof(include))
+        return AOT_ERR_BUILD;
+
+    // paths are passed as they are, only $CC is split
+    for (w = strtok_r(words, " \t", &save); w != NULL && n < AOT_CC_ARGS; w = strtok_r(NULL, " \t", &save))
+        argv[n++] = w;
+    if (n == 0 || w != NULL)
+        return AOT_ERR_EXEC;
+    argv[n++] = "-O2";
+    argv[n++] = "-shared";
+    argv[n++] = "-fPIC";
+    argv[n++] = include;
+    argv[n++] = "-o";
+    argv[n++] = (char*) so_file;
+    argv[n++] = (char*) c_file;
+    argv[n] = NULL;
+
+    // the child reports an exec failure through a close on exec pipe
+    if (pipe(pipefd) != 0)
+        return AOT_ERR_EXEC;
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+    pid = fork();
+    if (pid < 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return AOT_ERR_EXEC;
+    }
+    if (pid == 0) {
+        close(pipefd[0]);
+        execvp(argv[0], argv);
+        err = errno;
+        n = write(pipefd[1], &err, sizeof(err));
+        _exit(127);
+    }
+    close(pipefd[1]);
+    while ((n = read(pipefd[0], &err, sizeof(err))) < 0 && errno == EINTR)
+        ;
+    close(pipefd[0]);
+
+    while (waitpid(pid, &wstatus, 0) < 0)
+        if (errno != EINTR)
+            return AOT_ERR_EXEC;
+    if (n > 0)
+        return AOT_ERR_EXEC;
+
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0 ? AOT_OK : AOT_ERR_BUILD;
+}
+
+uint8_t aot_load(aot_t *aot, const char *so_file, const char *name) {
+    memset(aot, 0, sizeof(aot_t));
+
+    aot->handle = dlopen(so_file, RTLD_NOW | RTLD_LOCAL);
+    if (aot->handle == NULL)
+        return AOT_ERR_LOAD;
+
+    *(void**) (&aot->fn) = dlsym(aot->handle, name);
+    if (aot->fn == NULL) {
+        aot_unload(aot);
+        return AOT_ERR_LOAD;
+    }
+
+    return AOT_OK;
+}
+
+void aot_unload(aot_t *aot) {
+    if (aot->handle != NULL)
+        dlclose(aot->handle);
+    memset(aot, 0, sizeof(aot_t));
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_AOT_H_
+#define LIBRELOGIC_AOT_H_
+
+#include <stdint.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+
+// AHEAD-OF-TIME C TRANSLATION
+// aot_translate() writes a C translation unit with one function per program,
+// uint8_t <name>(vm_t *vm), labels as goto targets and operands as direct vm_t
+// field and bit accesses. aot_build() compiles it with the system C compiler
+// ($CC split at blanks, or cc; run directly, no shell) to a shared object, aot_load() maps it with dlopen. The function
+// is the scan body: vm_load() the same program, then
+// vm_select(vm, VM_ENGINE_AOT, aot.fn).
+// jumps into or out of parenthesis give AOT_ERR_UNSUPPORTED.
+
+typedef enum AOT_STATUS {
+    AOT_OK,              //
+    AOT_ERR_OPEN,        // can't write C file
+    AOT_ERR_UNSUPPORTED, // program structure or operand not translated
+    AOT_ERR_BUILD,       // C compiler failed
+    AOT_ERR_LOAD,        // dlopen/dlsym failed
+    AOT_ERR_EXEC,        // can't run the C compiler (fork/exec)
+    AOT_ERR_MEMORY,      // can't allocate translation tables
+} aot_status_t;
+
+typedef struct aot {
+       void *handle;            // dlopen
+    uint8_t (*fn)(vm_t *vm);    // scan body
+} aot_t;
+
+uint8_t aot_translate(const char *file, const il_program_t *prg, const char *name);
+uint8_t aot_build(const char *c_file, const char *so_file, const char *include_dir);
+uint8_t aot_load(aot_t *aot, const char *so_file, const char *name);
+   void aot_unload(aot_t *aot);
+
+#endif /* LIBRELOGIC_AOT_H_ */
@@ -25,8 +25,10 @@
 #include <inttypes.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
 
 const char *il_commands_str[32] = {
         "NOP", // 0x00
@@ -63,31 +65,27 @@ const char *il_commands_str[32] = {
         "N1F", // 0x1f
 };
 
-const char *IlOperands[17] = {
-        "i",  // 0x00
-        "if", // 0x01
-        "f",  // 0x02
-        "r",  // 0x03
-        "m",  // 0x04
-        "mf", // 0x05
-        "c",  // 0x06
-        "b",  // 0x07
-        "t",  // 0x08
-        "q",  // 0x09
-        "qf", // 0x0a
-        "Q",  // 0x0b
-        "QF", // 0x0c
-        "T",  // 0x0d
-        "M",  // 0x0e
-        "MF", // 0x0f
-        "W",  // 0x10
+const char *IlOperands[OP_END] = {
+        "",   // 0x00
+        "i",  // 0x01
+        "if", // 0x02
+        "f",  // 0x03
+        "r",  // 0x04
+        "m",  // 0x05
+        "mf", // 0x06
+        "c",  // 0x07
+        "b",  // 0x08
+        "t",  // 0x09
+        "q",  // 0x0a
+        "qf", // 0x0b
+        "Q",  // 0x0c
+        "QF", // 0x0d
+        "T",  // 0x0e
+        "M",  // 0x0f
+        "MF", // 0x10
+        "W",  // 0x11
 };
 
-typedef struct label {
-    char label[512];
-    uint32_t line;
-} label_t;
-
 static bool isBlank(char *line) {
     char *ch;
     bool is_blank = true;
@@ -110,9 +108,9 @@ static char* ltrim(char *s) {
 
 static char* rtrim(char *s) {
     char *back = s + strlen(s);
-    while (isspace(*--back))
-        ;
-    *(back + 1) = '\0';
+    while (back > s && isspace(back[-1]))
+        --back;
+    *back = '\0';
     return s;
 }
 
@@ -121,18 +119,13 @@ static char* trim(char *s) {
 }
 
 static void strupp(char *beg) {
-    while ((*beg++ = toupper(*beg)))
-        ;
+    for (; *beg != '\0'; beg++)
+        *beg = toupper(*beg);
 }
 
 static void to_binary(uint32_t num, char *binary) {
-    if (num == 0) {
-        printf("0");
-        return;
-    }
-
     // Stores binary representation of number.
-    int binaryNum[32]; // Assuming 32 bit integer.
+    int binaryNum[32] = { 0 }; // Assuming 32 bit integer.
     int i = 0;
 
     for (; num > 0;) {
@@ -157,7 +150,10 @@ void dump_instr(uint32_t instr, char *buf) {
 
     buf[0] = '\0';
 
-    strcat(buf, il_commands_str[result.il]);
+    if (result.il == IL_NOP && result.bit_return)
+        strcat(buf, "RET");
+    else
+        strcat(buf, il_commands_str[result.il]);
     if (result.bit_nins)
         strcat(buf, "!");
     if (result.bit_cond)
@@ -166,10 +162,10 @@ void dump_instr(uint32_t instr, char *buf) {
         strcat(buf, "(");
 
     strcat(buf, " ");
-    if (IL(instr) == IL_JMP) {
+    if (IL(instr) == IL_JMP || IL(instr) == IL_CAL) {
         sprintf(tmp, "%lu", (long unsigned int) result.insword2);
         strcat(buf, tmp);
-    } else {
+    } else if (result.operand != N_OPERANDS) {
         if (result.bit_narg)
             strcat(buf, "!");
 
@@ -186,238 +182,405 @@ void dump_instr(uint32_t instr, char *buf) {
     }
 }
 
-void compile_il(char *file) {
-    uint32_t code;
-    FILE *f;
-    char line[512];
-    char ln_ins[2][50] = {"", ""};
-    char *ln = NULL;
-    char *ptr;
-    int index, pc = 0, pos = 0, labels_qty;
-    label_t *labels;
+void il_program_free(il_program_t *prg) {
+    uint32_t n;
+
+    for (n = 0; n < prg->labels_qty; n++)
+        free(prg->labels[n].label);
+    for (n = 0; n < prg->diags_qty; n++)
+        free(prg->diags[n].text);
+    free(prg->code);
+    free(prg->lines);
+    free(prg->labels);
+    free(prg->diags);
+    memset(prg, 0, sizeof(il_program_t));
+}
+
+const char* il_diag_str(uint8_t code) {
+    static const char *str[IL_DIAG_END] = {
+            [IL_ERR_OPEN]        = "can't open file",
+            [IL_ERR_MEMORY]      = "out of memory",
+            [IL_ERR_LINE]        = "line too long",
+            [IL_ERR_INSTRUCTION] = "unknown instruction",
+            [IL_ERR_ARGUMENT]    = "bad argument",
+            [IL_ERR_OPERAND]     = "unknown operand",
+            [IL_ERR_LABEL]       = "label not found",
+            [IL_ERR_REDEFINED]   = "label redefined",
+            [IL_ERR_RANGE]       = "index out of range",
+    };
+
+    return code < IL_DIAG_END ? str[code] : "";
+}
+
+// label symbol: defined (label != 0) or pending with a fixup chain
+typedef struct il_symbol {
+        char *name;   //
+    uint32_t hash;    // FNV-1a of name
+    uint32_t label;   // labels index + 1, 0 while undefined
+    uint32_t fixup;   // pc + 1 of last unresolved JMP/CAL, chained through INSWORD2
+    uint32_t line;    // first reference, for diagnostics
+    uint32_t col;     //
+} il_symbol_t;
+
+typedef struct il_symbols {
+    il_symbol_t *sym;    //
+       uint32_t qty;     //
+       uint32_t cap;     //
+       uint32_t *slot;   // open addressing, sym index + 1
+       uint32_t slots;   // power of two
+} il_symbols_t;
+
+static uint32_t il_hash(const char *s) {
+    uint32_t h = 2166136261u;
+
+    while (*s != '\0')
+        h = (h ^ (uint8_t) *s++) * 16777619u;
+
+    return h;
+}
+
+static bool il_symbols_grow(il_symbols_t *t) {
+    uint32_t n, h, slots = t->slots ? t->slots * 2 : 64;
+    uint32_t *slot = calloc(slots, sizeof(uint32_t));
+
+    if (slot == NULL)
+        return false;
+
+    for (n = 0; n < t->qty; n++) {
+        for (h = t->sym[n].hash & (slots - 1); slot[h] != 0; h = (h + 1) & (slots - 1))
+            ;
+        slot[h] = n + 1;
+    }
+    free(t->slot);
+    t->slot = slot;
+    t->slots = slots;
+
+    return true;
+}
+
+// find or insert symbol
+static il_symbol_t* il_symbol(il_symbols_t *t, const char *name) {
+    uint32_t h, hash = il_hash(name);
+    il_symbol_t *sym;
+
+    if ((t->qty + 1) * 2 > t->slots && !il_symbols_grow(t))
+        return NULL;
+
+    for (h = hash & (t->slots - 1); t->slot[h] != 0; h = (h + 1) & (t->slots - 1)) {
+        sym = &t->sym[t->slot[h] - 1];
+        if (sym->hash == hash && !strcmp(sym->name, name))
+            return sym;
+    }
+
+    if (t->qty == t->cap) {
+        sym = realloc(t->sym, (t->cap ? t->cap * 2 : 64) * sizeof(il_symbol_t));
+        if (sym == NULL)
+            return NULL;
+        t->sym = sym;
+        t->cap = t->cap ? t->cap * 2 : 64;
+    }
+    sym = &t->sym[t->qty];
+    sym->name = strdup(name);
+    if (sym->name == NULL)
+        return NULL;
+    sym->hash = hash;
+    sym->label = 0;
+    sym->fixup = 0;
+    sym->line = 0;
+    sym->col = 0;
+    t->slot[h] = ++t->qty;
+
+    return sym;
+}
+
+// grow array by doubling, *cap elements of size
+static bool il_reserve(void **array, uint32_t *cap, uint32_t len, size_t size) {
+    void *tmp;
+
+    if (len < *cap)
+        return true;
+    tmp = realloc(*array, (*cap ? *cap * 2 : 256) * size);
+    if (tmp == NULL)
+        return false;
+    *array = tmp;
+    *cap = *cap ? *cap * 2 : 256;
+
+    return true;
+}
+
+// assembler state between lines
+typedef struct il_asm {
+    il_program_t *prg;         // output
+        uint32_t code_cap;     //
+        uint32_t lines_cap;    //
+        uint32_t labels_cap;   //
+        uint32_t diags_cap;    //
+    il_symbols_t symbols;      //
+} il_asm_t;
+
+// decimal operand index, surrounding blanks allowed. IL_DIAG_END: valid
+static uint8_t il_index(const char *s, unsigned long max, unsigned long *v) {
+    char *end;
+
+    while (isspace((unsigned char) *s))
+        s++;
+    // strtoul takes signs
+    if (!isdigit((unsigned char) *s))
+        return IL_ERR_ARGUMENT;
+    errno = 0;
+    *v = strtoul(s, &end, 10);
+    while (isspace((unsigned char) *end))
+        end++;
+    if (*end != '\0')
+        return IL_ERR_ARGUMENT;
+
+    return errno == ERANGE || *v > max ? IL_ERR_RANGE : IL_DIAG_END;
+}
+
+static void il_diag(il_asm_t *as, uint8_t code, uint32_t line, uint32_t col, const char *text) {
+    il_program_t *prg = as->prg;
+    il_diag_t *diag;
+
+    // a failed allocation drops the diagnostic, the result is an error anyway
+    if (!il_reserve((void**) &prg->diags, &as->diags_cap, prg->diags_qty, sizeof(il_diag_t)))
+        return;
+
+    diag = &prg->diags[prg->diags_qty++];
+    diag->code = code;
+    diag->line = line;
+    diag->col = col;
+    diag->text = text != NULL ? strdup(text) : NULL;
+}
+
+// assemble one source line (NUL terminated, modified), nr is 1 based
+static void il_line(il_asm_t *as, char *line, uint32_t nr) {
+    il_program_t *prg = as->prg;
+    uint32_t code = 0, n, next, col[2] = { 0, 0 };
+    char ln_ins[2][512];
+    char *ln, *ptr, *src = line;
+    int index;
+    il_symbol_t *sym;
     bool mod_cond = false;
     bool mod_neg_ins = false;
     bool mod_push = false;
     bool mod_neg_arg = false;
+    bool mod_ret = false;
     bool word = false;
-    uint32_t label_line = 0;
-    uint8_t operand = 0;
+    uint8_t operand = N_OPERANDS;
+    size_t len, best;
     uint8_t arg_byte = 0, arg_bit = 0;
     uint16_t arg_word = 0;
-    uint8_t instr = 0;
+    unsigned long byte = 0, bit = 0;
+    uint8_t instr = 255, err;
 
-    labels = malloc(sizeof(label_t));
-    labels_qty = 0;
-    f = fopen(file, "r");
-    if (f == NULL) {
-        printf("Error: can't open file\n");
-        exit(1);
-    }
-
-// first pass: localize labels
-    printf("labels:\n");
-    while (fgets(line, 512, f)) {
-        if(isBlank(line))
-            continue;
+    // erase comment
+    ptr = strchr(line, ';');
+    if (ptr != NULL)
+        *ptr = '\0';
 
-        ptr = strchr(line, ':');
-        pc++;
-        if (ptr == NULL)
-            continue;
-
-        index = ptr - line;
-        memcpy(labels[pos].label, line, index);
-        labels_qty++;
-        labels[pos].line = pc;
-        printf("  [%04d] (%s)\n", labels[pos].line, labels[pos].label);
-        ++pos;
+    if (isBlank(line))
+        return;
 
-        labels = realloc(labels, (pos + 1) * sizeof(label_t));
+    if (!il_reserve((void**) &prg->code, &as->code_cap, prg->code_len, sizeof(uint32_t))
+            || !il_reserve((void**) &prg->lines, &as->lines_cap, prg->code_len, sizeof(uint32_t))) {
+        il_diag(as, IL_ERR_MEMORY, nr, 1, NULL);
+        return;
     }
-    printf("\n");
-    rewind(f);
-    pc = 0;
-
-// second pass: compile
-    printf("program:\n");
-    while (fgets(line, 512, f)) {
-        if (isBlank(line))
-            continue;
-        pc++;
-        code = 0;
-
-        // erase label
-        ptr = strchr(line, ':');
-        if (ptr != NULL) {
-            index = ptr - line;
-            memcpy(line, ptr + 1, strlen(line) - index);
-        }
-
-        // erase comment
-        ptr = strchr(line, ';');
-        if (ptr != NULL) {
-            index = ptr - line;
-            line[index] = '\0';
-        }
+    prg->lines[prg->code_len] = nr;
+    prg->code[prg->code_len++] = 0;
 
+    // label: define and resolve pending jumps
+    ptr = strchr(line, ':');
+    if (ptr != NULL) {
+        *ptr = '\0';
         ln = trim(line);
-        printf("  [%04d] %s\n", pc, ln);
-
-        index = 0;
-        ptr = strtok(ln, " ");
-        while (ptr != NULL) {
-            strcpy(ln_ins[index++], ptr);
-            ptr = strtok(NULL, " ");
+        sym = il_symbol(&as->symbols, ln);
+        if (sym == NULL || !il_reserve((void**) &prg->labels, &as->labels_cap, prg->labels_qty, sizeof(label_t))) {
+            il_diag(as, IL_ERR_MEMORY, nr, ln - src + 1, NULL);
+            return;
+        }
+        if (sym->label != 0) {
+            il_diag(as, IL_ERR_REDEFINED, nr, ln - src + 1, ln);
+        } else {
+            prg->labels[prg->labels_qty].label = sym->name;
+            prg->labels[prg->labels_qty].line = prg->code_len;
+            sym->label = ++prg->labels_qty;
+            DBG_PRINT("  [%04lu] (%s)\n", (long unsigned int) prg->code_len, sym->name);
+
+            for (n = sym->fixup; n != 0; n = next) {
+                next = INSWORD2(prg->code[n - 1]);
+                prg->code[n - 1] = (prg->code[n - 1] & ~INSWORD2(0xffffffff)) | INSWORD2((prg->code_len - 1));
+            }
+            sym->fixup = 0;
         }
+        line = ptr + 1;
+    }
 
-        mod_cond = false;
-        mod_neg_ins = false;
-        mod_push = false;
-        mod_neg_arg = false;
+    ln = trim(line);
+    DBG_PRINT("  [%04lu] %s\n", (long unsigned int) prg->code_len, ln);
 
-        instr = 255;
+    memset(ln_ins, 0, sizeof(ln_ins));
+    index = 0;
+    ptr = strtok(ln, " \t");
+    while (ptr != NULL && index < 2) {
+        col[index] = ptr - src + 1;
+        strcpy(ln_ins[index++], ptr);
+        ptr = strtok(NULL, " \t");
+    }
 
-        // search flags
-        strupp(ln_ins[0]);
-        ptr = strchr(ln_ins[0], '!');
-        if (ptr != NULL) {
-            mod_neg_ins = true;
-            index = ptr - ln_ins[0];
-            ln_ins[0][index] = ' ';
-        }
+    // search flags
+    strupp(ln_ins[0]);
+    ptr = strchr(ln_ins[0], '!');
+    if (ptr != NULL) {
+        mod_neg_ins = true;
+        index = ptr - ln_ins[0];
+        ln_ins[0][index] = ' ';
+    }
 
-        ptr = strchr(ln_ins[0], '(');
-        if (ptr != NULL) {
-            mod_push = true;
-            index = ptr - ln_ins[0];
-            ln_ins[0][index] = ' ';
-        }
+    ptr = strchr(ln_ins[0], '(');
+    if (ptr != NULL) {
+        mod_push = true;
+        index = ptr - ln_ins[0];
+        ln_ins[0][index] = ' ';
+    }
 
-        ptr = strchr(ln_ins[0], '?');
-        if (ptr != NULL) {
-            mod_cond = true;
-            index = ptr - ln_ins[0];
-            ln_ins[0][index] = ' ';
-        }
+    ptr = strchr(ln_ins[0], '?');
+    if (ptr != NULL) {
+        mod_cond = true;
+        index = ptr - ln_ins[0];
+        ln_ins[0][index] = ' ';
+    }
 
-        // search instruction
-        ln = trim(ln_ins[0]);
-        for (index = 0; index < 32; index++) {
-            if (!strcmp(ln, il_commands_str[index])) {
-                instr = index;
-                break;
-            }
+    // search instruction
+    ln = trim(ln_ins[0]);
+    // RET: NOP with return flag
+    if (!strcmp(ln, "RET")) {
+        mod_ret = true;
+        strcpy(ln, il_commands_str[IL_NOP]);
+    }
+    for (index = 0; index < 32; index++) {
+        if (!strcmp(ln, il_commands_str[index])) {
+            instr = index;
+            break;
         }
-        if (instr == 255) {
-            printf("ERROR: unknown instruction\n");
+    }
+    if (instr == 255) {
+        il_diag(as, IL_ERR_INSTRUCTION, nr, col[0], ln);
+        return;
+    }
+    DBG_PRINT("    instr: %d(%s) / neg: %d / cond: %d / push:%d\n", instr, il_commands_str[instr], mod_neg_ins, mod_cond, mod_push);
+
+    // JMP / other
+    sym = NULL;
+    if (instr == IL_JMP || instr == IL_CAL) {
+        ln = trim(ln_ins[1]);
+        sym = il_symbol(&as->symbols, ln);
+        if (sym == NULL) {
+            il_diag(as, IL_ERR_MEMORY, nr, col[1], NULL);
             return;
         }
-        DBG_PRINT("    instr: %d(%s) / neg: %d / cond: %d / push:%d\n", instr, il_commands_str[instr], mod_neg_ins, mod_cond, mod_push);
-
-        // JMP / other
-        label_line = 0;
-        bool lb = false;
-        if (instr == IL_JMP) {
-            for (index = 0; index < labels_qty + 1; index++) {
-                ptr = NULL;
-                ptr = strstr(ln_ins[1], labels[index].label);
-                if (ptr != NULL) {
-                    label_line = labels[index].line;
-                    lb = true;
-                    break;
-                }
+        if (sym->line == 0) {
+            sym->line = nr;
+            sym->col = col[1] ? col[1] : col[0];
+        }
+        DBG_PRINT("    JMP: (%s) [%04lu]\n", sym->name, (long unsigned int) (sym->label ? prg->labels[sym->label - 1].line : 0));
+    } else {
+
+        // search arguments
+        ln = trim(ln_ins[1]);
+        if (strlen(ln) > 1) {
+            ptr = strchr(ln_ins[1], '!');
+            if (ptr != NULL) {
+                mod_neg_arg = true;
+                index = ptr - ln_ins[1];
+                ln_ins[1][index] = ' ';
             }
-            if (!lb) {
-                printf("ERROR: label (%s) not found\n", ln_ins[1]);
+
+            ptr = strchr(ln_ins[1], '%');
+            if (ptr == NULL) {
+                il_diag(as, IL_ERR_ARGUMENT, nr, col[1], ln);
                 return;
             }
-            DBG_PRINT("    JMP: (%s) [%04lu]\n", labels[index].label, (long unsigned int) label_line);
-        } else {
-
-            // search arguments
-            word = false;
-            arg_byte = 0;
-            arg_bit = 0;
-            arg_word = 0;
+            index = ptr - ln_ins[1];
+            ln_ins[1][index] = ' ';
 
             ln = trim(ln_ins[1]);
-            if (strlen(ln) > 1) {
-                if (ptr != NULL) {
-                    mod_neg_arg = true;
-                    index = ptr - ln_ins[1];
-                    ln_ins[1][index] = ' ';
-                }
-
-                ptr = strchr(ln_ins[1], '%');
-                if (ptr == NULL) {
-                    printf("ERROR: bad argument\n");
-                    return;
-                }
-                index = ptr - ln_ins[1];
-                ln_ins[1][index] = ' ';
-
-                ln = trim(ln_ins[1]);
-                operand = 255;
-                for (index = 0; index < 16; index++) {
-                    ptr = strstr(ln, IlOperands[index]);
-                    if (ptr) {
-                        operand = index;
-                        break;
-                    }
-                }
-                if (operand == 255) {
-                    printf("ERROR: unknown operand\n");
-                    return;
-                }
-                ln = ptr + strlen(IlOperands[operand]);
-
-                ptr = strchr(ln, '/');
-                if (ptr != NULL) {
-                    index = 0;
-                    ptr = strtok(ln, "/");
-                    while (ptr != NULL) {
-                        strcpy(ln_ins[index++], ptr);
-                        ptr = strtok(NULL, "/");
-                    }
-
-                    arg_byte = atoi(ln_ins[0]);
-                    arg_bit = atoi(ln_ins[1]);
-                    DBG_PRINT("    arg: (byte = %d / bit = %d)\n", arg_byte, arg_bit);
-                } else {
-                    word = true;
-                    arg_word = atoi(ln);
-                    DBG_PRINT("    arg: (word = %d)\n", arg_word);
+            // longest operand name matching
+            operand = 255;
+            best = 0;
+            for (index = 1; index < OP_END; index++) {
+                len = strlen(IlOperands[index]);
+                if (len > best && !strncmp(ln, IlOperands[index], len)) {
+                    operand = index;
+                    best = len;
                 }
             }
-            DBG_PRINT("    operand type: %d(%s) / neg: %d\n", operand, IlOperands[operand], mod_neg_arg);
+            if (operand == 255) {
+                il_diag(as, IL_ERR_OPERAND, nr, col[1], ln);
+                return;
+            }
+            ln = ln + strlen(IlOperands[operand]);
+
+            ptr = strchr(ln, '/');
+            if (ptr != NULL) {
+                *ptr = '\0';
+                if ((err = il_index(ln, UINT8_MAX, &byte)) == IL_DIAG_END)
+                    err = il_index(ptr + 1, 63, &bit);
+                arg_byte = byte;
+                arg_bit = bit;
+                DBG_PRINT("    arg: (byte = %d / bit = %d)\n", arg_byte, arg_bit);
+            } else {
+                word = true;
+                err = il_index(ln, UINT16_MAX, &byte);
+                arg_word = byte;
+                DBG_PRINT("    arg: (word = %d)\n", arg_word);
+            }
+            if (err != IL_DIAG_END) {
+                if (ptr != NULL)
+                    *ptr = '/';
+                il_diag(as, err, nr, col[1], ln_ins[1] + strspn(ln_ins[1], " \t"));
+                return;
+            }
         }
+        DBG_PRINT("    operand type: %d(%s) / neg: %d\n", operand, IlOperands[operand], mod_neg_arg);
+    }
 
-        // create op
-        SET_IL(code, instr);
-        if (mod_cond)
-            SET_COND(code);
-        if (mod_neg_ins)
-            SET_NEGATE_INS(code);
-
-        if (instr == IL_JMP) {
-            SET_INSWORD2_VAL(code, label_line);
+    // create op
+    SET_IL(code, instr);
+    if (mod_cond)
+        SET_COND(code);
+    if (mod_neg_ins)
+        SET_NEGATE_INS(code);
+    if (mod_ret)
+        SET_RETURN(code);
+
+    // jump target: program address of label line, or link into the label fixup chain
+    if (instr == IL_JMP || instr == IL_CAL) {
+        if (sym->label != 0) {
+            SET_INSWORD2_VAL(code, (prg->labels[sym->label - 1].line - 1));
         } else {
-            SET_OPERAND(code, operand);
-            if (mod_push)
-                SET_PUSH(code);
-            if (mod_neg_arg)
-                SET_NEGATE_ARG(code);
-            if (word) {
-                SET_WORD(code);
-                SET_INSWORD0_VAL(code, arg_word);
-            } else {
-                SET_BYTE_VAL(code, arg_byte);
-                SET_BIT_VAL(code, arg_bit);
-            }
+            SET_INSWORD2_VAL(code, sym->fixup);
+            sym->fixup = prg->code_len;
         }
+    } else {
+        SET_OPERAND(code, operand);
+        if (mod_push)
+            SET_PUSH(code);
+        if (mod_neg_arg)
+            SET_NEGATE_ARG(code);
+        if (word) {
+            SET_WORD(code);
+            SET_INSWORD0_VAL(code, arg_word);
+        } else {
+            SET_BYTE_VAL(code, arg_byte);
+            SET_BIT_VAL(code, arg_bit);
+        }
+    }
 
-        DBG_PRINT("    OP: 0x%08x\n", code);
+    if (vm_trace != NULL) {
         char buf[254] = "";
+
+        DBG_PRINT("    OP: 0x%08x\n", code);
         to_binary(code, buf);
 
         DBG_PRINT("    ----------------------------------------\n");
@@ -432,8 +595,108 @@ void compile_il(char *file) {
         dump_instr(code, buf);
         DBG_PRINT("    < DECODE INSTR: %s", buf);
         DBG_PRINT(" >\n////////////////////////////////////////////////\n");
+    }
 
-        // TODO: write code to file
+    prg->code[prg->code_len - 1] = code;
+}
+
+// report undefined labels, release assembler state
+static bool il_finish(il_asm_t *as) {
+    il_program_t *prg = as->prg;
+    uint32_t n;
+    bool ok;
+
+    for (n = 0; n < as->symbols.qty; n++)
+        if (as->symbols.sym[n].label == 0) {
+            il_diag(as, IL_ERR_LABEL, as->symbols.sym[n].line, as->symbols.sym[n].col, as->symbols.sym[n].name);
+            free(as->symbols.sym[n].name);
+        }
+    free(as->symbols.sym);
+    free(as->symbols.slot);
+
+    ok = prg->diags_qty == 0;
+    if (!ok) {
+        // keep diagnostics only
+        for (n = 0; n < prg->labels_qty; n++)
+            free(prg->labels[n].label);
+        free(prg->code);
+        free(prg->lines);
+        free(prg->labels);
+        prg->code = NULL;
+        prg->lines = NULL;
+        prg->code_len = 0;
+        prg->labels = NULL;
+        prg->labels_qty = 0;
+    }
+
+    return ok;
+}
+
+bool compile_il_buffer(const char *buf, size_t len, il_program_t *prg) {
+    il_asm_t as = { .prg = prg };
+    char line[512];
+    size_t pos = 0, end;
+    uint32_t nr = 0;
+
+    memset(prg, 0, sizeof(il_program_t));
+
+    while (pos < len) {
+        for (end = pos; end < len && buf[end] != '\n'; end++)
+            ;
+        ++nr;
+        if (end - pos >= sizeof(line)) {
+            il_diag(&as, IL_ERR_LINE, nr, sizeof(line), NULL);
+        } else {
+            memcpy(line, buf + pos, end - pos);
+            line[end - pos] = '\0';
+            il_line(&as, line, nr);
+        }
+        pos = end + 1;
+    }
+
+    return il_finish(&as);
+}
+
+bool compile_il_stream(FILE *f, il_program_t *prg) {
+    il_asm_t as = { .prg = prg };
+    char line[512];
+    uint32_t nr = 0;
+    size_t len;
+    int ch;
+
+    memset(prg, 0, sizeof(il_program_t));
+
+    while (fgets(line, sizeof(line), f)) {
+        ++nr;
+        len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(f)) {
+            il_diag(&as, IL_ERR_LINE, nr, sizeof(line), NULL);
+            while ((ch = fgetc(f)) != EOF && ch != '\n')
+                ;
+            continue;
+        }
+        il_line(&as, line, nr);
+    }
+
+    return il_finish(&as);
+}
+
+bool compile_il(char *file, il_program_t *prg) {
+    il_asm_t as = { .prg = prg };
+    FILE *f;
+    bool res;
+
+    if (!strcmp(file, "-"))
+        return compile_il_stream(stdin, prg);
+
+    f = fopen(file, "r");
+    if (f == NULL) {
+        memset(prg, 0, sizeof(il_program_t));
+        il_diag(&as, IL_ERR_OPEN, 0, 0, file);
+        return false;
     }
+    res = compile_il_stream(f, prg);
+    fclose(f);
 
+    return res;
 }
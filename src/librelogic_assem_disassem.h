@@ -21,8 +21,56 @@
 #ifndef LIBRELOGIC_ASSEM_DISASSEM_H_
 #define LIBRELOGIC_ASSEM_DISASSEM_H_
 
-void dump_instr(uint32_t instr);
-void compile_il(char *file);
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "librelogic_newvm.h"
+
+typedef struct label {
+        char *label;
+    uint32_t line;       // source line (1 based), program address is line - 1
+} label_t;
+
+typedef enum IL_DIAG {
+    IL_ERR_OPEN,        // can't open file (text: file name)
+    IL_ERR_MEMORY,      // out of memory
+    IL_ERR_LINE,        // line longer than 511 characters
+    IL_ERR_INSTRUCTION, // unknown instruction
+    IL_ERR_ARGUMENT,    // argument without %, index not a decimal number
+    IL_ERR_OPERAND,     // unknown operand
+    IL_ERR_LABEL,       // undefined label (line/col of first reference)
+    IL_ERR_REDEFINED,   // label defined twice
+    IL_ERR_RANGE,       // index wider than its field (word 65535, byte 255, bit 63)
+    IL_DIAG_END,        //
+} il_diags_t;
+
+typedef struct il_diag {
+     uint8_t code;   // il_diags_t
+    uint32_t line;   // 1 based, 0: no line
+    uint32_t col;    // 1 based
+        char *text;  // offending token, may be NULL
+} il_diag_t;
+
+typedef struct il_program {
+     uint32_t *code;       // instructions
+     uint32_t code_len;    //
+     uint32_t *lines;      // source line of each instruction
+      label_t *labels;     //
+     uint32_t labels_qty;  //
+    il_diag_t *diags;      // errors, code and labels are empty if any
+     uint32_t diags_qty;   //
+} il_program_t;
+
+extern const char *il_commands_str[32];
+extern const char *IlOperands[OP_END];
+
+       void dump_instr(uint32_t instr, char *buf);
+       bool compile_il(char *file, il_program_t *prg);
+       bool compile_il_stream(FILE *f, il_program_t *prg);
+       bool compile_il_buffer(const char *buf, size_t len, il_program_t *prg);
+       void il_program_free(il_program_t *prg);
+const char* il_diag_str(uint8_t code);
 
 
 
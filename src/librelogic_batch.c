@@ -0,0 +1,372 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_batch.h"
+
+#define W (b->words)
+
+// constant 0 slice, operand of instructions without one
+#define ZERO(b) ((b)->base[VM_Q] + (b)->size[VM_Q] * 64)
+
+static inline bool batch_any(batch_word_t v) {
+#ifdef __AVX2__
+    return (v[0] | v[1] | v[2] | v[3]) != 0;
+#else
+    return v != 0;
+#endif
+}
+
+static bool batch_any_words(const batch_word_t *v, uint32_t words) {
+    uint32_t w;
+
+    for (w = 0; w < words; w++)
+        if (batch_any(v[w]))
+            return true;
+
+    return false;
+}
+
+static batch_word_t* batch_alloc(size_t words) {
+    batch_word_t *p;
+
+    p = aligned_alloc(64, ((words ? words : 1) * sizeof(batch_word_t) + 63) & ~((size_t) 63));
+    if (p != NULL)
+        memset(p, 0, (words ? words : 1) * sizeof(batch_word_t));
+
+    return p;
+}
+
+uint8_t batch_init(batch_t *b, uint32_t instances, const uint32_t size[VM_AREAS]) {
+    uint32_t slices;
+
+    memset(b, 0, sizeof(batch_t));
+    b->words = (instances + BATCH_WORD_BITS - 1) / BATCH_WORD_BITS;
+    b->instances = b->words * BATCH_WORD_BITS;
+    b->size[VM_I] = size[VM_I];
+    b->size[VM_M] = size[VM_M];
+    b->size[VM_Q] = size[VM_Q];
+    b->base[VM_I] = 0;
+    b->base[VM_M] = b->base[VM_I] + size[VM_I] * 64;
+    b->base[VM_Q] = b->base[VM_M] + size[VM_M] * 64;
+
+    slices = ZERO(b) + 1;
+
+    b->slices = batch_alloc((size_t) slices * W);
+    b->acc = batch_alloc(W);
+    b->active = batch_alloc(W);
+    if (b->slices == NULL || b->acc == NULL || b->active == NULL) {
+        batch_deinit(b);
+        return BATCH_ERR_MEMORY;
+    }
+
+    return BATCH_OK;
+}
+
+void batch_deinit(batch_t *b) {
+    free(b->slices);
+    free(b->acc);
+    free(b->active);
+    free(b->stack);
+    free(b->pend_acc);
+    free(b->pend_mask);
+    free(b->code);
+    memset(b, 0, sizeof(batch_t));
+}
+
+static uint8_t batch_operand(const batch_t *b, uint32_t ins, bool write, uint32_t *slice) {
+    uint8_t area;
+
+    switch (OPERAND(ins)) {
+        case N_OPERANDS:
+            *slice = ZERO(b);
+            return BATCH_OK;
+        case OP_INPUT:
+            if (write)
+                return BATCH_ERR_UNSUPPORTED;
+            area = VM_I;
+            break;
+        case OP_MEMORY:
+            area = VM_M;
+            break;
+        case OP_OUTPUT:
+        case OP_CONTACT:
+            area = VM_Q;
+            break;
+        default:
+            return BATCH_ERR_UNSUPPORTED;
+    }
+    if (BIT_WORD(ins))
+        return BATCH_ERR_UNSUPPORTED;
+    if (INSBYTE2(ins) >= b->size[area] || INSBYTE3(ins) > 63)
+        return BATCH_ERR_OPERAND;
+
+    *slice = b->base[area] + INSBYTE2(ins) * 64 + INSBYTE3(ins);
+
+    return BATCH_OK;
+}
+
+uint8_t batch_load(batch_t *b, const uint32_t *vm_program, uint32_t prg_len) {
+    batch_op_t *code;
+    uint32_t pc, ins, depth = 0, max_depth = 0, pends = 0;
+    uint8_t il, status = BATCH_OK;
+
+    code = calloc(prg_len ? prg_len : 1, sizeof(batch_op_t));
+    if (code == NULL)
+        return BATCH_ERR_MEMORY;
+
+    for (pc = 0; pc < prg_len && status == BATCH_OK; pc++) {
+        ins = vm_program[pc];
+        il = IL(ins);
+        // parenthesis depth before instruction, jumps must land outside
+        code[pc].target = depth;
+        code[pc].il = il;
+        code[pc].flags = (BIT_COND(ins) ? F_COND : 0) | (BIT_NEGATE_INS(ins) ? F_NEG_INS : 0)
+                | (BIT_NEGATE_ARG(ins) ? F_NEG_ARG : 0) | (BIT_PUSH(ins) ? F_PUSH : 0);
+
+        switch (il) {
+            case IL_NOP:
+                if (BIT_RETURN(ins))
+                    status = BATCH_ERR_UNSUPPORTED;
+                break;
+            case IL_NOT:
+                break;
+            case IL_LD:
+                status = batch_operand(b, ins, false, &code[pc].slice);
+                code[pc].flags &= ~F_PUSH;
+                break;
+            case IL_ST:
+            case IL_S:
+            case IL_R:
+                status = batch_operand(b, ins, true, &code[pc].slice);
+                code[pc].flags &= ~F_PUSH;
+                // nothing to write
+                if (code[pc].slice == ZERO(b))
+                    code[pc].il = IL_NOP;
+                break;
+            case IL_AND:
+            case IL_OR:
+            case IL_XOR:
+                status = batch_operand(b, ins, false, &code[pc].slice);
+                if (BIT_PUSH(ins) && ++depth > max_depth)
+                    max_depth = depth;
+                break;
+            case IL_POP:
+                if (depth == 0)
+                    status = BATCH_ERR_UNSUPPORTED;
+                else
+                    --depth;
+                break;
+            case IL_JMP:
+                if (INSWORD2(ins) >= prg_len || depth != 0)
+                    status = BATCH_ERR_JUMP;
+                // some lanes could loop while others go on
+                else if (INSWORD2(ins) <= pc && BIT_COND(ins))
+                    status = BATCH_ERR_DIVERGE;
+                break;
+            default:
+                status = BATCH_ERR_UNSUPPORTED;
+        }
+        if (code[pc].slice == ZERO(b))
+            code[pc].flags &= ~F_NEG_ARG;
+    }
+    if (status != BATCH_OK) {
+        free(code);
+        return status;
+    }
+
+    for (pc = 0; pc < prg_len; pc++)
+        if (code[pc].il == IL_JMP && code[INSWORD2(vm_program[pc])].target != 0) {
+            free(code);
+            return BATCH_ERR_JUMP;
+        }
+
+    // a parking slot per jump target
+    for (pc = 0; pc < prg_len; pc++) {
+        if (code[pc].il != IL_JMP) {
+            code[pc].target = 0;
+            continue;
+        }
+        code[pc].target = INSWORD2(vm_program[pc]);
+        if (code[code[pc].target].pend == 0)
+            code[code[pc].target].pend = ++pends;
+    }
+
+    free(b->stack);
+    free(b->pend_acc);
+    free(b->pend_mask);
+    free(b->code);
+    b->stack = batch_alloc((size_t) max_depth * W);
+    b->pend_acc = batch_alloc((size_t) pends * W);
+    b->pend_mask = batch_alloc((size_t) pends * W);
+    b->code = code;
+    b->code_len = prg_len;
+    b->pends = pends;
+    b->stack_depth = max_depth;
+    if (b->stack == NULL || b->pend_acc == NULL || b->pend_mask == NULL)
+        return BATCH_ERR_MEMORY;
+
+    return BATCH_OK;
+}
+
+uint8_t batch_execute(batch_t *b) {
+    const batch_op_t *op, *stack_op[b->stack_depth + 1];
+    batch_word_t *s, *acc = b->acc, *active = b->active, *pacc, *pmask, *top, c, v, zero = { 0 };
+    uint32_t pc = 0, sp = 0, w;
+    bool none;
+
+    for (w = 0; w < W; w++) {
+        acc[w] = zero;
+        active[w] = ~zero;
+    }
+    // no lane parked from an earlier scan
+    for (w = 0; w < b->pends * W; w++)
+        b->pend_mask[w] = zero;
+
+    while (pc < b->code_len) {
+        op = &b->code[pc];
+        s = b->slices + (size_t) op->slice * W;
+
+        // lanes parked here join again
+        if (op->pend) {
+            pacc = b->pend_acc + (size_t) (op->pend - 1) * W;
+            pmask = b->pend_mask + (size_t) (op->pend - 1) * W;
+            for (w = 0; w < W; w++) {
+                acc[w] = (acc[w] & active[w]) | (pacc[w] & pmask[w]);
+                active[w] |= pmask[w];
+                pmask[w] ^= pmask[w];
+            }
+        }
+        if (!batch_any_words(active, W)) {
+            ++pc;
+            continue;
+        }
+
+        switch (op->il) {
+            case IL_LD:
+                for (w = 0; w < W; w++)
+                    acc[w] = !!(op->flags & F_NEG_INS) ^ !!(op->flags & F_NEG_ARG) ? ~s[w] : s[w];
+                break;
+            case IL_ST:
+                for (w = 0; w < W; w++) {
+                    v = op->flags & F_NEG_INS ? ~acc[w] : acc[w];
+                    s[w] = (s[w] & ~active[w]) | (v & active[w]);
+                }
+                break;
+            case IL_S:
+                for (w = 0; w < W; w++)
+                    s[w] |= acc[w] & active[w];
+                break;
+            case IL_R:
+                for (w = 0; w < W; w++)
+                    s[w] &= ~(acc[w] & active[w]);
+                break;
+            case IL_AND:
+            case IL_OR:
+            case IL_XOR:
+                if (op->flags & F_PUSH) {
+                    top = b->stack + (size_t) sp * W;
+                    stack_op[sp++] = op;
+                    for (w = 0; w < W; w++) {
+                        top[w] = acc[w];
+                        if (op->slice != ZERO(b))
+                            acc[w] = op->flags & F_NEG_ARG ? ~s[w] : s[w];
+                    }
+                    break;
+                }
+                for (w = 0; w < W; w++) {
+                    v = !!(op->flags & F_NEG_INS) ^ !!(op->flags & F_NEG_ARG) ? ~s[w] : s[w];
+                    acc[w] = op->il == IL_AND ? acc[w] & v : op->il == IL_OR ? acc[w] | v : acc[w] ^ v;
+                }
+                break;
+            case IL_NOT:
+                for (w = 0; w < W; w++)
+                    acc[w] = ~acc[w];
+                break;
+            case IL_POP:
+                top = b->stack + (size_t) --sp * W;
+                for (w = 0; w < W; w++) {
+                    v = stack_op[sp]->flags & F_NEG_INS ? ~acc[w] : acc[w];
+                    acc[w] = stack_op[sp]->il == IL_AND ? top[w] & v : stack_op[sp]->il == IL_OR ? top[w] | v : top[w] ^ v;
+                }
+                break;
+            case IL_JMP:
+                // backward jumps are unconditional (batch_load): all active lanes take them
+                if (op->target <= pc) {
+                    pc = op->target;
+                    continue;
+                }
+                none = true;
+                for (w = 0; w < W; w++) {
+                    c = !(op->flags & F_COND) ? active[w] : (op->flags & F_NEG_INS ? ~acc[w] : acc[w]) & active[w];
+                    none = none && !batch_any(c);
+                }
+                if (none)
+                    break;
+                // park taken lanes at target
+                pacc = b->pend_acc + (size_t) (b->code[op->target].pend - 1) * W;
+                pmask = b->pend_mask + (size_t) (b->code[op->target].pend - 1) * W;
+                for (w = 0; w < W; w++) {
+                    c = !(op->flags & F_COND) ? active[w] : (op->flags & F_NEG_INS ? ~acc[w] : acc[w]) & active[w];
+                    pacc[w] = (pacc[w] & ~c) | (acc[w] & c);
+                    pmask[w] |= c;
+                    active[w] &= ~c;
+                }
+                break;
+        }
+        ++pc;
+    }
+
+    return BATCH_OK;
+}
+
+// word of the slice holding instance, NULL: area, instance, idx or bit out of range
+static uint64_t* batch_bit(const batch_t *b, uint8_t area, uint32_t instance, uint32_t idx, uint8_t bit) {
+    if (area >= VM_AREAS || instance >= b->instances || idx >= b->size[area] || bit > 63)
+        return NULL;
+
+    return (uint64_t*) (b->slices + (size_t) (b->base[area] + idx * 64 + bit) * W) + instance / 64;
+}
+
+uint8_t batch_set(batch_t *b, uint8_t area, uint32_t instance, uint32_t idx, uint8_t bit, bool val) {
+    uint64_t *p = batch_bit(b, area, instance, idx, bit);
+
+    if (p == NULL)
+        return BATCH_ERR_OPERAND;
+    *p = val ? *p | (uint64_t) 1 << (instance % 64) : *p & ~((uint64_t) 1 << (instance % 64));
+
+    return BATCH_OK;
+}
+
+uint8_t batch_get(const batch_t *b, uint8_t area, uint32_t instance, uint32_t idx, uint8_t bit, bool *val) {
+    const uint64_t *p = batch_bit(b, area, instance, idx, bit);
+
+    if (p == NULL)
+        return BATCH_ERR_OPERAND;
+    *val = (*p >> (instance % 64)) & 1;
+
+    return BATCH_OK;
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_BATCH_H_
+#define LIBRELOGIC_BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "librelogic_newvm.h"
+
+// BIT-SLICED BATCH
+// runs one program for many instances at once: every %i/%q/%m bit is a slice
+// holding that bit for all instances, the accumulator is one bit per instance.
+// supported: LD ST S R AND OR XOR NOT ) JMP with N, C, ( modifiers on %i %q %Q %m
+// byte/bit operands. conditional jumps diverge by masking: forward jumps park the
+// lanes at the target until execution reaches it. backward jumps must be
+// unconditional (else BATCH_ERR_DIVERGE from batch_load, use vm_execute).
+
+#ifdef __AVX2__
+typedef uint64_t batch_word_t __attribute__ ((vector_size (32)));
+#define BATCH_WORD_BITS 256
+#else
+typedef uint64_t batch_word_t;
+#define BATCH_WORD_BITS 64
+#endif
+
+typedef enum BATCH_STATUS {
+    BATCH_OK,              //
+    BATCH_ERR_MEMORY,      // can't allocate slices
+    BATCH_ERR_UNSUPPORTED, // instruction or operand out of bit subset
+    BATCH_ERR_OPERAND,     // index out of range, or batch_set()/batch_get() arguments
+    BATCH_ERR_JUMP,        // jump target out of program or inside parenthesis
+    BATCH_ERR_DIVERGE,     // conditional backward jump
+} batch_status_t;
+
+typedef struct batch_op {
+    uint32_t slice;   // operand slice
+    uint32_t target;  // JMP: program address
+    uint32_t pend;    // jump target: parked lanes slot + 1 (0: none)
+     uint8_t il;      // il_commands_t
+     uint8_t flags;   // vm_flags_t
+} batch_op_t;
+
+typedef struct batch {
+        uint32_t instances;     // multiple of BATCH_WORD_BITS
+        uint32_t words;         // batch words per slice
+        uint32_t size[VM_AREAS]; // words per area (VM_I, VM_M, VM_Q)
+        uint32_t base[VM_AREAS]; // first slice of area
+    batch_word_t *slices;       // i, m, q
+    batch_word_t *acc;          //
+    batch_word_t *active;       // lanes executing
+    batch_word_t *stack;        // parenthesis accumulators
+    batch_word_t *pend_acc;     // parked lanes accumulators
+    batch_word_t *pend_mask;    // parked lanes
+      batch_op_t *code;         //
+        uint32_t code_len;      //
+        uint32_t pends;         // parking slots
+        uint32_t stack_depth;   //
+} batch_t;
+
+uint8_t batch_init(batch_t *b, uint32_t instances, const uint32_t size[VM_AREAS]);
+   void batch_deinit(batch_t *b);
+uint8_t batch_load(batch_t *b, const uint32_t *vm_program, uint32_t prg_len);
+uint8_t batch_execute(batch_t *b);
+// BATCH_ERR_OPERAND: area not VM_I/VM_M/VM_Q, instance, idx (word) or bit out of range
+uint8_t batch_set(batch_t *b, uint8_t area, uint32_t instance, uint32_t idx, uint8_t bit, bool val);
+uint8_t batch_get(const batch_t *b, uint8_t area, uint32_t instance, uint32_t idx, uint8_t bit, bool *val);
+
+#endif /* LIBRELOGIC_BATCH_H_ */
@@ -0,0 +1,276 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_checkpoint.h"
+
+#define CHECKPOINT_SECTOR 512
+
+static inline size_t checkpoint_page(void) {
+    return sysconf(_SC_PAGESIZE);
+}
+
+static inline checkpoint_header_t* checkpoint_header(const checkpoint_t *cp, uint8_t slot) {
+    return (checkpoint_header_t*) (cp->file + slot * CHECKPOINT_SECTOR);
+}
+
+static inline uint8_t* checkpoint_slot(const checkpoint_t *cp, uint8_t slot) {
+    return cp->file + checkpoint_page() + slot * cp->slot_len;
+}
+
+static uint64_t checkpoint_sum(const checkpoint_header_t *h) {
+    const uint8_t *p = (const uint8_t*) h;
+    uint64_t sum = 0xcbf29ce484222325ull;
+
+    for (size_t n = 0; n < offsetof(checkpoint_header_t, sum); n++)
+        sum = (sum ^ p[n]) * 0x100000001b3ull;
+
+    return sum;
+}
+
+static bool checkpoint_valid(const checkpoint_t *cp, const checkpoint_header_t *h, const uint32_t size[VM_AREAS]) {
+    return h->magic == CHECKPOINT_MAGIC && h->version == CHECKPOINT_VERSION && h->seq != 0
+            && h->mem_len == cp->mem_len && memcmp(h->size, size, sizeof(h->size)) == 0 && h->sum == checkpoint_sum(h);
+}
+
+// older slot brought to the stage, only the pages that differ are written
+static uint8_t checkpoint_write(checkpoint_t *cp, uint64_t *pages) {
+    uint8_t target = (cp->slot + 1) % CHECKPOINT_SLOTS, *slot = checkpoint_slot(cp, target);
+    checkpoint_header_t *h = checkpoint_header(cp, target);
+    size_t page = checkpoint_page(), off, len;
+
+    // invalid while its pages change
+    if (h->seq != 0) {
+        h->seq = 0;
+        h->sum = checkpoint_sum(h);
+        if (msync(cp->file, page, MS_SYNC) != 0)
+            return CHECKPOINT_ERR_SYNC;
+    }
+
+    for (off = 0; off < cp->mem_len; off += page) {
+        len = cp->mem_len - off < page ? cp->mem_len - off : page;
+        if (memcmp(slot + off, cp->stage + off, len) != 0) {
+            memcpy(slot + off, cp->stage + off, len);
+            ++*pages;
+        }
+    }
+    if (msync(slot, cp->slot_len, MS_SYNC) != 0)
+        return CHECKPOINT_ERR_SYNC;
+
+    h->magic = CHECKPOINT_MAGIC;
+    h->version = CHECKPOINT_VERSION;
+    memcpy(h->size, cp->vm->size, sizeof(h->size));
+    h->mem_len = cp->mem_len;
+    h->seq = cp->seq + 1;
+    h->time = cp->stage_time;
+    h->sum = checkpoint_sum(h);
+    if (msync(cp->file, page, MS_SYNC) != 0)
+        return CHECKPOINT_ERR_SYNC;
+
+    cp->seq = h->seq;
+    cp->slot = target;
+
+    return CHECKPOINT_OK;
+}
+
+static void* checkpoint_writer(void *arg) {
+    checkpoint_t *cp = arg;
+    uint64_t pages;
+    uint8_t status;
+
+    pthread_mutex_lock(&cp->lock);
+    for (;;) {
+        while (!cp->busy && cp->run)
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        // a pending snapshot is written before stopping
+        if (!cp->busy)
+            break;
+        pthread_mutex_unlock(&cp->lock);
+
+        pages = 0;
+        status = checkpoint_write(cp, &pages);
+
+        pthread_mutex_lock(&cp->lock);
+        cp->status = status;
+        cp->pages += pages;
+        if (status == CHECKPOINT_OK)
+            ++cp->written;
+        __atomic_store_n(&cp->busy, false, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&cp->cond);
+    }
+    pthread_mutex_unlock(&cp->lock);
+
+    return NULL;
+}
+
+// timers continue from the snapshot time, the wheel is rebuilt
+static void checkpoint_restore(checkpoint_t *cp) {
+    vm_t *vm = cp->vm;
+
+    vm->time = cp->time;
+    // T dropped in the last scan, the update never came
+    for (uint32_t n = 0; n < vm->size[VM_T]; n++)
+        if (!vm->t[n].en)
+            vm->t[n].q = false;
+    vm_timer_resolution(vm, 1);
+}
+
+uint8_t checkpoint_open(checkpoint_t *cp, const char *path, vm_t *vm, const uint32_t size[VM_AREAS],
+        uint32_t interval) {
+    const checkpoint_header_t *h;
+    size_t page = checkpoint_page();
+    struct stat st;
+    uint8_t slot;
+    void *p;
+    int fd;
+
+    memset(cp, 0, sizeof(checkpoint_t));
+    pthread_mutex_init(&cp->lock, NULL);
+    pthread_cond_init(&cp->cond, NULL);
+    cp->vm = vm;
+    cp->mem_len = vm_mem_len(size);
+    cp->slot_len = cp->mem_len ? (cp->mem_len + page - 1) / page * page : page;
+    cp->file_len = page + CHECKPOINT_SLOTS * cp->slot_len;
+    cp->interval = interval ? interval : 1;
+    cp->countdown = cp->interval;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        goto error_file;
+    if (fstat(fd, &st) != 0 || ((size_t) st.st_size != cp->file_len && ftruncate(fd, cp->file_len) != 0)) {
+        close(fd);
+        goto error_file;
+    }
+    p = mmap(NULL, cp->file_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        goto error_file;
+    }
+    cp->file = p;
+
+    // last good snapshot of this layout
+    for (slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+        h = checkpoint_header(cp, slot);
+        if (checkpoint_valid(cp, h, size) && h->seq > cp->seq) {
+            cp->seq = h->seq;
+            cp->slot = slot;
+            cp->time = h->time;
+        }
+    }
+    cp->restored = cp->seq != 0;
+
+    // restored pages are read from the file on first access. the writer only
+    // rewrites a page of this slot when it differs, so after the vm wrote it
+    if (cp->restored)
+        p = mmap(NULL, cp->slot_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, page + cp->slot * cp->slot_len);
+    else
+        p = mmap(NULL, cp->slot_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        goto error_file;
+    cp->storage = p;
+
+    cp->stage = aligned_alloc(64, cp->slot_len);
+    if (cp->stage == NULL || vm_init_at(vm, size, cp->storage) != VM_OK) {
+        checkpoint_close(cp);
+        return CHECKPOINT_ERR_MEMORY;
+    }
+    if (cp->restored)
+        checkpoint_restore(cp);
+
+    cp->run = true;
+    if (pthread_create(&cp->thread, NULL, checkpoint_writer, cp) != 0) {
+        checkpoint_close(cp);
+        return CHECKPOINT_ERR_THREAD;
+    }
+    cp->started = true;
+
+    return CHECKPOINT_OK;
+
+    error_file:
+    checkpoint_close(cp);
+    return CHECKPOINT_ERR_FILE;
+}
+
+void checkpoint_scan(checkpoint_t *cp) {
+    if (--cp->countdown != 0)
+        return;
+    cp->countdown = cp->interval;
+
+    // never waits for the writer
+    if (__atomic_load_n(&cp->busy, __ATOMIC_ACQUIRE)) {
+        ++cp->skipped;
+        return;
+    }
+    memcpy(cp->stage, cp->vm->mem, cp->mem_len);
+    cp->stage_time = cp->vm->time;
+
+    pthread_mutex_lock(&cp->lock);
+    __atomic_store_n(&cp->busy, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&cp->cond);
+    pthread_mutex_unlock(&cp->lock);
+}
+
+uint8_t checkpoint_save(checkpoint_t *cp) {
+    uint8_t status;
+
+    pthread_mutex_lock(&cp->lock);
+    while (cp->busy)
+        pthread_cond_wait(&cp->cond, &cp->lock);
+    memcpy(cp->stage, cp->vm->mem, cp->mem_len);
+    cp->stage_time = cp->vm->time;
+    __atomic_store_n(&cp->busy, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&cp->cond);
+    while (cp->busy)
+        pthread_cond_wait(&cp->cond, &cp->lock);
+    status = cp->status;
+    pthread_mutex_unlock(&cp->lock);
+
+    return status;
+}
+
+void checkpoint_close(checkpoint_t *cp) {
+    if (cp->started) {
+        pthread_mutex_lock(&cp->lock);
+        cp->run = false;
+        pthread_cond_broadcast(&cp->cond);
+        pthread_mutex_unlock(&cp->lock);
+        pthread_join(cp->thread, NULL);
+    }
+    if (cp->storage != NULL)
+        munmap(cp->storage, cp->slot_len);
+    if (cp->file != NULL)
+        munmap(cp->file, cp->file_len);
+    free(cp->stage);
+    pthread_mutex_destroy(&cp->lock);
+    pthread_cond_destroy(&cp->cond);
+    memset(cp, 0, sizeof(checkpoint_t));
+}
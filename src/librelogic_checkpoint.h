@@ -0,0 +1,107 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_CHECKPOINT_H_
+#define LIBRELOGIC_CHECKPOINT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "librelogic_newvm.h"
+
+// RETENTIVE CHECKPOINT
+// the vm areas are saved to a file: [header page][slot 0][slot 1], a slot holds a
+// copy of the whole areas block (vm_mem_len(), page rounded). every interval scans
+// checkpoint_scan() copies the areas to a staging buffer at the scan boundary and
+// a writer thread updates the older slot from it, writing only the pages that
+// differ: the slot is marked invalid and synced, the changed pages are copied and
+// synced, then the slot header gets the next sequence number and is synced. a
+// crash at any point leaves the other slot intact. checkpoint_open() restores the
+// slot with the highest valid sequence: it is mapped copy on write as the vm
+// storage, so a warm restart costs the page faults of the state actually touched.
+// vm->time must go on from checkpoint->time, timers continue where they stopped
+// (the downtime doesn't count). the areas are not in shared memory: don't use
+// with export_create().
+
+#define CHECKPOINT_MAGIC   0x5450434c // "LCPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_SLOTS   2
+
+typedef enum CHECKPOINT_STATUS {
+    CHECKPOINT_OK,         //
+    CHECKPOINT_ERR_FILE,   // open/ftruncate/mmap failed
+    CHECKPOINT_ERR_SYNC,   // msync failed, the slot stays invalid
+    CHECKPOINT_ERR_MEMORY, // can't allocate staging buffer or init the vm areas
+    CHECKPOINT_ERR_THREAD, // can't create writer thread
+} checkpoint_status_t;
+
+// one per slot, 512 bytes apart: a header is never torn across sectors
+typedef struct checkpoint_header {
+    uint32_t magic;            //
+    uint32_t version;          //
+    uint32_t size[VM_AREAS];   // elements per area
+    uint64_t mem_len;          // vm_mem_len()
+    uint64_t seq;              // 0: invalid
+    uint64_t time;             // vm->time at the snapshot
+    uint64_t sum;              // fnv-1a of the fields above
+} checkpoint_header_t;
+
+typedef struct checkpoint {
+             vm_t *vm;        //
+          uint8_t *file;      // mapped file
+           size_t file_len;   //
+          uint8_t *storage;   // vm areas: restored slot (private) or anonymous
+          uint8_t *stage;     // areas at the last boundary
+           size_t mem_len;    // vm_mem_len()
+           size_t slot_len;   // page rounded
+         uint64_t seq;        // last valid snapshot
+          uint8_t slot;       // slot of seq
+         uint64_t time;       // restored vm->time
+         uint64_t stage_time; //
+             bool restored;   // areas from a snapshot
+         uint32_t interval;   // scans between snapshots
+         uint32_t countdown;  //
+    // statistics
+         uint64_t written;    // snapshots
+         uint64_t pages;      // pages written
+         uint64_t skipped;    // writer still busy at interval
+          uint8_t status;     // last write
+    // writer
+        pthread_t thread;     //
+             bool started;    //
+             bool busy;       // stage to write
+             bool run;        //
+  pthread_mutex_t lock;       //
+   pthread_cond_t cond;       //
+} checkpoint_t;
+
+// vm initialized on the file areas, restored from the last good snapshot if any
+uint8_t checkpoint_open(checkpoint_t *cp, const char *path, vm_t *vm, const uint32_t size[VM_AREAS],
+                        uint32_t interval);
+// scan thread, after vm_execute()
+   void checkpoint_scan(checkpoint_t *cp);
+// snapshot now and wait for it, scan stopped
+uint8_t checkpoint_save(checkpoint_t *cp);
+// vm_deinit() before checkpoint_close()
+   void checkpoint_close(checkpoint_t *cp);
+
+#endif /* LIBRELOGIC_CHECKPOINT_H_ */
@@ -0,0 +1,206 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_export.h"
+
+#define EXPORT_AREAS (((sizeof(export_header_t) + 63) / 64) * 64)
+
+static void export_area(export_header_t *h, uint8_t operand, const void *base, uint32_t count, size_t size,
+        size_t field) {
+    h->operand[operand].offset = (const uint8_t*) base - (const uint8_t*) h;
+    h->operand[operand].count = count;
+    h->operand[operand].size = size;
+    h->operand[operand].field = field;
+}
+
+// vm areas in the segment, vm_deinit() before export_close()
+uint8_t export_create(export_t *e, const char *name, vm_t *vm, const uint32_t size[VM_AREAS]) {
+    export_header_t *h;
+    size_t len = EXPORT_AREAS + vm_mem_len(size);
+    void *shm;
+    int fd;
+
+    memset(e, 0, sizeof(export_t));
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+        return EXPORT_ERR_SHM;
+    if (ftruncate(fd, len) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return EXPORT_ERR_SHM;
+    }
+    shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        shm_unlink(name);
+        return EXPORT_ERR_SHM;
+    }
+
+    e->shm = h = shm;
+    e->len = len;
+    e->owner = true;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    if (vm_init_at(vm, size, (uint8_t*) shm + EXPORT_AREAS) != VM_OK) {
+        export_close(e);
+        return EXPORT_ERR_MEMORY;
+    }
+    vm->generation = &h->generation;
+
+    h->version = EXPORT_VERSION;
+    h->len = len;
+    memcpy(h->size, size, sizeof(h->size));
+    export_area(h, OP_INPUT,        vm->i,      size[VM_I],      sizeof(uint64_t),     0);
+    export_area(h, OP_REAL_INPUT,   vm->i_real, size[VM_I_REAL], sizeof(double),       0);
+    export_area(h, OP_FALLING,      vm->i_fall, size[VM_I],      sizeof(uint64_t),     0);
+    export_area(h, OP_RISING,       vm->i_rise, size[VM_I],      sizeof(uint64_t),     0);
+    export_area(h, OP_MEMORY,       vm->m,      size[VM_M],      sizeof(uint64_t),     0);
+    export_area(h, OP_REAL_MEMORY,  vm->m_real, size[VM_M_REAL], sizeof(double),       0);
+    export_area(h, OP_COMMAND,      vm->c,      size[VM_C],      sizeof(uint64_t),     0);
+    export_area(h, OP_BLINKOUT,     vm->b,      size[VM_B],      sizeof(vm_blinker_t), offsetof(vm_blinker_t, q));
+    export_area(h, OP_TIMEOUT,      vm->t,      size[VM_T],      sizeof(vm_timer_t),   offsetof(vm_timer_t, q));
+    export_area(h, OP_OUTPUT,       vm->q,      size[VM_Q],      sizeof(uint64_t),     0);
+    export_area(h, OP_REAL_OUTPUT,  vm->q_real, size[VM_Q_REAL], sizeof(double),       0);
+    export_area(h, OP_CONTACT,      vm->q,      size[VM_Q],      sizeof(uint64_t),     0);
+    export_area(h, OP_REAL_CONTACT, vm->q_real, size[VM_Q_REAL], sizeof(double),       0);
+    export_area(h, OP_START,        vm->t,      size[VM_T],      sizeof(vm_timer_t),   offsetof(vm_timer_t, en));
+    export_area(h, OP_PULSEIN,      vm->m,      size[VM_M],      sizeof(uint64_t),     0);
+    export_area(h, OP_REAL_MEMIN,   vm->m_real, size[VM_M_REAL], sizeof(double),       0);
+    export_area(h, OP_WRITE,        vm->c,      size[VM_C],      sizeof(uint64_t),     0);
+    // published last, readers check it
+    __atomic_store_n(&h->magic, EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+    return EXPORT_OK;
+}
+
+uint8_t export_attach(export_t *e, const char *name) {
+    struct stat st;
+    void *shm;
+    int fd;
+
+    memset(e, 0, sizeof(export_t));
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return EXPORT_ERR_SHM;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(export_header_t)) {
+        close(fd);
+        return EXPORT_ERR_FORMAT;
+    }
+    shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return EXPORT_ERR_SHM;
+
+    e->shm = shm;
+    e->len = st.st_size;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    if (__atomic_load_n(&e->shm->magic, __ATOMIC_ACQUIRE) != EXPORT_MAGIC || e->shm->version != EXPORT_VERSION
+            || e->shm->len > e->len) {
+        export_close(e);
+        return EXPORT_ERR_FORMAT;
+    }
+
+    return EXPORT_OK;
+}
+
+void export_close(export_t *e) {
+    if (e->shm != NULL)
+        munmap(e->shm, e->len);
+    if (e->owner)
+        shm_unlink(e->name);
+    memset(e, 0, sizeof(export_t));
+}
+
+// element idx of operand (its value field), NULL if out of range
+const void* export_operand(const export_t *e, uint8_t operand, uint32_t idx) {
+    const export_area_t *a;
+
+    if (operand >= OP_END)
+        return NULL;
+    a = &e->shm->operand[operand];
+    if (a->offset == 0 || idx >= a->count)
+        return NULL;
+
+    return (const uint8_t*) e->shm + a->offset + (size_t) idx * a->size + a->field;
+}
+
+static inline void export_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline uint64_t export_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// even generation to read from, waits while a scan runs
+uint64_t export_begin(const export_t *e) {
+    uint64_t g;
+
+    export_begin_wait(e, UINT64_MAX, &g);
+
+    return g;
+}
+
+// false: still scanning after timeout ns (writer stalled or dead)
+bool export_begin_wait(const export_t *e, uint64_t timeout, uint64_t *generation) {
+    uint64_t g, start = 0;
+    uint32_t n;
+
+    for (n = 0; (g = __atomic_load_n(&e->shm->generation, __ATOMIC_ACQUIRE)) & 1; n++) {
+        if (n < EXPORT_SPIN) {
+            export_pause();
+            continue;
+        }
+        if (start == 0)
+            start = export_now();
+        else if (export_now() - start >= timeout)
+            return false;
+        sched_yield();
+    }
+    *generation = g;
+
+    return true;
+}
+
+// true: a scan ran while reading, read again
+bool export_retry(const export_t *e, uint64_t generation) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&e->shm->generation, __ATOMIC_RELAXED) != generation;
+}
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_EXPORT_H_
+#define LIBRELOGIC_EXPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "librelogic_newvm.h"
+
+// SHARED MEMORY EXPORT
+// the vm areas live in a named POSIX shared memory segment: [header][vm areas].
+// the header describes, for every il_operands_t, where its elements are: element k
+// of operand o is at offset + k * size + field from the segment start (t/T/b are
+// the q/en fields of the timer and blinker structs, f/r the edge images).
+// readers map the segment read only and read in place, no copy on the vm side.
+// vm_execute() makes the generation odd while the scan runs and even after it, a
+// reader takes g = export_begin(), reads, and retries while export_retry(g).
+// export_begin() spins EXPORT_SPIN times then yields until the scan ends, a
+// writer stopped mid scan blocks it: export_begin_wait() gives up after timeout.
+// inputs copied in by a sched input callback are written before the generation
+// moves, read them with the same check if the exact scan matters.
+
+#define EXPORT_MAGIC   0x5850584c // "LXPX"
+#define EXPORT_VERSION 1
+#define EXPORT_SPIN    1000
+
+typedef enum EXPORT_STATUS {
+    EXPORT_OK,         //
+    EXPORT_ERR_SHM,    // shm_open/ftruncate/mmap failed
+    EXPORT_ERR_FORMAT, // attached segment is not an export segment of this version
+    EXPORT_ERR_MEMORY, // can't init the vm areas
+} export_status_t;
+
+typedef struct export_area {
+    uint64_t offset;  // first element, from segment start. 0: no area
+    uint32_t count;   // elements
+    uint16_t size;    // element size
+    uint16_t field;   // value offset in the element
+} export_area_t;
+
+typedef struct export_header {
+         uint32_t magic;                //
+         uint32_t version;              //
+         uint64_t generation;           // odd while a scan runs
+         uint64_t len;                  // segment length
+         uint32_t size[VM_AREAS];       // elements per area
+    export_area_t operand[OP_END];      // by il_operands_t
+} export_header_t;
+
+typedef struct export {
+    export_header_t *shm;      //
+             size_t len;       // mapped length
+               char name[64];  // shm name
+               bool owner;     // created: unlinked by export_close()
+} export_t;
+
+   uint8_t export_create(export_t *e, const char *name, vm_t *vm, const uint32_t size[VM_AREAS]);
+   uint8_t export_attach(export_t *e, const char *name);
+      void export_close(export_t *e);
+const void* export_operand(const export_t *e, uint8_t operand, uint32_t idx);
+  uint64_t export_begin(const export_t *e);
+      bool export_begin_wait(const export_t *e, uint64_t timeout, uint64_t *generation);
+      bool export_retry(const export_t *e, uint64_t generation);
+
+#endif /* LIBRELOGIC_EXPORT_H_ */
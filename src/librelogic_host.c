@@ -0,0 +1,321 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_host.h"
+
+#define NS 1000000000ull
+#define HOST_ALIGN(x) (((x) + 63) & ~((size_t) 63))
+
+static inline uint64_t host_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS + ts.tv_nsec;
+}
+
+static inline void host_sleep(uint64_t t) {
+    struct timespec ts = { .tv_sec = t / NS, .tv_nsec = t % NS };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+static inline void host_inc(uint64_t *cnt, uint64_t n) {
+    __atomic_store_n(cnt, *cnt + n, __ATOMIC_RELAXED);
+}
+
+static inline void host_max(uint64_t *max, uint64_t v) {
+    if (v > *max)
+        __atomic_store_n(max, v, __ATOMIC_RELAXED);
+}
+
+// len bytes of the worker arena, 64 bytes aligned. NULL: full
+static void* host_alloc(host_worker_t *w, size_t len) {
+    void *p;
+
+    if (len > w->host->arena_len - w->used)
+        return NULL;
+    p = w->arena + w->used;
+    w->used += HOST_ALIGN(len);
+    if (w->used > w->host->arena_len)
+        w->used = w->host->arena_len;
+
+    return p;
+}
+
+// claims prg for period and scans it. false: done for period or scanning
+static bool host_scan(host_program_t *prg, uint64_t period, uint64_t time, bool steal) {
+    uint64_t state = __atomic_load_n(&prg->state, __ATOMIC_ACQUIRE), t0;
+    uint8_t status;
+
+    if (state >> 1 >= period)
+        return false;
+    if (state & 1) {
+        if (!steal)
+            host_inc(&prg->overruns, 1);
+        return false;
+    }
+    if (!__atomic_compare_exchange_n(&prg->state, &state, period << 1 | 1, false, __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE))
+        return false;
+
+    t0 = host_now();
+    if (prg->inputs != NULL)
+        prg->inputs(&prg->vm, prg->ctx);
+    prg->vm.time = time;
+    status = vm_execute(&prg->vm);
+    if (prg->outputs != NULL)
+        prg->outputs(&prg->vm, prg->ctx);
+
+    __atomic_store_n(&prg->status, status, __ATOMIC_RELAXED);
+    if (status != VM_OK)
+        host_inc(&prg->errors, 1);
+    if (steal)
+        host_inc(&prg->stolen, 1);
+    host_inc(&prg->scans, 1);
+    host_max(&prg->scan_max, host_now() - t0);
+
+    __atomic_store_n(&prg->state, period << 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static void* host_worker(void *arg) {
+    host_worker_t *w = arg, *victim;
+    host_t *host = w->host;
+    uint64_t release, period, late, now;
+    uint8_t *arena;
+    uint32_t n, v, q;
+
+    // mapped and touched after pinning: pages on the local node
+    arena = mmap(NULL, host->arena_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+        arena = NULL;
+    else
+        memset(arena, 0, host->arena_len);
+
+    pthread_mutex_lock(&host->lock);
+    w->arena = arena;
+    host->failed |= arena == NULL;
+    ++host->ready;
+    pthread_cond_broadcast(&host->cond);
+    while (!host->go)
+        pthread_cond_wait(&host->cond, &host->lock);
+    pthread_mutex_unlock(&host->lock);
+
+    release = host->start;
+    while (__atomic_load_n(&host->run, __ATOMIC_ACQUIRE)) {
+        host_sleep(release);
+        if (!__atomic_load_n(&host->run, __ATOMIC_ACQUIRE))
+            break;
+        period = (release - host->start) / host->period + 1;
+
+        // own queue in order, then the other queues from the end
+        for (n = 0; n < w->queued; n++)
+            host_scan(host->program[w->queue[n]], period, (release - host->start) / 1000000, false);
+        __atomic_store_n(&w->done, period, __ATOMIC_RELEASE);
+        // only from a victim still on its own queue steal_after ns past the release
+        for (v = 1; v < host->workers; v++) {
+            victim = &host->worker[(w - host->worker + v) % host->workers];
+            if (__atomic_load_n(&victim->done, __ATOMIC_ACQUIRE) >= period)
+                continue;
+            if (host_now() < release + host->steal_after)
+                host_sleep(release + host->steal_after);
+            if (__atomic_load_n(&victim->done, __ATOMIC_ACQUIRE) >= period)
+                continue;
+            for (q = victim->queued; q-- > 0;)
+                if (host_scan(host->program[victim->queue[q]], period, (release - host->start) / 1000000, true))
+                    host_inc(&w->steals, 1);
+        }
+        host_inc(&w->periods, 1);
+
+        // next release, skipping the ones already past
+        release += host->period;
+        now = host_now();
+        if (now > release) {
+            late = (now - release) / host->period + 1;
+            host_inc(&w->late, late);
+            release += late * host->period;
+        }
+    }
+
+    return NULL;
+}
+
+uint8_t host_init(host_t *host, uint32_t workers, const int *cpus, int priority, size_t arena_len) {
+    struct sched_param param;
+    pthread_attr_t attr;
+    cpu_set_t set;
+    host_worker_t *w;
+    uint32_t n;
+    int err;
+
+    memset(host, 0, sizeof(host_t));
+    if (workers == 0 || workers > HOST_MAX_WORKERS || arena_len == 0)
+        return HOST_ERR_PARAM;
+    pthread_mutex_init(&host->lock, NULL);
+    pthread_cond_init(&host->cond, NULL);
+    host->workers = workers;
+    host->arena_len = HOST_ALIGN(arena_len);
+    host->run = true;
+
+    for (n = 0; n < workers; n++) {
+        w = &host->worker[n];
+        w->host = host;
+        pthread_attr_init(&attr);
+        if (cpus != NULL) {
+            CPU_ZERO(&set);
+            CPU_SET(cpus[n], &set);
+            w->pinned = pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0;
+        }
+        if (priority > 0) {
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            param.sched_priority = priority;
+            pthread_attr_setschedparam(&attr, &param);
+        }
+        err = pthread_create(&w->thread, &attr, host_worker, w);
+        pthread_attr_destroy(&attr);
+        w->rt = err == 0 && priority > 0;
+        // not permitted: default policy, no affinity
+        if (err != 0) {
+            w->pinned = false;
+            if (pthread_create(&w->thread, NULL, host_worker, w) != 0) {
+                host_free(host);
+                return HOST_ERR_THREAD;
+            }
+        }
+        ++host->threads;
+    }
+
+    pthread_mutex_lock(&host->lock);
+    while (host->ready < host->threads)
+        pthread_cond_wait(&host->cond, &host->lock);
+    pthread_mutex_unlock(&host->lock);
+    if (host->failed) {
+        host_free(host);
+        return HOST_ERR_MEMORY;
+    }
+
+    return HOST_OK;
+}
+
+uint8_t host_add(host_t *host, const uint32_t *vm_program, uint32_t prg_len, const uint32_t size[VM_AREAS],
+        void (*inputs)(vm_t*, void*), void (*outputs)(vm_t*, void*), void *ctx, uint8_t *status) {
+    host_program_t *prg;
+    host_worker_t *w;
+    void *mem, *code;
+    size_t mark;
+    uint32_t n;
+    uint8_t st;
+
+    if (host->go || host->programs == HOST_MAX_PROGRAMS)
+        return HOST_ERR_PARAM;
+
+    // least loaded worker
+    for (w = &host->worker[0], n = 1; n < host->workers; n++)
+        if (host->worker[n].load < w->load)
+            w = &host->worker[n];
+
+    mark = w->used;
+    prg = host_alloc(w, sizeof(host_program_t));
+    mem = host_alloc(w, vm_mem_len(size));
+    code = host_alloc(w, vm_code_len(prg_len));
+    if (prg == NULL || mem == NULL || code == NULL) {
+        w->used = mark;
+        return HOST_ERR_MEMORY;
+    }
+
+    memset(prg, 0, sizeof(host_program_t));
+    if ((st = vm_init_at(&prg->vm, size, mem)) == VM_OK)
+        st = vm_load_at(&prg->vm, vm_program, prg_len, code);
+    if (status != NULL)
+        *status = st;
+    if (st != VM_OK) {
+        w->used = mark;
+        return HOST_ERR_LOAD;
+    }
+
+    prg->worker = w - host->worker;
+    prg->inputs = inputs;
+    prg->outputs = outputs;
+    prg->ctx = ctx;
+    w->queue[w->queued++] = host->programs;
+    w->load += prg_len;
+    host->program[host->programs++] = prg;
+
+    return HOST_OK;
+}
+
+uint8_t host_start(host_t *host, uint64_t period) {
+    if (period == 0 || host->go)
+        return HOST_ERR_PARAM;
+
+    pthread_mutex_lock(&host->lock);
+    host->period = period;
+    if (host->steal_after == 0 || host->steal_after >= period)
+        host->steal_after = period / HOST_STEAL_DIV;
+    host->start = host_now();
+    host->go = true;
+    pthread_cond_broadcast(&host->cond);
+    pthread_mutex_unlock(&host->lock);
+
+    return HOST_OK;
+}
+
+void host_stop(host_t *host) {
+    uint32_t n;
+
+    pthread_mutex_lock(&host->lock);
+    __atomic_store_n(&host->run, false, __ATOMIC_RELEASE);
+    host->go = true;
+    pthread_cond_broadcast(&host->cond);
+    pthread_mutex_unlock(&host->lock);
+
+    for (n = 0; n < host->threads; n++)
+        pthread_join(host->worker[n].thread, NULL);
+    host->threads = 0;
+}
+
+void host_free(host_t *host) {
+    uint32_t n;
+
+    host_stop(host);
+    for (n = 0; n < host->programs; n++)
+        vm_deinit(&host->program[n]->vm);
+    for (n = 0; n < host->workers; n++)
+        if (host->worker[n].arena != NULL)
+            munmap(host->worker[n].arena, host->arena_len);
+    pthread_mutex_destroy(&host->lock);
+    pthread_cond_destroy(&host->cond);
+    memset(host, 0, sizeof(host_t));
+}
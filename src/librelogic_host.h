@@ -0,0 +1,120 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_HOST_H_
+#define LIBRELOGIC_HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "librelogic_newvm.h"
+
+// MULTI-PROGRAM HOST
+// runs many independent programs, each one on its own vm, on a pool of worker
+// threads pinned one per cpu. every worker maps its arena and touches it after
+// pinning, so the pages come from its local NUMA node (first touch). host_add()
+// places the vm_t, the areas and the pre-decoded code of a program in the arena of
+// the least loaded worker, 64 bytes aligned: no two vms share a cache line. rungs
+// and segments from vm_fuse()/vm_segment() are still allocated on the heap.
+// every period each worker scans the programs it owns. when a worker is still on
+// its own queue steal_after ns past the release (a long scan, or not scheduled),
+// the idle workers steal the programs it did not start yet, from the end of its
+// queue; under normal load every scan stays on its owner. set steal_after before
+// host_start(). a program is never scanned by two workers at once: a program
+// still running when the next period comes is skipped and counted as an overrun.
+// vm->time is the period release time in ms since host_start(). add programs
+// between host_init() and host_start().
+
+#define HOST_MAX_WORKERS  64
+#define HOST_MAX_PROGRAMS 256
+#define HOST_STEAL_DIV    2   // default steal_after: period / HOST_STEAL_DIV
+
+typedef enum HOST_STATUS {
+    HOST_OK,         //
+    HOST_ERR_PARAM,  // bad period, worker count, too many programs or running
+    HOST_ERR_MEMORY, // can't map an arena or arena full
+    HOST_ERR_THREAD, // can't create worker thread
+    HOST_ERR_LOAD,   // vm_load_at() failed, see host_add() load status
+} host_status_t;
+
+typedef struct host_program {
+        vm_t vm;                                  // in the owner arena
+    uint32_t worker;                              // arena owner
+        void (*inputs)(vm_t *vm, void *ctx);      // before scan, may be NULL
+        void (*outputs)(vm_t *vm, void *ctx);     // after scan, may be NULL
+        void *ctx;                                //
+    uint64_t state;                               // last period claimed << 1 | scanning
+    // statistics, updated by the scanning worker
+    uint64_t scans;                               //
+    uint64_t overruns;                            // periods skipped, still scanning
+    uint64_t stolen;                              // scans by another worker
+    uint64_t errors;                              // scans not VM_OK
+     uint8_t status;                              // last vm_execute() result
+    uint64_t scan_max;                            // ns
+} host_program_t;
+
+typedef struct host_worker {
+    struct host *host;                            //
+      uint8_t *arena;                             // mapped by the worker
+       size_t used;                               //
+     uint32_t queue[HOST_MAX_PROGRAMS];           // owned programs
+     uint32_t queued;                             //
+     uint64_t load;                               // instructions owned
+     uint64_t done;                               // last period its own queue was scanned
+    pthread_t thread;                             //
+         bool pinned;                             // affinity set
+         bool rt;                                 // running SCHED_FIFO
+    // statistics
+     uint64_t periods;                            //
+     uint64_t late;                               // periods skipped, woke up too late
+     uint64_t steals;                             //
+} host_worker_t;
+
+typedef struct host {
+     host_worker_t worker[HOST_MAX_WORKERS];      //
+          uint32_t workers;                       //
+          uint32_t threads;                       // started workers
+    host_program_t *program[HOST_MAX_PROGRAMS];   //
+          uint32_t programs;                      //
+            size_t arena_len;                     // per worker
+          uint64_t period;                        // ns
+          uint64_t steal_after;                   // ns past the release, 0: default
+          uint64_t start;                         // CLOCK_MONOTONIC ns
+          uint32_t ready;                         // arenas mapped
+              bool failed;                        // an arena can't be mapped
+              bool go;                            // host_start()
+              bool run;                           // cleared by host_stop()
+   pthread_mutex_t lock;                          // ready / go
+    pthread_cond_t cond;                          //
+} host_t;
+
+// cpus: one per worker, may be NULL. priority > 0: SCHED_FIFO workers
+uint8_t host_init(host_t *host, uint32_t workers, const int *cpus, int priority, size_t arena_len);
+// program appended to host->program[], status: vm_load_at() result, may be NULL
+uint8_t host_add(host_t *host, const uint32_t *vm_program, uint32_t prg_len, const uint32_t size[VM_AREAS],
+                 void (*inputs)(vm_t*, void*), void (*outputs)(vm_t*, void*), void *ctx, uint8_t *status);
+uint8_t host_start(host_t *host, uint64_t period);
+   void host_stop(host_t *host);
+// stops, releases the vms and the arenas
+   void host_free(host_t *host);
+
+#endif /* LIBRELOGIC_HOST_H_ */
@@ -0,0 +1,224 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+#include "librelogic_image.h"
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; n++) {
+        c = n;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+// image_write()/image_load() may run on several threads at once
+static uint32_t crc32(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    pthread_once(&crc_once, crc_init);
+
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+// max parenthesis nesting and elements used per area
+static void image_requirements(const uint32_t *code, uint32_t code_len, image_header_t *hdr) {
+    uint32_t pc, ins, idx, depth = 0;
+    uint8_t il, operand;
+
+    for (pc = 0; pc < code_len; pc++) {
+        ins = code[pc];
+        il = IL(ins);
+
+        if (il == IL_JMP || il == IL_CAL)
+            continue;
+
+        if (il >= IL_AND && il <= IL_LT && il != IL_NOT && BIT_PUSH(ins)) {
+            if (++depth > hdr->stack_depth)
+                hdr->stack_depth = depth;
+        } else if (il == IL_POP && depth > 0)
+            --depth;
+
+        operand = OPERAND(ins);
+        if (operand == N_OPERANDS || operand >= OP_END)
+            continue;
+
+        idx = BIT_WORD(ins) ? INSWORD0(ins) : INSBYTE2(ins);
+        if (idx + 1 > hdr->size[vm_operand_area[operand]])
+            hdr->size[vm_operand_area[operand]] = idx + 1;
+    }
+}
+
+uint8_t image_write(const char *file, const il_program_t *prg) {
+    image_header_t hdr;
+    image_label_t *labels;
+    char *strings;
+    uint32_t n, len, pos = 0, crc;
+    uint8_t status = IMAGE_OK;
+    FILE *f;
+
+    memset(&hdr, 0, sizeof(image_header_t));
+    hdr.magic = IMAGE_MAGIC;
+    hdr.version = IMAGE_VERSION;
+    hdr.header_len = sizeof(image_header_t);
+    hdr.code_len = prg->code_len;
+    hdr.labels_qty = prg->labels_qty;
+    for (n = 0; n < prg->labels_qty; n++)
+        hdr.strings_len += strlen(prg->labels[n].label) + 1;
+    image_requirements(prg->code, prg->code_len, &hdr);
+
+    labels = malloc((prg->labels_qty ? prg->labels_qty : 1) * sizeof(image_label_t));
+    strings = malloc(hdr.strings_len ? hdr.strings_len : 1);
+    if (labels == NULL || strings == NULL) {
+        status = IMAGE_ERR_WRITE;
+        goto end;
+    }
+
+    for (n = 0; n < prg->labels_qty; n++) {
+        len = strlen(prg->labels[n].label) + 1;
+        labels[n].address = prg->labels[n].line - 1;
+        labels[n].name = pos;
+        memcpy(strings + pos, prg->labels[n].label, len);
+        pos += len;
+    }
+
+    crc = crc32(0, &hdr, offsetof(image_header_t, checksum));
+    crc = crc32(crc, prg->code, prg->code_len * sizeof(uint32_t));
+    crc = crc32(crc, labels, prg->labels_qty * sizeof(image_label_t));
+    crc = crc32(crc, strings, hdr.strings_len);
+    hdr.checksum = crc;
+
+    f = fopen(file, "wb");
+    if (f == NULL) {
+        status = IMAGE_ERR_OPEN;
+        goto end;
+    }
+    if (fwrite(&hdr, sizeof(image_header_t), 1, f) != 1
+            || fwrite(prg->code, sizeof(uint32_t), prg->code_len, f) != prg->code_len
+            || fwrite(labels, sizeof(image_label_t), prg->labels_qty, f) != prg->labels_qty
+            || fwrite(strings, 1, hdr.strings_len, f) != hdr.strings_len)
+        status = IMAGE_ERR_WRITE;
+    if (fclose(f) != 0)
+        status = IMAGE_ERR_WRITE;
+
+    end:
+    free(labels);
+    free(strings);
+    return status;
+}
+
+uint8_t image_load(const char *file, image_t *img) {
+    const image_header_t *hdr;
+    const uint8_t *base;
+    struct stat st;
+    uint64_t len;
+    uint32_t crc, n;
+    void *map;
+    int fd;
+
+    memset(img, 0, sizeof(image_t));
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return IMAGE_ERR_OPEN;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return IMAGE_ERR_OPEN;
+    }
+    if ((size_t) st.st_size < sizeof(image_header_t)) {
+        close(fd);
+        return IMAGE_ERR_FORMAT;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return IMAGE_ERR_OPEN;
+
+    img->map = map;
+    img->map_len = st.st_size;
+    base = map;
+    hdr = map;
+
+    if (hdr->magic != IMAGE_MAGIC || hdr->header_len != sizeof(image_header_t))
+        goto format;
+    if (hdr->version != IMAGE_VERSION) {
+        image_unload(img);
+        return IMAGE_ERR_VERSION;
+    }
+
+    len = (uint64_t) hdr->header_len + (uint64_t) hdr->code_len * sizeof(uint32_t)
+            + (uint64_t) hdr->labels_qty * sizeof(image_label_t) + hdr->strings_len;
+    if (len != (uint64_t) st.st_size)
+        goto format;
+
+    img->header = hdr;
+    img->code = (const uint32_t*) (base + hdr->header_len);
+    img->labels = (const image_label_t*) (img->code + hdr->code_len);
+    img->strings = (const char*) (img->labels + hdr->labels_qty);
+
+    if (hdr->strings_len && img->strings[hdr->strings_len - 1] != '\0')
+        goto format;
+    for (n = 0; n < hdr->labels_qty; n++)
+        if (img->labels[n].name >= hdr->strings_len || img->labels[n].address >= hdr->code_len)
+            goto format;
+
+    crc = crc32(0, hdr, offsetof(image_header_t, checksum));
+    crc = crc32(crc, base + hdr->header_len, st.st_size - hdr->header_len);
+    if (crc != hdr->checksum) {
+        image_unload(img);
+        return IMAGE_ERR_CHECKSUM;
+    }
+
+    return IMAGE_OK;
+
+    format:
+    image_unload(img);
+    return IMAGE_ERR_FORMAT;
+}
+
+void image_unload(image_t *img) {
+    if (img->map != NULL)
+        munmap(img->map, img->map_len);
+    memset(img, 0, sizeof(image_t));
+}
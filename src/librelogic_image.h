@@ -0,0 +1,78 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_IMAGE_H_
+#define LIBRELOGIC_IMAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+
+// PROGRAM IMAGE
+// [header][code: code_len x uint32_t][labels: labels_qty x image_label_t][strings]
+// all fields in host byte order, checksum: crc32 of header (up to checksum) and
+// everything after the header. code starts 8 byte aligned so a mapped image can
+// be handed to vm_load() as it is.
+
+#define IMAGE_MAGIC   0x4d49524c // "LRIM"
+#define IMAGE_VERSION 1
+
+typedef enum IMAGE_STATUS {
+    IMAGE_OK,           //
+    IMAGE_ERR_OPEN,     // can't open/map file
+    IMAGE_ERR_WRITE,    // can't write file
+    IMAGE_ERR_FORMAT,   // bad magic or truncated image
+    IMAGE_ERR_VERSION,  // unsupported version
+    IMAGE_ERR_CHECKSUM, // corrupted image
+} image_status_t;
+
+typedef struct image_header {
+    uint32_t magic;            //
+    uint16_t version;          //
+    uint16_t header_len;       // sizeof(image_header_t)
+    uint32_t code_len;         // instructions
+    uint32_t labels_qty;       //
+    uint32_t strings_len;      // label names, '\0' terminated
+    uint32_t stack_depth;      // max parenthesis nesting
+    uint32_t size[VM_AREAS];   // elements used per area
+    uint32_t checksum;         //
+} image_header_t;
+
+typedef struct image_label {
+    uint32_t address;          // program address
+    uint32_t name;             // offset in strings
+} image_label_t;
+
+typedef struct image {
+    const image_header_t *header;  //
+          const uint32_t *code;    //
+     const image_label_t *labels;  //
+              const char *strings; //
+                    void *map;     //
+                  size_t map_len;  //
+} image_t;
+
+uint8_t image_write(const char *file, const il_program_t *prg);
+uint8_t image_load(const char *file, image_t *img);
+   void image_unload(image_t *img);
+
+#endif /* LIBRELOGIC_IMAGE_H_ */
@@ -0,0 +1,438 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_jit.h"
+
+#if defined(__x86_64__)
+
+// rax: accumulator, r8d: accumulator type (T_BOOL/T_WORD), rdx: operand,
+// rcx: operand address, rsi/r9: scratch, rdi: vm, rbp: frame for error exits
+
+#define JIT_OP_MAX 80 // bytes emitted per op, upper bound
+
+typedef struct emit {
+    uint8_t *buf;        //
+     size_t pos;         //
+     size_t *at;         // native offset of each op
+     size_t *jumps;      // rel32 positions to patch
+   uint32_t *targets;    // program address of each jump
+   uint32_t jumps_qty;   //
+     size_t *errors;     // rel32 positions to the division error exit
+   uint32_t errors_qty;  //
+} emit_t;
+
+#define E(...) emit_bytes(e, (const uint8_t[]) { __VA_ARGS__ }, sizeof((const uint8_t[]) { __VA_ARGS__ }))
+
+static inline void emit_bytes(emit_t *e, const uint8_t *b, size_t n) {
+    memcpy(e->buf + e->pos, b, n);
+    e->pos += n;
+}
+
+static inline void emit32(emit_t *e, uint32_t v) {
+    memcpy(e->buf + e->pos, &v, 4);
+    e->pos += 4;
+}
+
+// rel32 already emitted at pos, unaligned
+static inline void patch32(emit_t *e, size_t pos, int32_t v) {
+    memcpy(e->buf + pos, &v, 4);
+}
+
+static inline void emit64(emit_t *e, uint64_t v) {
+    memcpy(e->buf + e->pos, &v, 8);
+    e->pos += 8;
+}
+
+// mov rcx, imm64
+static void emit_address(emit_t *e, const void *p) {
+    E(0x48, 0xB9);
+    emit64(e, (uint64_t) (uintptr_t) p);
+}
+
+// mov r8d, type
+static void emit_type(emit_t *e, uint8_t type) {
+    E(0x41, 0xB8);
+    emit32(e, type);
+}
+
+// negate rdx of known type
+static void emit_negate_rdx(emit_t *e, uint8_t type) {
+    if (type == T_BOOL)
+        E(0x83, 0xF2, 0x01);       // xor edx, 1
+    else
+        E(0x48, 0xF7, 0xD2);       // not rdx
+}
+
+// negate rax (reg 0) or rdx (reg 2) of type r8d
+static void emit_negate_dynamic(emit_t *e, uint8_t reg) {
+    E(0x45, 0x85, 0xC0);           // test r8d, r8d
+    E(0x75, 0x05);                 // jnz word
+    E(0x83, 0xF0 | reg, 0x01);     // xor reg32, 1
+    E(0xEB, 0x03);                 // jmp end
+    E(0x48, 0xF7, 0xD0 | reg);     // word: not reg
+}
+
+// rdx = operand (G applied), returns its type
+static uint8_t emit_load(emit_t *e, const vm_op_t *op) {
+    uint8_t type = T_WORD;
+
+    switch (op->kind) {
+        case K_NONE:
+            E(0x31, 0xD2);             // xor edx, edx
+            return T_BOOL;
+        case K_BIT:
+        case K_WORD:
+            emit_address(e, op->arg.w);
+            E(0x48, 0x8B, 0x11);       // mov rdx, [rcx]
+            break;
+        case K_TIMER_Q:
+            emit_address(e, &op->arg.t->q);
+            goto byte;
+        case K_TIMER_EN:
+            emit_address(e, &op->arg.t->en);
+            goto byte;
+        case K_BLINK:
+            emit_address(e, &op->arg.b->q);
+            byte:
+            E(0x0F, 0xB6, 0x11);       // movzx edx, byte [rcx]
+            type = T_BOOL;
+            break;
+    }
+
+    if (op->mask) {
+        if (__builtin_ctzll(op->mask))
+            E(0x48, 0xC1, 0xEA, __builtin_ctzll(op->mask)); // shr rdx, bit
+        E(0x83, 0xE2, 0x01);       // and edx, 1
+        type = T_BOOL;
+    }
+
+    if (op->flags & F_NEG_ARG)
+        emit_negate_rdx(e, type);
+
+    return type;
+}
+
+// write rdx (ST) or constant (S: 1, R: 0) if rax
+static void emit_store(emit_t *e, const vm_op_t *op) {
+    uint8_t bit = __builtin_ctzll(op->mask | ((uint64_t) 1 << 63));
+
+    if (op->kind == K_NONE)
+        return;
+
+    emit_address(e, op->arg.w);
+    switch (op->il) {
+        case IL_ST:
+            if (op->kind == K_WORD) {
+                E(0x48, 0x89, 0x11);             // mov [rcx], rdx
+                return;
+            }
+            E(0x48, 0x85, 0xD2);                 // test rdx, rdx
+            E(0x74, 0x07);                       // jz clear
+            E(0x48, 0x0F, 0xBA, 0x29, bit);      // bts [rcx], bit
+            E(0xEB, 0x05);                       // jmp end
+            E(0x48, 0x0F, 0xBA, 0x31, bit);      // clear: btr [rcx], bit
+            return;
+        case IL_S:
+        case IL_R:
+            E(0x48, 0x85, 0xC0);                 // test rax, rax
+            if (op->kind == K_WORD) {
+                E(0x74, 0x07);                   // jz end
+                E(0x48, 0xC7, 0x01);             // mov qword [rcx], imm32
+                emit32(e, op->il == IL_S);
+                return;
+            }
+            E(0x74, 0x05);                       // jz end
+            E(0x48, 0x0F, 0xBA, op->il == IL_S ? 0x29 : 0x31, bit); // bts/btr [rcx], bit
+            return;
+    }
+}
+
+// rax = rax <il> rdx, r9d: rax type if known dynamically (parenthesis)
+static void emit_operation(emit_t *e, uint8_t il, uint8_t type, bool pop) {
+    static const uint8_t setcc[] = {
+            [IL_GT] = 0x9F, [IL_GE] = 0x9D, [IL_EQ] = 0x94,
+            [IL_NE] = 0x95, [IL_LE] = 0x9E, [IL_LT] = 0x9C
+    };
+
+    switch (il) {
+        case IL_AND:
+            E(0x48, 0x21, 0xD0);                 // and rax, rdx
+            goto bitwise;
+        case IL_OR:
+            E(0x48, 0x09, 0xD0);                 // or rax, rdx
+            goto bitwise;
+        case IL_XOR:
+            E(0x48, 0x31, 0xD0);                 // xor rax, rdx
+            bitwise:
+            // bool only if both bool
+            if (pop)
+                E(0x45, 0x09, 0xC8);             // or r8d, r9d
+            else if (type == T_WORD)
+                emit_type(e, T_WORD);
+            return;
+        case IL_ADD:
+            E(0x48, 0x01, 0xD0);                 // add rax, rdx
+            break;
+        case IL_SUB:
+            E(0x48, 0x29, 0xD0);                 // sub rax, rdx
+            break;
+        case IL_MUL:
+            E(0x48, 0x0F, 0xAF, 0xC2);           // imul rax, rdx
+            break;
+        case IL_DIV:
+            if (pop)
+                E(0x45, 0x89, 0xC8);             // mov r8d, r9d
+            E(0x48, 0x85, 0xD2);                 // test rdx, rdx
+            E(0x0F, 0x84);                       // jz error
+            e->errors[e->errors_qty++] = e->pos;
+            emit32(e, 0);
+            E(0x48, 0x89, 0xD6);                 // mov rsi, rdx
+            // INT64_MIN / -1 traps: negate, wraps like the interpreter
+            E(0x48, 0x83, 0xFE, 0xFF);           // cmp rsi, -1
+            E(0x75, 0x05);                       // jne div
+            E(0x48, 0xF7, 0xD8);                 // neg rax
+            E(0xEB, 0x05);                       // jmp done
+            E(0x48, 0x99);                       // div: cqo
+            E(0x48, 0xF7, 0xFE);                 // idiv rsi
+            break;                               // done:
+        default:
+            E(0x48, 0x39, 0xD0);                 // cmp rax, rdx
+            E(0x0F, setcc[il], 0xC0);            // setcc al
+            E(0x0F, 0xB6, 0xC0);                 // movzx eax, al
+            emit_type(e, T_BOOL);
+            return;
+    }
+    emit_type(e, T_WORD);
+}
+
+static bool jit_supported(const vm_op_t *op) {
+    switch (op->il) {
+        case IL_CAL:
+            return false;
+        case IL_NOP:
+            return !(op->flags & F_RETURN);
+        case IL_ST:
+        case IL_S:
+        case IL_R:
+            return op->kind == K_NONE || op->kind == K_BIT || op->kind == K_WORD;
+        default:
+            return op->kind != K_REAL;
+    }
+}
+
+uint8_t jit_compile(jit_t *jit, const vm_t *vm) {
+    const vm_op_t *code = vm->code, *op, **pushes = NULL;
+    uint32_t pc, n, depth = 0, *depths = NULL;
+    uint8_t type, status = JIT_OK;
+    size_t len;
+    emit_t e_, *e = &e_;
+    void *buf;
+
+    memset(jit, 0, sizeof(jit_t));
+    memset(e, 0, sizeof(emit_t));
+    if (code == NULL)
+        return JIT_ERR_UNSUPPORTED;
+
+    // structure: parenthesis live on the machine stack, jumps can't cross them
+    depths = calloc(vm->code_len + 1, sizeof(uint32_t));
+    pushes = calloc(vm->code_len + 1, sizeof(vm_op_t*));
+    e->at = calloc(vm->code_len + 1, sizeof(size_t));
+    e->jumps = calloc(vm->code_len + 1, sizeof(size_t));
+    e->targets = calloc(vm->code_len + 1, sizeof(uint32_t));
+    e->errors = calloc(vm->code_len + 1, sizeof(size_t));
+    if (depths == NULL || pushes == NULL || e->at == NULL || e->jumps == NULL || e->targets == NULL
+            || e->errors == NULL) {
+        status = JIT_ERR_MEMORY;
+        goto end;
+    }
+
+    for (pc = 0; pc < vm->code_len; pc++) {
+        op = &code[pc];
+        depths[pc] = depth;
+        if (!jit_supported(op)) {
+            status = JIT_ERR_UNSUPPORTED;
+            goto end;
+        }
+        if (op->flags & F_PUSH)
+            ++depth;
+        else if (op->il == IL_POP && depth-- == 0)
+            status = JIT_ERR_UNSUPPORTED;
+        else if ((op->il == IL_JMP) && depth != 0)
+            status = JIT_ERR_UNSUPPORTED;
+    }
+    for (pc = 0; pc < vm->code_len && status == JIT_OK; pc++)
+        if (code[pc].il == IL_JMP && depths[code[pc].target] != 0)
+            status = JIT_ERR_UNSUPPORTED;
+    if (status != JIT_OK)
+        goto end;
+
+    len = ((size_t) vm->code_len * JIT_OP_MAX + 256 + 4095) & ~(size_t) 4095;
+    buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        status = JIT_ERR_MEMORY;
+        goto end;
+    }
+    e->buf = buf;
+
+    E(0x55);                                     // push rbp
+    E(0x48, 0x89, 0xE5);                         // mov rbp, rsp
+    E(0x31, 0xC0);                               // xor eax, eax
+    E(0x45, 0x31, 0xC0);                         // xor r8d, r8d
+
+    depth = 0;
+    for (pc = 0; pc < vm->code_len; pc++) {
+        op = &code[pc];
+        e->at[pc] = e->pos;
+
+        if (op->flags & F_PUSH) {
+            // save accumulator, pending operation known at compile time
+            pushes[depth++] = op;
+            E(0x50);                             // push rax
+            E(0x41, 0x50);                       // push r8
+            if (op->kind != K_NONE) {
+                type = emit_load(e, op);
+                E(0x48, 0x89, 0xD0);             // mov rax, rdx
+                emit_type(e, type);
+            }
+            continue;
+        }
+
+        switch (op->il) {
+            case IL_NOP:
+                break;
+            case IL_LD:
+                type = emit_load(e, op);
+                if (op->flags & F_NEG_INS)
+                    emit_negate_rdx(e, type);
+                E(0x48, 0x89, 0xD0);             // mov rax, rdx
+                emit_type(e, type);
+                break;
+            case IL_ST:
+                E(0x48, 0x89, 0xC2);             // mov rdx, rax
+                if (op->flags & F_NEG_INS)
+                    emit_negate_dynamic(e, 2);
+                emit_store(e, op);
+                break;
+            case IL_S:
+            case IL_R:
+                emit_store(e, op);
+                break;
+            case IL_NOT:
+                emit_negate_dynamic(e, 0);
+                break;
+            case IL_POP:
+                op = pushes[--depth];
+                E(0x48, 0x89, 0xC2);             // mov rdx, rax
+                if (op->flags & F_NEG_INS)
+                    emit_negate_dynamic(e, 2);
+                E(0x41, 0x59);                   // pop r9
+                E(0x58);                         // pop rax
+                emit_operation(e, op->il, T_WORD, true);
+                break;
+            case IL_JMP:
+                if (op->flags & F_COND) {
+                    E(0x48, 0x85, 0xC0);         // test rax, rax
+                    E(0x0F, op->flags & F_NEG_INS ? 0x84 : 0x85); // jz/jnz
+                } else {
+                    E(0xE9);                     // jmp
+                }
+                e->jumps[e->jumps_qty] = e->pos;
+                e->targets[e->jumps_qty++] = op->target;
+                emit32(e, 0);
+                break;
+            default:
+                type = emit_load(e, op);
+                if (op->flags & F_NEG_INS)
+                    emit_negate_rdx(e, type);
+                emit_operation(e, op->il, type, false);
+        }
+    }
+    e->at[vm->code_len] = e->pos;
+
+    // store accumulator, status VM_OK
+    E(0x48, 0x89, 0x87);                         // mov [rdi + acc.w], rax
+    emit32(e, offsetof(vm_t, acc) + offsetof(vm_value_t, w));
+    E(0x44, 0x88, 0x87);                         // mov [rdi + acc.type], r8b
+    emit32(e, offsetof(vm_t, acc) + offsetof(vm_value_t, type));
+    E(0x31, 0xC0);                               // xor eax, eax
+    E(0x48, 0x89, 0xEC);                         // mov rsp, rbp
+    E(0x5D);                                     // pop rbp
+    E(0xC3);                                     // ret
+
+    // division by zero
+    for (n = 0; n < e->errors_qty; n++)
+        patch32(e, e->errors[n], (int32_t) (e->pos - (e->errors[n] + 4)));
+    E(0x48, 0x89, 0x87);                         // mov [rdi + acc.w], rax
+    emit32(e, offsetof(vm_t, acc) + offsetof(vm_value_t, w));
+    E(0x44, 0x88, 0x87);                         // mov [rdi + acc.type], r8b
+    emit32(e, offsetof(vm_t, acc) + offsetof(vm_value_t, type));
+    E(0xB8);                                     // mov eax, VM_ERR_DIV_ZERO
+    emit32(e, VM_ERR_DIV_ZERO);
+    E(0x48, 0x89, 0xEC);                         // mov rsp, rbp
+    E(0x5D);                                     // pop rbp
+    E(0xC3);                                     // ret
+
+    for (n = 0; n < e->jumps_qty; n++)
+        patch32(e, e->jumps[n], (int32_t) (e->at[e->targets[n]] - (e->jumps[n] + 4)));
+
+    if (mprotect(buf, len, PROT_READ | PROT_EXEC) != 0) {
+        munmap(buf, len);
+        status = JIT_ERR_MEMORY;
+        goto end;
+    }
+
+    jit->buf = buf;
+    jit->len = len;
+    jit->fn = (uint8_t (*)(vm_t*)) buf;
+
+    end:
+    free(depths);
+    free(pushes);
+    free(e->at);
+    free(e->jumps);
+    free(e->targets);
+    free(e->errors);
+    return status;
+}
+
+#else
+
+uint8_t jit_compile(jit_t *jit, const vm_t *vm) {
+    (void) vm;
+    memset(jit, 0, sizeof(jit_t));
+    return JIT_ERR_ARCH;
+}
+
+#endif
+
+void jit_free(jit_t *jit) {
+    if (jit->buf != NULL)
+        munmap(jit->buf, jit->len);
+    memset(jit, 0, sizeof(jit_t));
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_JIT_H_
+#define LIBRELOGIC_JIT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "librelogic_newvm.h"
+
+// X86-64 JIT
+// compiles the pre-decoded program of a vm to native code: the accumulator lives
+// in rax (type in r8), operand addresses and bit masks are immediates, JMP are
+// native branches and parenthesis use the machine stack.
+// supported: every instruction but CAL/RET on boolean and word operands; real
+// operands, counters (M) and timer inputs (T) as targets, and jumps into or out
+// of parenthesis give JIT_ERR_UNSUPPORTED and the vm stays on the interpreter.
+// select with vm_select(vm, VM_ENGINE_JIT, jit.fn).
+
+typedef enum JIT_STATUS {
+    JIT_OK,              //
+    JIT_ERR_MEMORY,      // can't map code buffer
+    JIT_ERR_UNSUPPORTED, // instruction or operand not compiled
+    JIT_ERR_ARCH,        // not an x86-64 host
+} jit_status_t;
+
+typedef struct jit {
+    uint8_t *buf;              // executable code
+     size_t len;               // mapped length
+    uint8_t (*fn)(vm_t *vm);   // compiled scan body
+} jit_t;
+
+uint8_t jit_compile(jit_t *jit, const vm_t *vm);
+   void jit_free(jit_t *jit);
+
+#endif /* LIBRELOGIC_JIT_H_ */
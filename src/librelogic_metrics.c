@@ -0,0 +1,147 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "librelogic_metrics.h"
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint8_t metrics_create(metrics_t *m, const char *name, uint32_t tasks) {
+    void *shm;
+    int fd;
+
+    memset(m, 0, sizeof(metrics_t));
+    if (tasks > METRICS_TASKS)
+        return METRICS_ERR_SHM;
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+        return METRICS_ERR_SHM;
+    if (ftruncate(fd, sizeof(metrics_shm_t)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return METRICS_ERR_SHM;
+    }
+    shm = mmap(NULL, sizeof(metrics_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        shm_unlink(name);
+        return METRICS_ERR_SHM;
+    }
+
+    m->shm = shm;
+    m->owner = true;
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->shm->tasks = tasks;
+    m->shm->version = METRICS_VERSION;
+    // published last, readers check it
+    __atomic_store_n(&m->shm->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+
+    return METRICS_OK;
+}
+
+uint8_t metrics_attach(metrics_t *m, const char *name) {
+    struct stat st;
+    void *shm;
+    int fd;
+
+    memset(m, 0, sizeof(metrics_t));
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return METRICS_ERR_SHM;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(metrics_shm_t)) {
+        close(fd);
+        return METRICS_ERR_FORMAT;
+    }
+    shm = mmap(NULL, sizeof(metrics_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return METRICS_ERR_SHM;
+
+    m->shm = shm;
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    if (__atomic_load_n(&m->shm->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC || m->shm->version != METRICS_VERSION) {
+        metrics_close(m);
+        return METRICS_ERR_FORMAT;
+    }
+
+    return METRICS_OK;
+}
+
+void metrics_close(metrics_t *m) {
+    if (m->shm != NULL)
+        munmap(m->shm, sizeof(metrics_shm_t));
+    if (m->owner)
+        shm_unlink(m->name);
+    memset(m, 0, sizeof(metrics_t));
+}
+
+metrics_task_t* metrics_task(metrics_t *m, uint32_t task, const char *name) {
+    if (m->shm == NULL || task >= m->shm->tasks)
+        return NULL;
+    if (name != NULL)
+        snprintf(m->shm->task[task].name, sizeof(m->shm->task[task].name), "%s", name);
+
+    return &m->shm->task[task];
+}
+
+// upper bound of the bucket holding the p (0..1) quantile, at most the maximum
+uint64_t metrics_percentile(const metrics_hist_t *h, double p) {
+    uint64_t total = __atomic_load_n(&h->total, __ATOMIC_RELAXED), max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    uint64_t rank, sum = 0, bound;
+    uint32_t b, group;
+
+    if (total == 0)
+        return 0;
+
+    rank = (uint64_t) (p * total);
+    if (rank >= total)
+        rank = total - 1;
+
+    for (b = 0; b < METRICS_BUCKETS; b++) {
+        sum += __atomic_load_n(&h->count[b], __ATOMIC_RELAXED);
+        if (sum > rank)
+            break;
+    }
+    if (b == METRICS_BUCKETS)
+        return max;
+    if (b < METRICS_SUB)
+        return b;
+
+    group = b / METRICS_SUB;
+    bound = ((uint64_t) (METRICS_SUB + b % METRICS_SUB + 1) << (group - 1)) - 1;
+    return bound < max ? bound : max;
+}
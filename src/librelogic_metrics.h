@@ -0,0 +1,99 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_METRICS_H_
+#define LIBRELOGIC_METRICS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// SCAN METRICS
+// per task log-linear histograms (16 sub-buckets per power of two, ~6% error)
+// of scan time and wakeup jitter in ns plus counters, in a POSIX shared memory
+// segment. the scheduler thread is the only writer and uses relaxed atomic
+// stores, a monitor attaches read only with metrics_attach() and never blocks it.
+
+#define METRICS_MAGIC   0x4d52544d // "MTRM"
+#define METRICS_VERSION 1
+#define METRICS_SUB     16
+#define METRICS_BUCKETS (61 * METRICS_SUB)
+#define METRICS_TASKS   16
+
+typedef enum METRICS_STATUS {
+    METRICS_OK,         //
+    METRICS_ERR_SHM,    // shm_open/ftruncate/mmap failed
+    METRICS_ERR_FORMAT, // attached segment is not a metrics segment of this version
+} metrics_status_t;
+
+typedef struct metrics_hist {
+    uint64_t count[METRICS_BUCKETS];  //
+    uint64_t total;                   // samples
+    uint64_t max;                     //
+} metrics_hist_t;
+
+typedef struct metrics_task {
+              char name[32];        //
+    metrics_hist_t scan;            // scan time, ns
+    metrics_hist_t jitter;          // wakeup - release, ns
+          uint64_t scans;           //
+          uint64_t overruns;        //
+          uint64_t deadline_misses; //
+          uint64_t errors;          //
+          uint64_t instructions;    // dispatched by the interpreter (superinstruction: 1)
+} metrics_task_t;
+
+typedef struct metrics_shm {
+          uint32_t magic;                  //
+          uint32_t version;                //
+          uint32_t tasks;                  //
+          uint32_t reserved;               //
+    metrics_task_t task[METRICS_TASKS];    //
+} metrics_shm_t;
+
+typedef struct metrics {
+    metrics_shm_t *shm;      //
+             char name[64];  // shm name
+             bool owner;     // created: unlinked by metrics_close()
+} metrics_t;
+
+       uint8_t metrics_create(metrics_t *m, const char *name, uint32_t tasks);
+       uint8_t metrics_attach(metrics_t *m, const char *name);
+          void metrics_close(metrics_t *m);
+metrics_task_t* metrics_task(metrics_t *m, uint32_t task, const char *name);
+      uint64_t metrics_percentile(const metrics_hist_t *h, double p);
+      uint64_t metrics_now(void);
+
+// single writer
+static inline void metrics_record(metrics_hist_t *h, uint64_t v) {
+    uint32_t msb, b;
+
+    if (v < METRICS_SUB) {
+        b = v;
+    } else {
+        msb = 63 - __builtin_clzll(v);
+        b = (msb - 3) * METRICS_SUB + ((v >> (msb - 4)) & (METRICS_SUB - 1));
+    }
+    __atomic_store_n(&h->count[b], h->count[b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+    if (v > h->max)
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+#endif /* LIBRELOGIC_METRICS_H_ */
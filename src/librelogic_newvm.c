@@ -25,138 +25,2189 @@
 #include <inttypes.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#ifdef VM_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #include "librelogic_newvm.h"
 
+#define VM_ALIGN(x) (((x) + 63) & ~((size_t) 63))
+
+// handlers beyond il_commands_t
+enum VM_HANDLERS {
+    H_PUSH = 0x20, // AND( .. LT(
+    H_HALT,        // end of program
+    // superinstructions
+    H_LD_CMP_JMP,  // LD x / GT..LT y / JMP label
+    H_LD_OP_ST,    // LD x / AND..DIV y / ST z
+    H_LD_ST,       // LD x / ST y
+    H_OP_POP,      // AND..LT( x / )
+    H_CHAIN,       // OP( x / OP[(] y / ... / ) same bitwise operation
+    H_RUNG,        // LD x / AND|OR|XOR[N][(] y / ... / NOT / ) boolean rung
+    H_SEGMENT,     // first op of a segment
+    H_END
+};
+
+// set by vm_execute(NULL)
+static const void **vm_dispatch = NULL;
+
+int (*vm_trace)(const char *fmt, ...) = NULL;
+
+// area selected by each operand
+const uint8_t vm_operand_area[OP_END] = {
+        VM_AREAS,  // N_OPERANDS
+        VM_I,      // OP_INPUT
+        VM_I_REAL, // OP_REAL_INPUT
+        VM_I,      // OP_FALLING
+        VM_I,      // OP_RISING
+        VM_M,      // OP_MEMORY
+        VM_M_REAL, // OP_REAL_MEMORY
+        VM_C,      // OP_COMMAND
+        VM_B,      // OP_BLINKOUT
+        VM_T,      // OP_TIMEOUT
+        VM_Q,      // OP_OUTPUT
+        VM_Q_REAL, // OP_REAL_OUTPUT
+        VM_Q,      // OP_CONTACT
+        VM_Q_REAL, // OP_REAL_CONTACT
+        VM_T,      // OP_START
+        VM_M,      // OP_PULSEIN
+        VM_M_REAL, // OP_REAL_MEMIN
+        VM_C,      // OP_WRITE
+};
+
+// one block, every area on its own cache line. off: area offsets, returns length
+static size_t vm_layout(const uint32_t size[VM_AREAS], size_t off[16]) {
+    size_t len = 0;
+
+    off[0]  = len; len += VM_ALIGN(size[VM_I] * sizeof(uint64_t));
+    off[1]  = len; len += VM_ALIGN(size[VM_I] * sizeof(uint64_t));
+    off[2]  = len; len += VM_ALIGN(size[VM_I_REAL] * sizeof(double));
+    off[3]  = len; len += VM_ALIGN(size[VM_M] * sizeof(uint64_t));
+    off[4]  = len; len += VM_ALIGN(size[VM_M] * sizeof(uint8_t));
+    off[5]  = len; len += VM_ALIGN(size[VM_M_REAL] * sizeof(double));
+    off[6]  = len; len += VM_ALIGN(size[VM_C] * sizeof(uint64_t));
+    off[7]  = len; len += VM_ALIGN(size[VM_Q] * sizeof(uint64_t));
+    off[8]  = len; len += VM_ALIGN(size[VM_Q_REAL] * sizeof(double));
+    off[9]  = len; len += VM_ALIGN(size[VM_T] * sizeof(vm_timer_t));
+    off[10] = len; len += VM_ALIGN(size[VM_B] * sizeof(vm_blinker_t));
+    off[11] = len; len += VM_ALIGN(size[VM_I] * sizeof(uint64_t));
+    off[12] = len; len += VM_ALIGN(size[VM_I] * sizeof(uint64_t));
+    off[13] = len; len += VM_ALIGN((size[VM_T] + size[VM_B]) * sizeof(vm_wheel_node_t));
+    off[14] = len; len += VM_ALIGN(size[VM_T] * sizeof(uint32_t));
+    off[15] = len;
+
+    return len;
+}
+
+size_t vm_mem_len(const uint32_t size[VM_AREAS]) {
+    size_t off[16];
+
+    return vm_layout(size, off);
+}
+
+// areas in caller memory: 64 bytes aligned, vm_mem_len() bytes, contents kept
+uint8_t vm_init_at(vm_t *vm, const uint32_t size[VM_AREAS], void *storage) {
+    uint8_t *mem = storage;
+    size_t off[16];
+
+    memset(vm, 0, sizeof(vm_t));
+    memcpy(vm->size, size, sizeof(vm->size));
+    if (mem == NULL || ((uintptr_t) mem & 63))
+        return VM_ERR_MEMORY;
+    vm_layout(size, off);
+
+    vm->mem     = mem;
+    vm->i       = (uint64_t*) (mem + off[0]);
+    vm->i_prev  = (uint64_t*) (mem + off[1]);
+    vm->i_real  = (double*) (mem + off[2]);
+    vm->m       = (uint64_t*) (mem + off[3]);
+    vm->m_pulse = (uint8_t*) (mem + off[4]);
+    vm->m_real  = (double*) (mem + off[5]);
+    vm->c       = (uint64_t*) (mem + off[6]);
+    vm->q       = (uint64_t*) (mem + off[7]);
+    vm->q_real  = (double*) (mem + off[8]);
+    vm->t       = (vm_timer_t*) (mem + off[9]);
+    vm->b       = (vm_blinker_t*) (mem + off[10]);
+    vm->i_rise  = (uint64_t*) (mem + off[11]);
+    vm->i_fall  = (uint64_t*) (mem + off[12]);
+    vm->mem_extern = true;
+
+    // the wheel is rebuilt from the timers and blinkers
+    vm->wheel.node  = (vm_wheel_node_t*) (mem + off[13]);
+    vm->wheel.queue = (uint32_t*) (mem + off[14]);
+    memset(vm->wheel.node, 0, (size[VM_T] + size[VM_B]) * sizeof(vm_wheel_node_t));
+    vm_timer_resolution(vm, 1);
+
+    return VM_OK;
+}
+
+uint8_t vm_init(vm_t *vm, const uint32_t size[VM_AREAS]) {
+    size_t len = vm_mem_len(size);
+    uint8_t *mem;
+
+    memset(vm, 0, sizeof(vm_t));
+    mem = aligned_alloc(64, len ? len : 64);
+    if (mem == NULL)
+        return VM_ERR_MEMORY;
+    memset(mem, 0, len);
+
+    vm_init_at(vm, size, mem);
+    vm->mem_extern = false;
+
+    return VM_OK;
+}
+
+static void vm_rungs_free(vm_t *vm) {
+    vm_rung_t *next;
+
+    for (; vm->rungs != NULL; vm->rungs = next) {
+        next = vm->rungs->next;
+        free(vm->rungs);
+    }
+}
+
+// restores the first op handlers
+static void vm_segments_free(vm_t *vm) {
+    for (uint32_t pc = 0; vm->segs != NULL && pc < vm->code_len; pc++)
+        if (vm->seg_at[pc] != UINT32_MAX)
+            vm->code[pc].handler = vm->segs[vm->seg_at[pc]].handler;
+
+    free(vm->segs);
+    free(vm->seg_at);
+    free(vm->seg_watch);
+    vm->segs = NULL;
+    vm->seg_at = NULL;
+    vm->segs_len = 0;
+    vm->seg_watch = NULL;
+    vm->seg_watches = 0;
+}
+
+void vm_deinit(vm_t *vm) {
+    vm_segments_free(vm);
+    vm_rungs_free(vm);
+    if (!vm->code_extern)
+        free(vm->code);
+    if (!vm->mem_extern)
+        free(vm->mem);
+    memset(vm, 0, sizeof(vm_t));
+}
+
+static inline bool vm_truthy(vm_value_t v) {
+    return v.type == T_REAL ? v.r != 0.0 : v.w != 0;
+}
+
+static inline uint64_t vm_to_word(vm_value_t v) {
+    return v.type == T_REAL ? (uint64_t) (int64_t) v.r : v.w;
+}
+
+static inline double vm_to_real(vm_value_t v) {
+    return v.type == T_REAL ? v.r : (double) (int64_t) v.w;
+}
+
+static inline void vm_negate(vm_value_t *v) {
+    switch (v->type) {
+        case T_BOOL:
+            v->w = !v->w;
+            break;
+        case T_WORD:
+            v->w = ~v->w;
+            break;
+        case T_REAL:
+            v->r = -v->r;
+            break;
+    }
+}
+
+
+////////////////////// TIMING WHEEL //////////////////////
+
+// first tick at or after ms
+static inline uint64_t vm_wheel_tick(const vm_wheel_t *w, uint64_t ms) {
+    return ms / w->res + (ms % w->res != 0);
+}
+
+static void vm_wheel_unlink(vm_wheel_t *w, uint32_t n) {
+    vm_wheel_node_t *x = &w->node[n];
+
+    if (x->list == VM_WHEEL_NONE)
+        return;
+
+    if (x->prev != VM_WHEEL_NONE)
+        w->node[x->prev].next = x->next;
+    else
+        w->head[x->list] = x->next;
+    if (x->next != VM_WHEEL_NONE)
+        w->node[x->next].prev = x->prev;
+    if (w->head[x->list] == VM_WHEEL_NONE && x->list < VM_WHEEL_SLOTS)
+        w->busy[x->list / 64] &= ~((uint64_t) 1 << (x->list % 64));
+
+    x->list = VM_WHEEL_NONE;
+    --w->armed;
+}
+
+// false: already expired
+static bool vm_wheel_link(vm_wheel_t *w, uint32_t n, uint64_t expire) {
+    vm_wheel_node_t *x = &w->node[n];
+    uint32_t level;
+
+    if (expire <= w->tick)
+        return false;
+
+    level = (63 - __builtin_clzll(expire ^ w->tick)) / 6;
+    if (level < VM_WHEEL_LEVELS) {
+        x->list = level * 64 + ((expire >> (6 * level)) & 63);
+        w->busy[level] |= (uint64_t) 1 << (x->list % 64);
+    } else
+        x->list = VM_WHEEL_SLOTS;
+
+    x->expire = expire;
+    x->prev = VM_WHEEL_NONE;
+    x->next = w->head[x->list];
+    if (x->next != VM_WHEEL_NONE)
+        w->node[x->next].prev = n;
+    w->head[x->list] = n;
+    ++w->armed;
+
+    return true;
+}
+
+// next half cycle of blinker n (node size[VM_T] + n)
+static void vm_blinker_arm(vm_t *vm, uint32_t n) {
+    vm_blinker_t *b = &vm->b[n];
+    uint64_t cycles = vm->time / b->period;
+    uint32_t node = vm->size[VM_T] + n;
+
+    b->q = cycles & 1;
+    if (!vm_wheel_link(&vm->wheel, node, vm_wheel_tick(&vm->wheel, (cycles + 1) * b->period)))
+        vm_wheel_link(&vm->wheel, node, vm->wheel.tick + 1);
+}
+
+static void vm_wheel_expire(vm_t *vm, uint32_t n) {
+    if (n < vm->size[VM_T])
+        vm->t[n].q = true;
+    else
+        vm_blinker_arm(vm, n - vm->size[VM_T]);
+}
+
+// move the wheel to tick now: jump from event to event, cascading slot lists
+static void vm_wheel_advance(vm_t *vm, uint64_t now) {
+    vm_wheel_t *w = &vm->wheel;
+    uint32_t level, shift, list, n, next;
+    uint64_t at;
+
+    while (w->armed != 0 && w->tick < now) {
+        // lowest busy level holds the next event: the start of its first busy slot
+        for (level = 0; level < VM_WHEEL_LEVELS && w->busy[level] == 0; level++)
+            ;
+        shift = 6 * level;
+        if (level < VM_WHEEL_LEVELS) {
+            list = level * 64 + __builtin_ctzll(w->busy[level]);
+            at = (w->tick >> (shift + 6) << (shift + 6)) | (uint64_t) (list % 64) << shift;
+        } else {
+            list = VM_WHEEL_SLOTS;
+            at = ((w->tick >> shift) + 1) << shift;
+        }
+        if (at > now)
+            break;
+
+        w->tick = at;
+        if (list < VM_WHEEL_SLOTS)
+            w->busy[level] &= ~((uint64_t) 1 << (list % 64));
+        n = w->head[list];
+        w->head[list] = VM_WHEEL_NONE;
+        for (; n != VM_WHEEL_NONE; n = next) {
+            next = w->node[n].next;
+            w->node[n].list = VM_WHEEL_NONE;
+            --w->armed;
+            if (!vm_wheel_link(w, n, w->node[n].expire))
+                vm_wheel_expire(vm, n);
+        }
+    }
+
+    if (w->tick < now)
+        w->tick = now;
+}
+
+// scan start: (re)arm timers whose T changed, then expire up to vm->time
+static void vm_timers_update(vm_t *vm) {
+    vm_wheel_t *w = &vm->wheel;
+    vm_timer_t *t;
+    uint32_t k, n;
+
+    for (k = 0; k < w->queued; k++) {
+        n = w->queue[k];
+        t = &vm->t[n];
+        w->node[n].queued = false;
+        vm_wheel_unlink(w, n);
+        t->q = t->en && !vm_wheel_link(w, n, vm_wheel_tick(w, t->start + t->preset));
+    }
+    w->queued = 0;
+
+    vm_wheel_advance(vm, vm->time / w->res);
+}
+
+// tick length in ms, the running timers and blinkers are rescheduled
+void vm_timer_resolution(vm_t *vm, uint64_t res) {
+    vm_wheel_t *w = &vm->wheel;
+    vm_timer_t *t;
+    uint32_t n;
+
+    w->res = res ? res : 1;
+    w->tick = vm->time / w->res;
+    w->armed = 0;
+    memset(w->busy, 0, sizeof(w->busy));
+    for (n = 0; n <= VM_WHEEL_SLOTS; n++)
+        w->head[n] = VM_WHEEL_NONE;
+    for (n = 0; n < vm->size[VM_T] + vm->size[VM_B]; n++)
+        w->node[n].list = VM_WHEEL_NONE;
+
+    // queued timers are armed at next scan
+    for (n = 0; n < vm->size[VM_T]; n++) {
+        t = &vm->t[n];
+        if (t->en && !t->q && !w->node[n].queued && !vm_wheel_link(w, n, vm_wheel_tick(w, t->start + t->preset)))
+            t->q = true;
+    }
+    for (n = 0; n < vm->size[VM_B]; n++)
+        if (vm->b[n].period)
+            vm_blinker_arm(vm, n);
+}
+
+uint8_t vm_blinker_set(vm_t *vm, uint32_t n, uint64_t period) {
+    if (n >= vm->size[VM_B])
+        return VM_ERR_OPERAND;
+
+    vm_wheel_unlink(&vm->wheel, vm->size[VM_T] + n);
+    vm->b[n].period = period;
+    vm->b[n].q = false;
+    if (period)
+        vm_blinker_arm(vm, n);
+
+    return VM_OK;
+}
+
+// edge images of the whole input area, then the input image becomes the previous
+// one. 4 words per vector: SSE2 pairs, a single AVX2 op when enabled
+typedef uint64_t vm_vec_t __attribute__((vector_size(32)));
+
+static inline void vm_edges(vm_t *vm) {
+    uint64_t *i = vm->i, *p = vm->i_prev, *r = vm->i_rise, *f = vm->i_fall;
+    uint32_t n = 0, len = vm->size[VM_I];
+    vm_vec_t vi, vp, vr, vf;
+
+    for (; n + 4 <= len; n += 4) {
+        memcpy(&vi, i + n, sizeof(vm_vec_t));
+        memcpy(&vp, p + n, sizeof(vm_vec_t));
+        vr = vi & ~vp;
+        vf = vp & ~vi;
+        memcpy(r + n, &vr, sizeof(vm_vec_t));
+        memcpy(f + n, &vf, sizeof(vm_vec_t));
+        memcpy(p + n, &vi, sizeof(vm_vec_t));
+    }
+    for (; n < len; n++) {
+        r[n] = i[n] & ~p[n];
+        f[n] = p[n] & ~i[n];
+        p[n] = i[n];
+    }
+}
+
+static inline void vm_read(const vm_op_t *op, vm_value_t *v) {
+    switch (op->kind) {
+        case K_NONE:
+        default:
+            v->w = 0;
+            v->type = T_BOOL;
+            return;
+        case K_BIT:
+            v->w = (*op->arg.w & op->mask) != 0;
+            v->type = T_BOOL;
+            break;
+        case K_WORD:
+        case K_PULSE:
+            v->w = *op->arg.w;
+            v->type = T_WORD;
+            break;
+        case K_REAL:
+            v->r = *op->arg.r;
+            v->type = T_REAL;
+            break;
+        case K_TIMER_Q:
+            v->w = op->arg.t->q;
+            v->type = T_BOOL;
+            break;
+        case K_TIMER_EN:
+            v->w = op->arg.t->en;
+            v->type = T_BOOL;
+            break;
+        case K_BLINK:
+            v->w = op->arg.b->q;
+            v->type = T_BOOL;
+            break;
+    }
+
+    if (op->flags & F_NEG_ARG)
+        vm_negate(v);
+}
+
+static inline void vm_write(vm_t *vm, const vm_op_t *op, vm_value_t v) {
+    bool bit;
+
+    switch (op->kind) {
+        case K_BIT:
+            *op->arg.w = vm_truthy(v) ? *op->arg.w | op->mask : *op->arg.w & ~op->mask;
+            break;
+        case K_WORD:
+            *op->arg.w = vm_to_word(v);
+            break;
+        case K_REAL:
+            *op->arg.r = vm_to_real(v);
+            break;
+        case K_PULSE:
+            // counter: count on rising edge of the stored value
+            bit = vm_truthy(v);
+            if (bit && !*op->pulse)
+                ++*op->arg.w;
+            *op->pulse = bit;
+            break;
+        case K_TIMER_EN:
+            vm_timer_input(vm, op->arg.t - vm->t, vm_truthy(v));
+            break;
+        default:
+            break;
+    }
+}
+
+// resolve operand of instruction to vm areas
+static uint8_t vm_resolve(vm_t *vm, uint32_t ins, vm_op_t *op, bool write) {
+    uint8_t operand = OPERAND(ins);
+    uint32_t idx = BIT_WORD(ins) ? INSWORD0(ins) : INSBYTE2(ins);
+
+    op->kind = K_NONE;
+    op->mask = 0;
+
+    if (operand == N_OPERANDS)
+        return VM_OK;
+    if (operand >= OP_END || idx >= vm->size[vm_operand_area[operand]])
+        return VM_ERR_OPERAND;
+
+    if (!BIT_WORD(ins)) {
+        if (INSBYTE3(ins) > 63)
+            return VM_ERR_OPERAND;
+        op->mask = (uint64_t) 1 << INSBYTE3(ins);
+    }
+    op->kind = BIT_WORD(ins) ? K_WORD : K_BIT;
+
+    switch (operand) {
+        case OP_INPUT:
+            op->arg.w = &vm->i[idx];
+            break;
+        case OP_FALLING:
+            op->arg.w = &vm->i_fall[idx];
+            break;
+        case OP_RISING:
+            op->arg.w = &vm->i_rise[idx];
+            break;
+        case OP_MEMORY:
+            op->arg.w = &vm->m[idx];
+            break;
+        case OP_PULSEIN:
+            op->arg.w = &vm->m[idx];
+            if (write) {
+                op->pulse = &vm->m_pulse[idx];
+                op->mask = 0;
+                op->kind = K_PULSE;
+            }
+            break;
+        case OP_COMMAND:
+        case OP_WRITE:
+            op->arg.w = &vm->c[idx];
+            break;
+        case OP_OUTPUT:
+        case OP_CONTACT:
+            op->arg.w = &vm->q[idx];
+            break;
+        case OP_REAL_INPUT:
+            op->arg.r = &vm->i_real[idx];
+            op->kind = K_REAL;
+            break;
+        case OP_REAL_MEMORY:
+        case OP_REAL_MEMIN:
+            op->arg.r = &vm->m_real[idx];
+            op->kind = K_REAL;
+            break;
+        case OP_REAL_OUTPUT:
+        case OP_REAL_CONTACT:
+            op->arg.r = &vm->q_real[idx];
+            op->kind = K_REAL;
+            break;
+        case OP_TIMEOUT:
+            op->arg.t = &vm->t[idx];
+            op->kind = K_TIMER_Q;
+            break;
+        case OP_START:
+            op->arg.t = &vm->t[idx];
+            op->kind = K_TIMER_EN;
+            break;
+        case OP_BLINKOUT:
+            op->arg.b = &vm->b[idx];
+            op->kind = K_BLINK;
+            break;
+    }
+    if (op->kind != K_BIT)
+        op->mask = 0;
+
+    // read only operands
+    if (write) {
+        switch (operand) {
+            case OP_INPUT:
+            case OP_REAL_INPUT:
+            case OP_FALLING:
+            case OP_RISING:
+            case OP_COMMAND:
+            case OP_BLINKOUT:
+            case OP_TIMEOUT:
+                return VM_ERR_OPERAND;
+        }
+    }
+
+    return VM_OK;
+}
+
+// depth of parenthesis stack reaching pc, must agree on every path
+static uint8_t vm_verify_reach(uint32_t *depth, uint32_t *work, uint32_t *wlen, uint32_t pc, uint32_t d) {
+    if (depth[pc] == UINT32_MAX) {
+        depth[pc] = d;
+        work[(*wlen)++] = pc;
+    } else if (depth[pc] != d)
+        return VM_ERR_STACK;
+
+    return VM_OK;
+}
+
+// longest CAL chain from subroutine e, callees listed in edge[first[e]..first[e + 1]].
+// e is called at depth calls from the program start: recursion stays within VM_CALL_DEPTH
+static uint8_t vm_verify_calls(const uint32_t *first, const uint32_t *edge, uint8_t *state, uint32_t *level, uint32_t e,
+        uint32_t calls) {
+    uint32_t n, l;
+    uint8_t status;
+
+    if (state[e] == 2)
+        return VM_OK;
+    if (state[e] == 1 || calls > VM_CALL_DEPTH)
+        return VM_ERR_CALL; // recursion or too deep
+    state[e] = 1;
+
+    level[e] = 0;
+    for (n = first[e]; n < first[e + 1]; n++) {
+        if ((status = vm_verify_calls(first, edge, state, level, edge[n], calls + 1)) != VM_OK)
+            return status;
+        l = level[edge[n]] + 1;
+        if (l > VM_CALL_DEPTH)
+            return VM_ERR_CALL;
+        if (l > level[e])
+            level[e] = l;
+    }
+    state[e] = 2;
+
+    return VM_OK;
+}
+
+// static checks on the decoded program: balanced parenthesis on every path, parenthesis and
+// CAL depth within the vm stacks. CAL and RET are only allowed outside parenthesis.
+static uint8_t vm_verify(vm_t *vm, const vm_op_t *code, uint32_t len) {
+    uint32_t *depth, *work, *entry, *first, *edge, *mark, *level;
+    uint32_t pc, d, wlen = 0, entries = 1, edges = 0, edges_cap = 0, e, n;
+    uint8_t *state, status = VM_OK;
+    void *tmp;
+
+    depth = malloc((len + 1) * sizeof(uint32_t));
+    work = malloc((len + 1) * sizeof(uint32_t));
+    entry = calloc(len + 1, sizeof(uint32_t));
+    first = malloc((len + 2) * sizeof(uint32_t));
+    mark = calloc(len + 1, sizeof(uint32_t));
+    level = malloc((len + 1) * sizeof(uint32_t));
+    state = calloc(len + 1, sizeof(uint8_t));
+    edge = NULL;
+    if (depth == NULL || work == NULL || entry == NULL || first == NULL || mark == NULL || level == NULL || state == NULL) {
+        status = VM_ERR_MEMORY;
+        goto end;
+    }
+    memset(depth, 0xff, (len + 1) * sizeof(uint32_t));
+
+    // parenthesis depth, dataflow over reachable code
+    vm->stack_depth = 0;
+    vm_verify_reach(depth, work, &wlen, 0, 0);
+    while (wlen > 0 && status == VM_OK) {
+        pc = work[--wlen];
+        d = depth[pc];
+        if (pc == len)
+            continue;
+
+        if (code[pc].flags & F_PUSH) {
+            if (++d > VM_STACK_DEPTH) {
+                status = VM_ERR_STACK;
+                break;
+            }
+            if (d > vm->stack_depth)
+                vm->stack_depth = d;
+        }
+
+        switch (code[pc].il) {
+            case IL_POP:
+                if (d == 0)
+                    status = VM_ERR_STACK;
+                else
+                    status = vm_verify_reach(depth, work, &wlen, pc + 1, d - 1);
+                break;
+            case IL_JMP:
+                status = vm_verify_reach(depth, work, &wlen, code[pc].target, d);
+                if (status == VM_OK && (code[pc].flags & F_COND))
+                    status = vm_verify_reach(depth, work, &wlen, pc + 1, d);
+                break;
+            case IL_CAL:
+                if (d != 0) {
+                    status = VM_ERR_STACK;
+                    break;
+                }
+                if (entry[code[pc].target] == 0)
+                    entry[code[pc].target] = ++entries;
+                status = vm_verify_reach(depth, work, &wlen, code[pc].target, 0);
+                if (status == VM_OK)
+                    status = vm_verify_reach(depth, work, &wlen, pc + 1, 0);
+                break;
+            case IL_NOP:
+                if (code[pc].flags & F_RETURN) {
+                    if (d != 0)
+                        status = VM_ERR_STACK;
+                    else if (code[pc].flags & F_COND)
+                        status = vm_verify_reach(depth, work, &wlen, pc + 1, 0);
+                    break;
+                }
+                /* fall through */
+            default:
+                status = vm_verify_reach(depth, work, &wlen, pc + 1, d);
+        }
+    }
+    if (status != VM_OK)
+        goto end;
+
+    // CAL depth: callees of each subroutine body (program start included), then longest chain
+    entries = 0;
+    entry[0] = 1;
+    for (pc = 0; pc < len; pc++)
+        if (entry[pc] != 0)
+            entry[pc] = ++entries;
+
+    for (pc = 0, e = 0; pc < len; pc++) {
+        if (entry[pc] == 0)
+            continue;
+        first[e++] = edges;
+
+        wlen = 0;
+        mark[pc] = e;
+        work[wlen++] = pc;
+        while (wlen > 0) {
+            n = work[--wlen];
+            if (n == len)
+                continue;
+
+            d = n + 1;
+            if (code[n].il == IL_CAL) {
+                if (edges == edges_cap) {
+                    tmp = realloc(edge, (edges_cap ? edges_cap * 2 : 64) * sizeof(uint32_t));
+                    if (tmp == NULL) {
+                        status = VM_ERR_MEMORY;
+                        goto end;
+                    }
+                    edge = tmp;
+                    edges_cap = edges_cap ? edges_cap * 2 : 64;
+                }
+                edge[edges++] = entry[code[n].target] - 1;
+            } else if (code[n].il == IL_JMP) {
+                if (mark[code[n].target] != e) {
+                    mark[code[n].target] = e;
+                    work[wlen++] = code[n].target;
+                }
+                if (!(code[n].flags & F_COND))
+                    continue;
+            } else if ((code[n].flags & F_RETURN) && !(code[n].flags & F_COND))
+                continue;
+
+            if (mark[d] != e) {
+                mark[d] = e;
+                work[wlen++] = d;
+            }
+        }
+    }
+    first[e] = edges;
+
+    status = len ? vm_verify_calls(first, edge, state, level, 0, 0) : VM_OK;
+    vm->call_depth = len ? level[0] : 0;
+
+    end:
+    free(depth);
+    free(work);
+    free(entry);
+    free(first);
+    free(edge);
+    free(mark);
+    free(level);
+    free(state);
+    return status;
+}
+
+// program decoded to code (prg_len + 1 ops), the vm keeps running its program
+static uint8_t vm_decode(vm_t *vm, const uint32_t *vm_program, uint32_t prg_len, vm_op_t *code) {
+    uint32_t pc, ins;
+    uint8_t il, status;
+
+    if (vm_dispatch == NULL)
+        vm_execute(NULL);
+
+    memset(code, 0, (prg_len + 1) * sizeof(vm_op_t));
+
+    for (pc = 0; pc < prg_len; pc++) {
+        ins = vm_program[pc];
+        il = IL(ins);
+        status = VM_OK;
+
+        if (il > IL_POP)
+            return VM_ERR_OPCODE;
+
+        code[pc].il = il;
+        code[pc].handler = vm_dispatch[il];
+        code[pc].flags = (BIT_COND(ins) ? F_COND : 0) | (BIT_NEGATE_INS(ins) ? F_NEG_INS : 0)
+                | (BIT_NEGATE_ARG(ins) ? F_NEG_ARG : 0) | (BIT_RETURN(ins) ? F_RETURN : 0);
+
+        switch (il) {
+            case IL_NOP:
+            case IL_NOT:
+            case IL_POP:
+                break;
+            case IL_JMP:
+            case IL_CAL:
+                if (INSWORD2(ins) >= prg_len)
+                    status = VM_ERR_JUMP;
+                code[pc].target = INSWORD2(ins);
+                break;
+            case IL_ST:
+            case IL_S:
+            case IL_R:
+                status = vm_resolve(vm, ins, &code[pc], true);
+                break;
+            case IL_LD:
+                status = vm_resolve(vm, ins, &code[pc], false);
+                break;
+            default:
+                status = vm_resolve(vm, ins, &code[pc], false);
+                if (BIT_PUSH(ins)) {
+                    code[pc].handler = vm_dispatch[H_PUSH];
+                    code[pc].flags |= F_PUSH;
+                }
+        }
+        if (status != VM_OK)
+            return status;
+    }
+    code[prg_len].handler = vm_dispatch[H_HALT];
+    code[prg_len].il = H_HALT;
+
+    return vm_verify(vm, code, prg_len);
+}
+
+static void vm_install(vm_t *vm, vm_op_t *code, uint32_t prg_len, bool code_extern) {
+    vm_segments_free(vm);
+    vm_rungs_free(vm);
+    if (!vm->code_extern)
+        free(vm->code);
+    vm->code = code;
+    vm->code_len = prg_len;
+    vm->code_extern = code_extern;
+    vm->engine = VM_ENGINE_INTERP;
+    vm->native = NULL;
+}
+
+uint8_t vm_load(vm_t *vm, const uint32_t *vm_program, uint32_t prg_len) {
+    vm_op_t *code;
+    uint8_t status;
+
+    code = aligned_alloc(64, vm_code_len(prg_len));
+    if (code == NULL)
+        return VM_ERR_MEMORY;
+
+    if ((status = vm_decode(vm, vm_program, prg_len, code)) != VM_OK) {
+        free(code);
+        return status;
+    }
+    vm_install(vm, code, prg_len, false);
+
+    return VM_OK;
+}
+
+size_t vm_code_len(uint32_t prg_len) {
+    return VM_ALIGN((prg_len + 1) * sizeof(vm_op_t));
+}
+
+// program in caller memory: 64 bytes aligned, vm_code_len() bytes, not freed
+uint8_t vm_load_at(vm_t *vm, const uint32_t *vm_program, uint32_t prg_len, void *storage) {
+    uint8_t status;
+
+    if (storage == NULL || ((uintptr_t) storage & 63) || storage == vm->code)
+        return VM_ERR_MEMORY;
+    if ((status = vm_decode(vm, vm_program, prg_len, storage)) != VM_OK)
+        return status;
+    vm_install(vm, storage, prg_len, true);
+
+    return VM_OK;
+}
+
+// next shares the areas of vm, the wheel and everything else stay with vm
+uint8_t vm_stage(const vm_t *vm, vm_t *next, const uint32_t *vm_program, uint32_t prg_len) {
+    memset(next, 0, sizeof(vm_t));
+    memcpy(next->size, vm->size, sizeof(next->size));
+    next->i = vm->i;
+    next->i_prev = vm->i_prev;
+    next->i_rise = vm->i_rise;
+    next->i_fall = vm->i_fall;
+    next->i_real = vm->i_real;
+    next->m = vm->m;
+    next->m_pulse = vm->m_pulse;
+    next->m_real = vm->m_real;
+    next->c = vm->c;
+    next->q = vm->q;
+    next->q_real = vm->q_real;
+    next->t = vm->t;
+    next->b = vm->b;
+    next->mem = vm->mem;
+    next->mem_extern = true;
+
+    return vm_load(next, vm_program, prg_len);
+}
+
+// program fields of vm and next exchanged, next keeps the previous program
+static void vm_swap(vm_t *vm, vm_t *next) {
+    vm_t prev = *vm;
+
+    vm->code = next->code;
+    vm->code_len = next->code_len;
+    vm->code_extern = next->code_extern;
+    vm->stack_depth = next->stack_depth;
+    vm->call_depth = next->call_depth;
+    vm->rungs = next->rungs;
+    vm->segs = next->segs;
+    vm->segs_len = next->segs_len;
+    vm->seg_at = next->seg_at;
+    vm->seg_watch = next->seg_watch;
+    vm->seg_watches = next->seg_watches;
+    vm->seg_fixed = next->seg_fixed;
+    vm->segs_skipped = 0;
+    vm->engine = VM_ENGINE_INTERP;
+    vm->native = NULL;
+
+    next->code = prev.code;
+    next->code_len = prev.code_len;
+    next->code_extern = prev.code_extern;
+    next->stack_depth = prev.stack_depth;
+    next->call_depth = prev.call_depth;
+    next->rungs = prev.rungs;
+    next->segs = prev.segs;
+    next->segs_len = prev.segs_len;
+    next->seg_at = prev.seg_at;
+    next->seg_watch = prev.seg_watch;
+    next->seg_watches = prev.seg_watches;
+    next->seg_fixed = prev.seg_fixed;
+
+    __atomic_store_n(&next->pending, NULL, __ATOMIC_RELEASE);
+}
+
+static inline uint8_t vm_operate(uint8_t il, vm_value_t *a, vm_value_t b) {
+    bool real = a->type == T_REAL || b.type == T_REAL;
+    uint8_t type = real ? T_REAL : T_WORD;
+    int64_t wa = (int64_t) vm_to_word(*a), wb = (int64_t) vm_to_word(b);
+    double ra = vm_to_real(*a), rb = vm_to_real(b);
+
+    switch (il) {
+        case IL_AND:
+        case IL_OR:
+        case IL_XOR:
+            type = (a->type == T_BOOL && b.type == T_BOOL) ? T_BOOL : T_WORD;
+            a->w = il == IL_AND ? (uint64_t) (wa & wb) : il == IL_OR ? (uint64_t) (wa | wb) : (uint64_t) (wa ^ wb);
+            break;
+        case IL_ADD:
+            if (real)
+                a->r = ra + rb;
+            else
+                a->w = (uint64_t) wa + (uint64_t) wb;
+            break;
+        case IL_SUB:
+            if (real)
+                a->r = ra - rb;
+            else
+                a->w = (uint64_t) wa - (uint64_t) wb;
+            break;
+        case IL_MUL:
+            if (real)
+                a->r = ra * rb;
+            else
+                a->w = (uint64_t) wa * (uint64_t) wb;
+            break;
+        case IL_DIV:
+            if (real)
+                a->r = ra / rb;
+            else {
+                if (wb == 0)
+                    return VM_ERR_DIV_ZERO;
+                // INT64_MIN / -1 traps: wraps like the other operations
+                a->w = wb == -1 ? (uint64_t) 0 - (uint64_t) wa : (uint64_t) (wa / wb);
+            }
+            break;
+        case IL_GT:
+            a->w = real ? ra > rb : wa > wb;
+            type = T_BOOL;
+            break;
+        case IL_GE:
+            a->w = real ? ra >= rb : wa >= wb;
+            type = T_BOOL;
+            break;
+        case IL_EQ:
+            a->w = real ? ra == rb : wa == wb;
+            type = T_BOOL;
+            break;
+        case IL_NE:
+            a->w = real ? ra != rb : wa != wb;
+            type = T_BOOL;
+            break;
+        case IL_LE:
+            a->w = real ? ra <= rb : wa <= wb;
+            type = T_BOOL;
+            break;
+        case IL_LT:
+            a->w = real ? ra < rb : wa < wb;
+            type = T_BOOL;
+            break;
+        default:
+            return VM_ERR_OPCODE;
+    }
+    a->type = type;
+
+    return VM_OK;
+}
+
+// native engines run the scan body only, vm_execute() keeps timers and edges
+uint8_t vm_select(vm_t *vm, uint8_t engine, uint8_t (*native)(vm_t *vm)) {
+    if (engine != VM_ENGINE_INTERP && native == NULL)
+        return VM_ERR_OPCODE;
+
+    vm->engine = engine;
+    vm->native = engine == VM_ENGINE_INTERP ? NULL : native;
+    vm_dirty(vm);
+
+    return VM_OK;
+}
+
+static inline bool vm_is_operation(uint8_t il) {
+    return il >= IL_AND && il <= IL_LT && il != IL_NOT;
+}
+
+// length of AND|OR|XOR( chain starting at pc (0: not a chain)
+static uint32_t vm_chain_len(const vm_op_t *code, uint32_t code_len, uint32_t pc) {
+    uint8_t il = code[pc].il;
+    uint32_t n, depth = 1;
+
+    if (il != IL_AND && il != IL_OR && il != IL_XOR)
+        return 0;
+
+    for (n = pc + 1; n < code_len; n++) {
+        if (code[n].il == IL_POP) {
+            if (--depth == 0)
+                return n - pc + 1;
+            continue;
+        }
+        if (code[n].il != il || (code[n].flags & F_NEG_INS) || code[n].kind == K_NONE)
+            return 0;
+        if (code[n].flags & F_PUSH)
+            ++depth;
+    }
+
+    return 0;
+}
+
+////////////////////// BOOLEAN RUNGS //////////////////////
+// rungs are compiled to sum of products. every value is a set of terms, absorbed
+// terms are dropped so the set stays minimal under OR. NOT applies De Morgan and
+// XOR expands to (a AND NOT b) OR (NOT a AND b).
+
+static const uint64_t vm_rung_zero = 0;
+
+typedef struct vm_dnf {
+          uint32_t n;                    // terms
+    vm_rung_term_t t[VM_RUNG_TERMS];     //
+} vm_dnf_t;
+
+enum {
+    T_OPERAND, // operand / negated parenthesis
+    T_N,       // NOT: negated term
+    T_AND,     // NOT: partial product
+    T_NA,      // XOR: NOT a
+    T_NB,      // XOR: NOT b
+    T_OUT,     // AND / XOR result
+    T_XOR,     // XOR: second product
+    T_TEMPS
+};
+
+typedef struct vm_rung_build {
+    const uint64_t *word[VM_RUNG_WORDS];
+          uint32_t words;
+          vm_dnf_t *tmp;                 // T_TEMPS
+          vm_dnf_t *stack;               // stack_depth + 1
+} vm_rung_build_t;
+
+// x implies y: every bit tested by y is tested with the same value by x
+static inline bool vm_term_implies(const vm_rung_term_t *x, const vm_rung_term_t *y) {
+    for (uint32_t w = 0; w < VM_RUNG_WORDS; w++)
+        if ((y->mask[w] & ~x->mask[w]) || ((x->value[w] ^ y->value[w]) & y->mask[w]))
+            return false;
+
+    return true;
+}
+
+static bool vm_dnf_add(vm_dnf_t *d, const vm_rung_term_t *t) {
+    uint32_t n, k = 0;
+
+    for (n = 0; n < d->n; n++)
+        if (vm_term_implies(t, &d->t[n]))
+            return true;
+
+    for (n = 0; n < d->n; n++)
+        if (!vm_term_implies(&d->t[n], t))
+            d->t[k++] = d->t[n];
+    d->n = k;
+
+    if (d->n == VM_RUNG_TERMS)
+        return false;
+    d->t[d->n++] = *t;
+
+    return true;
+}
+
+static inline void vm_dnf_true(vm_dnf_t *d) {
+    memset(&d->t[0], 0, sizeof(vm_rung_term_t));
+    d->n = 1;
+}
+
+static bool vm_dnf_or(vm_dnf_t *a, const vm_dnf_t *b) {
+    for (uint32_t n = 0; n < b->n; n++)
+        if (!vm_dnf_add(a, &b->t[n]))
+            return false;
+
+    return true;
+}
+
+static bool vm_dnf_and(const vm_dnf_t *a, const vm_dnf_t *b, vm_dnf_t *out) {
+    vm_rung_term_t t;
+    uint32_t x, y, w;
+
+    out->n = 0;
+    for (x = 0; x < a->n; x++)
+        for (y = 0; y < b->n; y++) {
+            for (w = 0; w < VM_RUNG_WORDS; w++) {
+                if ((a->t[x].value[w] ^ b->t[y].value[w]) & a->t[x].mask[w] & b->t[y].mask[w])
+                    break;
+                t.mask[w] = a->t[x].mask[w] | b->t[y].mask[w];
+                t.value[w] = a->t[x].value[w] | b->t[y].value[w];
+            }
+            if (w == VM_RUNG_WORDS && !vm_dnf_add(out, &t))
+                return false;
+        }
+
+    return true;
+}
+
+static bool vm_dnf_not(vm_rung_build_t *b, const vm_dnf_t *a, vm_dnf_t *out) {
+    vm_dnf_t *n = &b->tmp[T_N], *p = &b->tmp[T_AND];
+    uint64_t bits, bit;
+    uint32_t x, w;
+
+    vm_dnf_true(out);
+    for (x = 0; x < a->n; x++) {
+        // NOT (l1 AND l2 ...) = NOT l1 OR NOT l2 ...
+        n->n = 0;
+        for (w = 0; w < VM_RUNG_WORDS; w++)
+            for (bits = a->t[x].mask[w]; bits; bits &= bits - 1) {
+                if (n->n == VM_RUNG_TERMS)
+                    return false;
+                bit = bits & -bits;
+                memset(&n->t[n->n], 0, sizeof(vm_rung_term_t));
+                n->t[n->n].mask[w] = bit;
+                n->t[n->n].value[w] = ~a->t[x].value[w] & bit;
+                ++n->n;
+            }
+        if (!vm_dnf_and(out, n, p))
+            return false;
+        *out = *p;
+    }
+
+    return true;
+}
+
+// a = a il b
+static bool vm_dnf_operate(vm_rung_build_t *b, uint8_t il, vm_dnf_t *a, const vm_dnf_t *v) {
+    vm_dnf_t *out = &b->tmp[T_OUT];
+
+    switch (il) {
+        case IL_AND:
+            if (!vm_dnf_and(a, v, out))
+                return false;
+            break;
+        case IL_OR:
+            return vm_dnf_or(a, v);
+        case IL_XOR:
+            if (!vm_dnf_not(b, a, &b->tmp[T_NA]) || !vm_dnf_not(b, v, &b->tmp[T_NB])
+                    || !vm_dnf_and(a, &b->tmp[T_NB], out) || !vm_dnf_and(&b->tmp[T_NA], v, &b->tmp[T_XOR])
+                    || !vm_dnf_or(out, &b->tmp[T_XOR]))
+                return false;
+            break;
+        default:
+            return false;
+    }
+    *a = *out;
+
+    return true;
+}
+
+static bool vm_dnf_literal(vm_rung_build_t *b, const vm_op_t *op, bool neg, vm_dnf_t *out) {
+    uint32_t w;
+
+    for (w = 0; w < b->words && b->word[w] != op->arg.w; w++)
+        ;
+    if (w == VM_RUNG_WORDS)
+        return false;
+    if (w == b->words)
+        b->word[b->words++] = op->arg.w;
+
+    memset(&out->t[0], 0, sizeof(vm_rung_term_t));
+    out->t[0].mask[w] = op->mask;
+    out->t[0].value[w] = neg ? 0 : op->mask;
+    out->n = 1;
+
+    return true;
+}
+
+// length of the balanced boolean rung starting at pc (0: not a rung). the rung
+// stops before a parenthesis deeper than max_depth: dead code is not verified
+static uint32_t vm_rung_len(const vm_op_t *code, uint32_t code_len, uint32_t pc, uint32_t max_depth) {
+    uint32_t n, depth = 0, len = 0;
+    uint8_t il;
+
+    if (code[pc].il != IL_LD || code[pc].kind != K_BIT)
+        return 0;
+
+    for (n = pc + 1; n < code_len && n - pc < UINT16_MAX; n++) {
+        il = code[n].il;
+        if (il == IL_POP) {
+            if (depth == 0)
+                break;
+            --depth;
+        } else if (il == IL_AND || il == IL_OR || il == IL_XOR) {
+            if (code[n].flags & F_PUSH) {
+                if ((code[n].kind != K_BIT && code[n].kind != K_NONE) || depth == max_depth)
+                    break;
+                ++depth;
+            } else if (code[n].kind != K_BIT)
+                break;
+        } else if (il != IL_NOT)
+            break;
+
+        if (depth == 0)
+            len = n - pc + 1;
+    }
+
+    return len;
+}
+
+static vm_rung_t* vm_rung_compile(vm_rung_build_t *b, const vm_op_t *code, uint32_t len) {
+    vm_dnf_t *v = &b->tmp[T_OPERAND];
+    uint8_t il[VM_STACK_DEPTH];
+    bool neg[VM_STACK_DEPTH];
+    uint32_t n, sp = 0;
+    vm_rung_t *rung;
+    bool ni, na;
+
+    b->words = 0;
+    for (n = 0; n < len; n++) {
+        ni = code[n].flags & F_NEG_INS;
+        na = code[n].flags & F_NEG_ARG;
+
+        switch (code[n].il) {
+            case IL_LD:
+                if (!vm_dnf_literal(b, &code[n], ni ^ na, &b->stack[sp]))
+                    return NULL;
+                break;
+            case IL_NOT:
+                if (!vm_dnf_not(b, &b->stack[sp], v))
+                    return NULL;
+                b->stack[sp] = *v;
+                break;
+            case IL_POP:
+                --sp;
+                if (neg[sp]) {
+                    if (!vm_dnf_not(b, &b->stack[sp + 1], v))
+                        return NULL;
+                } else
+                    *v = b->stack[sp + 1];
+                if (!vm_dnf_operate(b, il[sp], &b->stack[sp], v))
+                    return NULL;
+                break;
+            default:
+                if (code[n].flags & F_PUSH) {
+                    il[sp] = code[n].il;
+                    neg[sp] = ni;
+                    ++sp;
+                    if (code[n].kind == K_NONE)
+                        b->stack[sp] = b->stack[sp - 1];
+                    else if (!vm_dnf_literal(b, &code[n], na, &b->stack[sp]))
+                        return NULL;
+                } else if (!vm_dnf_literal(b, &code[n], ni ^ na, v)
+                        || !vm_dnf_operate(b, code[n].il, &b->stack[sp], v))
+                    return NULL;
+        }
+    }
+
+    if ((rung = malloc(sizeof(vm_rung_t) + b->stack[0].n * sizeof(vm_rung_term_t))) == NULL)
+        return NULL;
+    for (n = 0; n < VM_RUNG_WORDS; n++)
+        rung->word[n] = n < b->words ? b->word[n] : &vm_rung_zero;
+    rung->terms = b->stack[0].n;
+    memcpy(rung->term, b->stack[0].t, rung->terms * sizeof(vm_rung_term_t));
+
+    return rung;
+}
+
+static inline bool vm_rung(const vm_rung_t *r) {
+    const uint64_t w0 = *r->word[0], w1 = *r->word[1], w2 = *r->word[2], w3 = *r->word[3];
+    const vm_rung_term_t *t;
+
+    for (t = r->term; t < r->term + r->terms; t++)
+        if ((((w0 & t->mask[0]) ^ t->value[0]) | ((w1 & t->mask[1]) ^ t->value[1])
+                | ((w2 & t->mask[2]) ^ t->value[2]) | ((w3 & t->mask[3]) ^ t->value[3])) == 0)
+            return true;
+
+    return false;
+}
+
+void vm_fuse(vm_t *vm) {
+    vm_op_t *code = vm->code;
+    vm_rung_build_t b;
+    vm_rung_t *rung;
+    uint32_t pc, len;
+
+    vm_segments_free(vm);
+
+    // no rungs if out of memory, the other fusions still apply
+    b.tmp = malloc((T_TEMPS + vm->stack_depth + 1) * sizeof(vm_dnf_t));
+    b.stack = b.tmp + T_TEMPS;
+
+    for (pc = 0; pc < vm->code_len; pc += len ? len : 1) {
+        len = 0;
+
+        // boolean rung
+        if (b.tmp != NULL && (len = vm_rung_len(code, vm->code_len, pc, vm->stack_depth)) >= 4
+                && (rung = vm_rung_compile(&b, &code[pc], len)) != NULL) {
+            rung->next = vm->rungs;
+            vm->rungs = rung;
+            code[pc].rung = rung;
+            code[pc].handler = vm_dispatch[H_RUNG];
+            code[pc].len = len;
+            continue;
+        }
+        len = 0;
+
+        // parenthesis
+        if (code[pc].flags & F_PUSH) {
+            if (code[pc].kind == K_NONE) {
+                len = 0;
+            } else if (!(code[pc].flags & F_NEG_INS) && (len = vm_chain_len(code, vm->code_len, pc)) > 2) {
+                code[pc].handler = vm_dispatch[H_CHAIN];
+            } else if (pc + 1 < vm->code_len && code[pc + 1].il == IL_POP) {
+                code[pc].handler = vm_dispatch[H_OP_POP];
+                len = 2;
+            } else {
+                len = 0;
+            }
+            code[pc].len = len;
+            continue;
+        }
+
+        if (code[pc].il != IL_LD || pc + 1 >= vm->code_len)
+            continue;
+
+        if (code[pc + 1].il == IL_ST) {
+            code[pc].handler = vm_dispatch[H_LD_ST];
+            len = 2;
+        }
+
+        if (vm_is_operation(code[pc + 1].il) && !(code[pc + 1].flags & F_PUSH)
+                && pc + 2 < vm->code_len) {
+            if (code[pc + 1].il >= IL_GT && code[pc + 2].il == IL_JMP) {
+                code[pc].handler = vm_dispatch[H_LD_CMP_JMP];
+                len = 3;
+            } else if (code[pc + 1].il <= IL_DIV && code[pc + 2].il == IL_ST) {
+                code[pc].handler = vm_dispatch[H_LD_OP_ST];
+                len = 3;
+            }
+        }
+        code[pc].len = len;
+    }
+
+    free(b.tmp);
+}
+
+////////////////////// INCREMENTAL EXECUTION //////////////////////
+
+void vm_dirty(vm_t *vm) {
+    for (uint32_t n = 0; n < vm->segs_len; n++)
+        vm->segs[n].valid = false;
+}
+
+// word and bits of a plain area operand, false for anything else
+static bool vm_seg_location(const vm_t *vm, const vm_op_t *op, const uint64_t **w, uint64_t *mask) {
+    switch (op->kind) {
+        case K_BIT:
+            *w = op->arg.w;
+            *mask = op->mask;
+            break;
+        case K_WORD:
+            *w = op->arg.w;
+            *mask = ~(uint64_t) 0;
+            break;
+        case K_REAL:
+            *w = (const uint64_t*) op->arg.r;
+            *mask = ~(uint64_t) 0;
+            return true;
+        default:
+            return false;
+    }
+
+    // edge images change on their own every scan
+    return !((*w >= vm->i_rise && *w < vm->i_rise + vm->size[VM_I])
+            || (*w >= vm->i_fall && *w < vm->i_fall + vm->size[VM_I]));
+}
+
+typedef struct vm_seg_access {
+    const uint64_t *w;
+          uint64_t mask;
+          uint32_t seg;
+              bool write;
+} vm_seg_access_t;
+
+static int vm_seg_access_cmp(const void *a, const void *b) {
+    const uint64_t *wa = ((const vm_seg_access_t*) a)->w, *wb = ((const vm_seg_access_t*) b)->w;
+
+    return wa < wb ? -1 : wa > wb;
+}
+
+// reads and writes of the segment at start, false: it must always run.
+// writes are collected even then, other segments can't share them
+static bool vm_seg_scan(vm_t *vm, uint32_t start, vm_seg_access_t *acc, uint32_t *acc_len) {
+    vm_segment_t *seg = &vm->segs[vm->seg_at[start]];
+    const vm_op_t *op;
+    const uint64_t *w;
+    uint64_t mask;
+    uint32_t pc;
+    int depth = 0;
+    bool write;
+    // LD: doesn't depend on the accumulator left by the previous op
+    bool safe = vm->code[start].il == IL_LD;
+
+    for (pc = start; pc < seg->end; pc++) {
+        op = &vm->code[pc];
+        if (op->il == IL_JMP || op->il == IL_CAL || (op->flags & F_RETURN) || pc + op->len > seg->end)
+            safe = false;
+
+        if (op->flags & F_PUSH)
+            ++depth;
+        else if (op->il == IL_POP && --depth < 0)
+            safe = false;
+
+        write = op->il == IL_ST || op->il == IL_S || op->il == IL_R;
+        if (write) {
+            // counters: the word they count in
+            if (op->kind == K_PULSE) {
+                w = op->arg.w;
+                mask = ~(uint64_t) 0;
+                safe = false;
+            } else if (!vm_seg_location(vm, op, &w, &mask)) {
+                safe = false;
+                continue;
+            }
+        } else {
+            if (!safe || (op->il != IL_LD && !vm_is_operation(op->il)) || op->kind == K_NONE)
+                continue;
+            if (!vm_seg_location(vm, op, &w, &mask)) {
+                safe = false;
+                continue;
+            }
+        }
+        acc[*acc_len].w = w;
+        acc[*acc_len].mask = mask;
+        acc[*acc_len].seg = vm->seg_at[start];
+        acc[*acc_len].write = write;
+        ++*acc_len;
+    }
+
+    return safe && depth == 0;
+}
+
+// watched words: the ones read by segments that can be skipped, sorted accesses
+static uint8_t vm_seg_watch(vm_t *vm, const vm_seg_access_t *acc, uint32_t acc_len) {
+    uint32_t n, k, r, end, watches = 0;
+    uint64_t bit;
+    bool read;
+
+    vm->seg_watch = malloc((acc_len + 1) * sizeof(vm_seg_watch_t));
+    if (vm->seg_watch == NULL)
+        return VM_ERR_MEMORY;
+    vm->seg_fixed = 0;
+
+    for (n = 0; n < acc_len; n = end) {
+        read = false;
+        for (end = n; end < acc_len && acc[end].w == acc[n].w; end++)
+            if (!acc[end].write && !vm->segs[acc[end].seg].always)
+                read = true;
+        if (!read)
+            continue;
+
+        bit = (uint64_t) 1 << (watches % 64);
+        vm->seg_watch[watches].w = acc[n].w;
+        vm->seg_watch[watches].mask = 0;
+        for (k = n; k < end; k++)
+            if (!acc[k].write && !vm->segs[acc[k].seg].always) {
+                vm->seg_watch[watches].mask |= acc[k].mask;
+                vm->segs[acc[k].seg].reads |= bit;
+            }
+        memcpy(&vm->seg_watch[watches].last, acc[n].w, sizeof(uint64_t));
+        vm->seg_watch[watches].last &= vm->seg_watch[watches].mask;
+        ++watches;
+
+        // writers: only bits another segment reads are published, a segment sees its
+        // own writes at the next scan
+        for (k = n; k < end; k++) {
+            if (!acc[k].write)
+                continue;
+            for (r = n; r < end; r++)
+                if (!acc[r].write && acc[r].seg != acc[k].seg && !vm->segs[acc[r].seg].always
+                        && (acc[r].mask & acc[k].mask))
+                    break;
+            if (r == end)
+                continue;
+            if (vm->segs[acc[k].seg].always)
+                vm->seg_fixed |= bit;
+            else
+                vm->segs[acc[k].seg].writes |= bit;
+        }
+    }
+    vm->seg_watches = watches;
+
+    return VM_OK;
+}
+
+uint8_t vm_segment(vm_t *vm) {
+    vm_op_t *code = vm->code;
+    vm_seg_access_t *acc;
+    vm_segment_t *seg;
+    uint32_t pc, n, end, acc_len = 0;
+    int depth = 0;
+
+    if (code == NULL)
+        return VM_ERR_OPCODE;
+    vm_segments_free(vm);
+
+    vm->seg_at = malloc((vm->code_len + 1) * sizeof(uint32_t));
+    acc = malloc((vm->code_len + 1) * sizeof(vm_seg_access_t));
+    if (vm->seg_at == NULL || acc == NULL)
+        goto error;
+
+    // control flow boundaries
+    memset(vm->seg_at, 0xff, (vm->code_len + 1) * sizeof(uint32_t));
+    vm->seg_at[0] = 0;
+    for (pc = 0; pc < vm->code_len; pc++) {
+        if (code[pc].il == IL_JMP || code[pc].il == IL_CAL)
+            vm->seg_at[code[pc].target] = 0;
+        if (code[pc].il == IL_JMP || code[pc].il == IL_CAL || (code[pc].flags & F_RETURN))
+            vm->seg_at[pc + 1] = 0;
+    }
+    vm->seg_at[vm->code_len] = UINT32_MAX;
+
+    // and LD outside parenthesis
+    for (pc = 0; pc < vm->code_len; pc++) {
+        if (vm->seg_at[pc] != UINT32_MAX || (code[pc].il == IL_LD && depth == 0)) {
+            vm->seg_at[pc] = vm->segs_len++;
+            depth = 0;
+        }
+        if (code[pc].flags & F_PUSH)
+            ++depth;
+        else if (code[pc].il == IL_POP)
+            --depth;
+    }
+
+    if ((vm->segs = calloc(vm->segs_len, sizeof(vm_segment_t))) == NULL)
+        goto error;
+
+    for (end = pc = vm->code_len; pc-- > 0;)
+        if (vm->seg_at[pc] != UINT32_MAX) {
+            vm->segs[vm->seg_at[pc]].handler = code[pc].handler;
+            vm->segs[vm->seg_at[pc]].end = end;
+            end = pc;
+        }
+
+    for (pc = 0; pc < vm->code_len; pc++) {
+        if (vm->seg_at[pc] != UINT32_MAX)
+            vm->segs[vm->seg_at[pc]].always = !vm_seg_scan(vm, pc, acc, &acc_len);
+
+        // a segment entered in the middle by a superinstruction
+        for (n = pc + 1; n < pc + code[pc].len; n++)
+            if (vm->seg_at[n] != UINT32_MAX)
+                vm->segs[vm->seg_at[n]].always = true;
+    }
+
+    // a location written by two segments keeps the value of the last one that ran
+    qsort(acc, acc_len, sizeof(vm_seg_access_t), vm_seg_access_cmp);
+    for (pc = 0; pc < acc_len; pc++)
+        for (n = pc + 1; n < acc_len && acc[n].w == acc[pc].w; n++)
+            if (acc[n].write && acc[pc].write && acc[n].seg != acc[pc].seg && (acc[n].mask & acc[pc].mask)) {
+                vm->segs[acc[n].seg].always = true;
+                vm->segs[acc[pc].seg].always = true;
+            }
+
+    // a single fused rung is as cheap as the check
+    for (pc = 0; pc < vm->code_len; pc++)
+        if (vm->seg_at[pc] != UINT32_MAX && code[pc].handler == vm_dispatch[H_RUNG]
+                && pc + code[pc].len == vm->segs[vm->seg_at[pc]].end)
+            vm->segs[vm->seg_at[pc]].always = true;
+
+    if (vm_seg_watch(vm, acc, acc_len) != VM_OK)
+        goto error;
+
+    // segments that always run and start with LD don't need the previous accumulator:
+    // left unwrapped, the open segment before them closes at the next wrapped one
+    for (pc = 0; pc < vm->code_len; pc++) {
+        if (vm->seg_at[pc] == UINT32_MAX)
+            continue;
+        seg = &vm->segs[vm->seg_at[pc]];
+        if (!seg->always || code[pc].il != IL_LD)
+            code[pc].handler = vm_dispatch[H_SEGMENT];
+    }
+    vm->seg_scan = 0;
+
+    free(acc);
+    return VM_OK;
+
+    error:
+    free(acc);
+    vm_segments_free(vm);
+    return VM_ERR_MEMORY;
+}
+
+// nothing the segment reads changed since it last ran: one mask per scan in between
+static inline bool vm_seg_clean(vm_t *vm, vm_segment_t *seg) {
+    uint64_t changed, scan = vm->seg_scan, s = seg->seen;
+    bool clean;
+
+    // again in the same scan (loop, subroutine): it may read its own writes, which
+    // the words compared at the scan start don't show. it runs at the next scan too:
+    // seen stays VM_SEG_HISTORY scans back for the rest of this one
+    if (s == scan || scan - s == VM_SEG_HISTORY) {
+        seg->seen = scan - VM_SEG_HISTORY;
+        return false;
+    }
+    clean = seg->valid && scan - s < VM_SEG_HISTORY;
+    if (clean) {
+        // written after it ran in that scan, then everything since
+        changed = vm->seg_written[s % VM_SEG_HISTORY];
+        while (++s <= scan)
+            changed |= vm->seg_changed[s % VM_SEG_HISTORY];
+        clean = !(changed & seg->reads);
+    }
+    seg->seen = scan;
+
+    return clean;
+}
+
+// changed set of the scan: watched words against their values at the previous one
+static inline void vm_seg_changes(vm_t *vm) {
+    uint64_t changed = vm->seg_fixed, v;
+    vm_seg_watch_t *w;
+    uint32_t n;
+
+    for (n = 0, w = vm->seg_watch; n < vm->seg_watches; n++, w++) {
+        memcpy(&v, w->w, sizeof(v));
+        v &= w->mask;
+        changed |= (uint64_t) (v != w->last) << (n % 64);
+        w->last = v;
+    }
+    ++vm->seg_scan;
+    vm->seg_changed[vm->seg_scan % VM_SEG_HISTORY] = changed;
+    vm->seg_written[vm->seg_scan % VM_SEG_HISTORY] = 0;
+}
+
+#ifdef VM_PROFILE
+static inline uint64_t vm_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+#endif
+
 ////////////////////////// VM /////////////////////////////
-uint8_t vm_execute(uint32_t *vm_program, uint32_t prg_len) {
-    uint32_t pc = 0;
-    uint8_t status = 0;
-
-    static void *dispatch_vm[] = {
-            &&_IL_NOP, &&_IL_LD,
-            &&_IL_ST,  &&_IL_S,
-            &&_IL_R,   &&_IL_AND,
-            &&_IL_OR,  &&_IL_XOR,
-            &&_IL_NOT, &&_IL_ADD,
-            &&_IL_SUB, &&_IL_MUL,
-            &&_IL_DIV, &&_IL_GT,
-            &&_IL_GE,  &&_IL_EQ,
-            &&_IL_NE,  &&_IL_LE,
-            &&_IL_LT,  &&_IL_JMP,
-            &&_IL_CAL, &&_IL_HALT
+// scan body on the dispatch loop: no timers, edges or generation, vm_execute() does
+// them. vm_run_interp(NULL) only publishes the dispatch table for vm_load()
+uint8_t vm_run_interp(vm_t *vm) {
+    const vm_op_t *op, *ip;
+    uint32_t sp = 0, csp = 0;
+    uint64_t count = 0;
+    uint8_t status = VM_OK;
+    vm_value_t val;
+    vm_segment_t *seg, *open = NULL;
+#ifdef VM_PROFILE
+    vm_profile_t *prof;
+    uint64_t then, now;
+    uint32_t last = 0;
+#endif
+
+    static const void *dispatch_vm[H_END] = {
+            &&_IL_NOP,   &&_IL_LD,
+            &&_IL_ST,    &&_IL_S,
+            &&_IL_R,     &&_IL_AND,
+            &&_IL_OR,    &&_IL_XOR,
+            &&_IL_NOT,   &&_IL_ADD,
+            &&_IL_SUB,   &&_IL_MUL,
+            &&_IL_DIV,   &&_IL_GT,
+            &&_IL_GE,    &&_IL_EQ,
+            &&_IL_NE,    &&_IL_LE,
+            &&_IL_LT,    &&_IL_JMP,
+            &&_IL_CAL,   &&_IL_POP,
+            &&_IL_UNDEF, &&_IL_UNDEF,
+            &&_IL_UNDEF, &&_IL_UNDEF,
+            &&_IL_UNDEF, &&_IL_UNDEF,
+            &&_IL_UNDEF, &&_IL_UNDEF,
+            &&_IL_UNDEF, &&_IL_UNDEF,
+            [H_PUSH]       = &&_IL_PUSH,
+            [H_HALT]       = &&_IL_HALT,
+            [H_LD_CMP_JMP] = &&_H_LD_CMP_JMP,
+            [H_LD_OP_ST]   = &&_H_LD_OP_ST,
+            [H_LD_ST]      = &&_H_LD_ST,
+            [H_OP_POP]     = &&_H_OP_POP,
+            [H_CHAIN]      = &&_H_CHAIN,
+            [H_RUNG]       = &&_H_RUNG,
+            [H_SEGMENT]    = &&_H_SEGMENT
     };
-#define DISPATCH() \
-    goto *dispatch_vm[IL(vm_program[pc++])]
+
+    if (vm == NULL) {
+        vm_dispatch = dispatch_vm;
+        return VM_OK;
+    }
+    if (vm->code == NULL)
+        return VM_ERR_OPCODE;
+
+#ifdef VM_PROFILE
+// close the running address, open the next one
+#define PROFILE()                                  \
+    if (prof != NULL) {                            \
+        now = vm_cycles();                         \
+        prof->cycles[last] += now - then;          \
+        then = now;                                \
+        last = ip - vm->code;                      \
+        ++prof->pc[last];                          \
+        if (last < prof->len)                      \
+            ++prof->op[ip->il];                    \
+    }
+#else
+#define PROFILE()
+#endif
+
+#define DISPATCH()                   \
+    ip = op++;                       \
+    ++count;                         \
+    PROFILE();                       \
+    goto *ip->handler
+
+#define CONDITION()                  \
+    (!(ip->flags & F_COND) || (vm_truthy(vm->acc) ^ !!(ip->flags & F_NEG_INS)))
+
+// operate accumulator with (negated) operand
+#define OPERATE(il)                                                  \
+    OPERATE_OP(ip, il)
+
+#define OPERATE_OP(p, il)                                            \
+    vm_read(p, &val);                                                \
+    if ((p)->flags & F_NEG_INS)                                      \
+        vm_negate(&val);                                             \
+    if ((status = vm_operate(il, &vm->acc, val)) != VM_OK)           \
+        goto _IL_HALT
+
+#define LOAD(p)                                                      \
+    vm_read(p, &vm->acc);                                            \
+    if ((p)->flags & F_NEG_INS)                                      \
+        vm_negate(&vm->acc)
+
+#define STORE(p)                                                     \
+    val = vm->acc;                                                   \
+    if ((p)->flags & F_NEG_INS)                                      \
+        vm_negate(&val);                                             \
+    vm_write(vm, p, val)
+
+    op = vm->code;
+
+#ifdef VM_PROFILE
+    prof = vm->profile != NULL && vm->profile->len == vm->code_len ? vm->profile : NULL;
+    then = prof != NULL ? vm_cycles() : 0;
+#endif
 
     DISPATCH();
     ////////////////////
     _IL_NOP:
-    //
-
+    // R: (conditional) return
+    if ((ip->flags & F_RETURN) && CONDITION()) {
+        if (csp == 0)
+            goto _IL_HALT;
+        op = vm->code + vm->calls[--csp];
+    }
     DISPATCH();
 
     _IL_LD:
-    //
-
+    LOAD(ip);
     DISPATCH();
 
     _IL_ST:
-    //
-
+    STORE(ip);
     DISPATCH();
 
     _IL_S:
-    //
-
+    if (vm_truthy(vm->acc)) {
+        val.w = 1;
+        val.type = T_BOOL;
+        vm_write(vm, ip, val);
+    }
     DISPATCH();
 
     _IL_R:
-    //
-
+    if (vm_truthy(vm->acc)) {
+        val.w = 0;
+        val.type = T_BOOL;
+        vm_write(vm, ip, val);
+    }
     DISPATCH();
 
     _IL_AND:
-    //
-
+    OPERATE(IL_AND);
     DISPATCH();
 
     _IL_OR:
-    //
-
+    OPERATE(IL_OR);
     DISPATCH();
 
     _IL_XOR:
-    //
-
+    OPERATE(IL_XOR);
     DISPATCH();
 
     _IL_NOT:
-    //
-
+    vm_negate(&vm->acc);
     DISPATCH();
 
     _IL_ADD:
-    //
-
+    OPERATE(IL_ADD);
     DISPATCH();
 
     _IL_SUB:
-    //
-
+    OPERATE(IL_SUB);
     DISPATCH();
 
     _IL_MUL:
-    //
-
+    OPERATE(IL_MUL);
     DISPATCH();
 
     _IL_DIV:
-    //
-
+    OPERATE(IL_DIV);
     DISPATCH();
 
     _IL_GT:
-    //
-
+    OPERATE(IL_GT);
     DISPATCH();
 
     _IL_GE:
-    //
-
+    OPERATE(IL_GE);
     DISPATCH();
 
     _IL_EQ:
-    //
-
+    OPERATE(IL_EQ);
     DISPATCH();
 
     _IL_NE:
-    //
-
+    OPERATE(IL_NE);
     DISPATCH();
 
     _IL_LE:
-    //
-
+    OPERATE(IL_LE);
     DISPATCH();
 
     _IL_LT:
-    //
-
+    OPERATE(IL_LT);
     DISPATCH();
 
     _IL_JMP:
-    //
-
+    if (CONDITION())
+        op = vm->code + ip->target;
     DISPATCH();
 
     _IL_CAL:
-    //
+    if (CONDITION()) {
+        vm->calls[csp++] = op - vm->code;
+        op = vm->code + ip->target;
+    }
+    DISPATCH();
+
+    _IL_PUSH:
+    // save accumulator and pending operation, load operand
+    vm->stack[sp].acc = vm->acc;
+    vm->stack[sp].il = ip->il;
+    vm->stack[sp].neg = ip->flags & F_NEG_INS;
+    ++sp;
+    if (ip->kind != K_NONE)
+        vm_read(ip, &vm->acc);
+    DISPATCH();
+
+    _IL_POP:
+    // ): operate saved accumulator with (negated) parenthesis result
+    --sp;
+    val = vm->acc;
+    if (vm->stack[sp].neg)
+        vm_negate(&val);
+    vm->acc = vm->stack[sp].acc;
+    if ((status = vm_operate(vm->stack[sp].il, &vm->acc, val)) != VM_OK)
+        goto _IL_HALT;
+    DISPATCH();
+
+    ////////////////////
+    _H_LD_CMP_JMP:
+    LOAD(ip);
+    OPERATE_OP(ip + 1, ip[1].il);
+    op = ip + 3;
+    if (!(ip[2].flags & F_COND) || (vm->acc.w ^ !!(ip[2].flags & F_NEG_INS)))
+        op = vm->code + ip[2].target;
+    DISPATCH();
 
+    _H_LD_OP_ST:
+    LOAD(ip);
+    OPERATE_OP(ip + 1, ip[1].il);
+    STORE(ip + 2);
+    op = ip + 3;
     DISPATCH();
 
+    _H_LD_ST:
+    LOAD(ip);
+    STORE(ip + 1);
+    op = ip + 2;
+    DISPATCH();
+
+    _H_OP_POP:
+    // ( x ): pending operation with (negated) x
+    OPERATE(ip->il);
+    op = ip + 2;
+    DISPATCH();
+
+    _H_CHAIN:
+    // same associative operation: no stack needed
+    for (op = ip; op < ip + ip->len; op++)
+        if (op->kind != K_NONE) {
+            OPERATE_OP(op, ip->il);
+        }
+    DISPATCH();
+
+    _H_RUNG:
+    vm->acc.w = vm_rung(ip->rung);
+    vm->acc.type = T_BOOL;
+    op = ip + ip->len;
+    DISPATCH();
+
+    _H_SEGMENT:
+    // the previous segment ended here
+    seg = &vm->segs[vm->seg_at[ip - vm->code]];
+    if (open != NULL) {
+        open->acc = vm->acc;
+        open->valid = true;
+        open = NULL;
+    }
+    // clean segments in a row are skipped without dispatching, segments are numbered
+    // in program order: the one at seg->end is seg + 1
+    while (!seg->always && vm_seg_clean(vm, seg)) {
+        vm->acc = seg->acc;
+        ++vm->segs_skipped;
+        op = vm->code + seg->end;
+        if (op->handler != &&_H_SEGMENT) {
+            DISPATCH();
+        }
+        ip = op++;
+        ++seg;
+    }
+    if (!seg->always) {
+        seg->valid = false;
+        open = seg;
+        // its writes, for the segments after it in this scan
+        vm->seg_changed[vm->seg_scan % VM_SEG_HISTORY] |= seg->writes;
+        vm->seg_written[vm->seg_scan % VM_SEG_HISTORY] |= seg->writes;
+    }
+    goto *seg->handler;
+
+    _IL_UNDEF:
+    status = VM_ERR_OPCODE;
+
     _IL_HALT:
-    //
+    if (open != NULL && status == VM_OK) {
+        open->acc = vm->acc;
+        open->valid = true;
+    }
+    vm->instructions += count;
+    return status;
+}
+
+// vm_execute(NULL) only publishes the dispatch table for vm_load()
+uint8_t vm_execute(vm_t *vm) {
+    vm_t *next;
+    uint8_t status;
+
+    if (vm == NULL)
+        return vm_run_interp(NULL);
+    // online change: one load per scan
+    if (__atomic_load_n(&vm->pending, __ATOMIC_RELAXED) != NULL
+            && (next = __atomic_exchange_n(&vm->pending, NULL, __ATOMIC_ACQUIRE)) != NULL)
+        vm_swap(vm, next);
+    if (vm->code == NULL)
+        return VM_ERR_OPCODE;
+
+    // readers retry while the generation is odd or changed
+    if (vm->generation != NULL) {
+        __atomic_store_n(vm->generation, *vm->generation + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    vm_timers_update(vm);
+    vm_edges(vm);
+    if (vm->segs != NULL && vm->native == NULL)
+        vm_seg_changes(vm);
+    vm->acc.w = 0;
+    vm->acc.type = T_BOOL;
+
+    status = vm->native != NULL ? vm->native(vm) : vm_run_interp(vm);
+
+    if (vm->generation != NULL)
+        __atomic_store_n(vm->generation, *vm->generation + 1, __ATOMIC_RELEASE);
     return status;
 }
+
+////////////////////// REFERENCE ENGINES //////////////////////
+// same semantics as vm_execute() with other dispatch techniques, for benchmarks.
+// they run op by op and ignore superinstructions. select with
+// vm_select(vm, VM_ENGINE_SWITCH, vm_run_switch) / (vm, VM_ENGINE_CALL, vm_run_call)
+
+uint8_t vm_run_switch(vm_t *vm) {
+    const vm_op_t *ip, *op = vm->code;
+    uint32_t sp = 0, csp = 0;
+    uint8_t status = VM_OK;
+    vm_value_t val;
+
+    for (;;) {
+        ip = op++;
+
+        if (ip->flags & F_PUSH) {
+            vm->stack[sp].acc = vm->acc;
+            vm->stack[sp].il = ip->il;
+            vm->stack[sp].neg = ip->flags & F_NEG_INS;
+            ++sp;
+            if (ip->kind != K_NONE)
+                vm_read(ip, &vm->acc);
+            continue;
+        }
+
+        switch (ip->il) {
+            case IL_NOP:
+                if ((ip->flags & F_RETURN) && CONDITION()) {
+                    if (csp == 0)
+                        return status;
+                    op = vm->code + vm->calls[--csp];
+                }
+                break;
+            case IL_LD:
+                LOAD(ip);
+                break;
+            case IL_ST:
+                STORE(ip);
+                break;
+            case IL_S:
+            case IL_R:
+                if (vm_truthy(vm->acc)) {
+                    val.w = ip->il == IL_S;
+                    val.type = T_BOOL;
+                    vm_write(vm, ip, val);
+                }
+                break;
+            case IL_NOT:
+                vm_negate(&vm->acc);
+                break;
+            case IL_JMP:
+                if (CONDITION())
+                    op = vm->code + ip->target;
+                break;
+            case IL_CAL:
+                if (CONDITION()) {
+                    vm->calls[csp++] = op - vm->code;
+                    op = vm->code + ip->target;
+                }
+                break;
+            case IL_POP:
+                --sp;
+                val = vm->acc;
+                if (vm->stack[sp].neg)
+                    vm_negate(&val);
+                vm->acc = vm->stack[sp].acc;
+                if ((status = vm_operate(vm->stack[sp].il, &vm->acc, val)) != VM_OK)
+                    return status;
+                break;
+            case H_HALT:
+                return status;
+            default:
+                vm_read(ip, &val);
+                if (ip->flags & F_NEG_INS)
+                    vm_negate(&val);
+                if ((status = vm_operate(ip->il, &vm->acc, val)) != VM_OK)
+                    return status;
+        }
+    }
+}
+
+// call threading: one function per instruction returns the next op, NULL halts
+typedef struct vm_call_state {
+    uint32_t sp;      //
+    uint32_t csp;     //
+     uint8_t status;  //
+} vm_call_state_t;
+
+typedef const vm_op_t* (*vm_call_t)(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st);
+
+static const vm_op_t* vm_call_nop(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    if ((ip->flags & F_RETURN) && CONDITION()) {
+        if (st->csp == 0)
+            return NULL;
+        return vm->code + vm->calls[--st->csp];
+    }
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_ld(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    (void) st;
+    LOAD(ip);
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_st(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    vm_value_t val;
+
+    (void) st;
+    STORE(ip);
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_set(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    vm_value_t val;
+
+    (void) st;
+    if (vm_truthy(vm->acc)) {
+        val.w = ip->il == IL_S;
+        val.type = T_BOOL;
+        vm_write(vm, ip, val);
+    }
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_operate(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    vm_value_t val;
+
+    vm_read(ip, &val);
+    if (ip->flags & F_NEG_INS)
+        vm_negate(&val);
+    if ((st->status = vm_operate(ip->il, &vm->acc, val)) != VM_OK)
+        return NULL;
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_not(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    (void) st;
+    vm_negate(&vm->acc);
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_jmp(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    (void) st;
+    return CONDITION() ? vm->code + ip->target : ip + 1;
+}
+
+static const vm_op_t* vm_call_cal(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    if (!CONDITION())
+        return ip + 1;
+    vm->calls[st->csp++] = ip + 1 - vm->code;
+    return vm->code + ip->target;
+}
+
+static const vm_op_t* vm_call_push(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    vm->stack[st->sp].acc = vm->acc;
+    vm->stack[st->sp].il = ip->il;
+    vm->stack[st->sp].neg = ip->flags & F_NEG_INS;
+    ++st->sp;
+    if (ip->kind != K_NONE)
+        vm_read(ip, &vm->acc);
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_pop(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    vm_stack_t *top = &vm->stack[--st->sp];
+    vm_value_t val = vm->acc;
+
+    if (top->neg)
+        vm_negate(&val);
+    vm->acc = top->acc;
+    if ((st->status = vm_operate(top->il, &vm->acc, val)) != VM_OK)
+        return NULL;
+    return ip + 1;
+}
+
+static const vm_op_t* vm_call_halt(vm_t *vm, const vm_op_t *ip, vm_call_state_t *st) {
+    (void) vm;
+    (void) ip;
+    (void) st;
+    return NULL;
+}
+
+uint8_t vm_run_call(vm_t *vm) {
+    static const vm_call_t call[H_HALT + 1] = {
+            [IL_NOP]  = vm_call_nop,     [IL_LD]  = vm_call_ld,      [IL_ST]  = vm_call_st,
+            [IL_S]    = vm_call_set,     [IL_R]   = vm_call_set,     [IL_AND] = vm_call_operate,
+            [IL_OR]   = vm_call_operate, [IL_XOR] = vm_call_operate, [IL_NOT] = vm_call_not,
+            [IL_ADD]  = vm_call_operate, [IL_SUB] = vm_call_operate, [IL_MUL] = vm_call_operate,
+            [IL_DIV]  = vm_call_operate, [IL_GT]  = vm_call_operate, [IL_GE]  = vm_call_operate,
+            [IL_EQ]   = vm_call_operate, [IL_NE]  = vm_call_operate, [IL_LE]  = vm_call_operate,
+            [IL_LT]   = vm_call_operate, [IL_JMP] = vm_call_jmp,     [IL_CAL] = vm_call_cal,
+            [IL_POP]  = vm_call_pop,     [H_PUSH] = vm_call_push,    [H_HALT] = vm_call_halt,
+    };
+    vm_call_state_t st = { 0, 0, VM_OK };
+    const vm_op_t *ip = vm->code;
+
+    while (ip != NULL)
+        ip = call[ip->flags & F_PUSH ? H_PUSH : ip->il](vm, ip, &st);
+
+    return st.status;
+}
@@ -21,8 +21,7 @@
 #ifndef LIBRELOGIC_NEWVM_H_
 #define LIBRELOGIC_NEWVM_H_
 
-#define DEBUG
-
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -60,7 +59,7 @@
 #define BIT_WORD(x)            (x & 0x400000)
 #define BIT_NEGATE_ARG(x)      (x & 0x200000)
 
-#define SET_IL(i, v)           (i = (i | (v << 27)))
+#define SET_IL(i, v)           (i = (i | ((uint32_t) (v) << 27)))
 #define SET_OPERAND(i, v)      (i = (i | (v << 16)))
 #define SET_COND(i)            (i = (i | 0x4000000))
 #define SET_NEGATE_INS(i)      (i = (i | 0x2000000))
@@ -89,12 +88,12 @@
     v.insword1   = INSWORD1(ins);       \
     v.insword2   = INSWORD2(ins);
 
-#ifdef DEBUG
-    #define DBG_PRINT(fmt, args...)  \
-                fprintf(stderr, "" fmt, ##args)
-#else
-    #define DBG_PRINT(fmt, args...)
-#endif
+// debug tracing: off while vm_trace is NULL
+#define DBG_PRINT(fmt, args...)          \
+    do {                                 \
+        if (vm_trace != NULL)            \
+            vm_trace("" fmt, ##args);    \
+    } while (0)
 
 typedef struct instr {
         bool bit_cond;   //
@@ -114,7 +113,7 @@ typedef struct instr {
 
 typedef enum IL_COMMANDS {
 //   instr  //       | modifiers |  description
-    IL_NOP, //  0x00 |           |  Not operation
+    IL_NOP, //  0x00 |    CNR    |  Not operation (with R: (conditional) return from CAL).
     IL_LD,  //  0x01 |     N     |  Loads the (negated) the value of the operand into the accumulator.
     IL_ST,  //  0x02 |     N     |  Stores the (negated) content of the accumulator in the operand.
     IL_S,   //  0x03 |           |  Sets the operand (type BOOL) to TRUE if the content of the accumulator is TRUE.
@@ -172,6 +171,335 @@ typedef enum IL_OPERANDS {
     OP_END,          // 0x12 |
 } il_operands_t;
 
-uint8_t vm_execute(uint32_t *vm_program, uint32_t prg_len);
+// VM STATE
+// integer areas are arrays of 64 bit two's complement words. A byte/bit operand
+// (%m3/5) addresses bit 5 of word 3, a word operand (%m3) the whole word.
+// real areas are arrays of double.
+// timers (t/T) and blinkers (b) are addressed by index, the bit is ignored.
+
+#define VM_STACK_DEPTH 32 // parenthesis stack depth
+#define VM_CALL_DEPTH  16 // CAL nesting depth
+
+typedef enum VM_STATUS {
+    VM_OK,            // scan completed
+    VM_ERR_OPCODE,    // undefined instruction
+    VM_ERR_OPERAND,   // bad operand type for instruction or index out of range
+    VM_ERR_STACK,     // parenthesis unbalanced or deeper than VM_STACK_DEPTH, CAL/RET inside parenthesis
+    VM_ERR_CALL,      // recursive CAL or deeper than VM_CALL_DEPTH
+    VM_ERR_JUMP,      // jump target out of program
+    VM_ERR_DIV_ZERO,  // integer division by zero
+    VM_ERR_MEMORY,    // can't allocate vm areas
+} vm_status_t;
+
+typedef enum VM_AREAS {
+    VM_I,      // i, f, r
+    VM_I_REAL, // if
+    VM_M,      // m, M
+    VM_M_REAL, // mf, MF
+    VM_C,      // c, W
+    VM_Q,      // q, Q
+    VM_Q_REAL, // qf, QF
+    VM_T,      // t, T
+    VM_B,      // b
+    VM_AREAS
+} vm_areas_t;
+
+typedef enum VM_TYPES {
+    T_BOOL, //
+    T_WORD, //
+    T_REAL, //
+} vm_types_t;
+
+typedef struct vm_value {
+    union {
+        uint64_t w; //
+          double r; //
+    };
+     uint8_t type;  // vm_types_t
+} vm_value_t;
+
+typedef enum VM_ENGINES {
+    VM_ENGINE_INTERP,   // dispatch loop
+    VM_ENGINE_JIT,      // jit_compile()
+    VM_ENGINE_AOT,      // aot_load()
+    VM_ENGINE_SWITCH,   // vm_run_switch(), reference
+    VM_ENGINE_CALL,     // vm_run_call(), reference
+    VM_ENGINE_PARALLEL, // parallel_start()
+} vm_engines_t;
+
+typedef struct vm_timer {
+    uint64_t preset; // ms, read at rising edge of T
+    uint64_t start;  // vm time at rising edge of T
+        bool en;     // T: timer input
+        bool q;      // t: timer output
+} vm_timer_t;
+
+typedef struct vm_blinker {
+    uint64_t period; // ms (half cycle), set with vm_blinker_set()
+        bool q;      // b: blinker output
+} vm_blinker_t;
+
+// TIMING WHEEL
+// running timers and blinkers wait in a hierarchical timing wheel: VM_WHEEL_LEVELS
+// levels of 64 slots, level l slots span 64^l ticks. an entry sits in the level of
+// the highest 6 bit digit where its expiration differs from the current tick and
+// moves down when the wheel reaches its slot. a bitmap of busy slots per level
+// finds the next event, so a scan costs the expirations, not the timers count.
+// expirations beyond 64^VM_WHEEL_LEVELS ticks wait in an overflow list.
+// a tick is vm_timer_resolution() ms (default 1), independent of the scan period:
+// outputs are never early and late by less than a tick. vm->time must not go back.
+
+#define VM_WHEEL_LEVELS 4
+#define VM_WHEEL_SLOTS  (VM_WHEEL_LEVELS * 64)
+#define VM_WHEEL_NONE   UINT32_MAX
+
+typedef struct vm_wheel_node {
+    uint64_t expire; // tick
+    uint32_t next;   // list links
+    uint32_t prev;   //
+    uint32_t list;   // slot, VM_WHEEL_SLOTS: overflow, VM_WHEEL_NONE: not armed
+        bool queued; // timer: T changed since last scan
+} vm_wheel_node_t;
+
+typedef struct vm_wheel {
+           uint64_t res;                      // ms per tick
+           uint64_t tick;                     // current tick
+           uint64_t busy[VM_WHEEL_LEVELS];    // non empty slots
+           uint32_t head[VM_WHEEL_SLOTS + 1]; // slot lists, then overflow
+           uint32_t armed;                    // nodes in the wheel
+    vm_wheel_node_t *node;                    // timers, then blinkers
+           uint32_t *queue;                   // timers to (re)arm at next scan
+           uint32_t queued;                   //
+} vm_wheel_t;
+
+typedef struct vm_stack {
+    vm_value_t acc;  // accumulator at push
+       uint8_t il;   // pending operation
+          bool neg;  // negate parenthesis result
+} vm_stack_t;
+
+// SUPERINSTRUCTIONS
+// vm_fuse() replaces the handler of the first op of common sequences with a fused
+// handler covering the whole sequence. The covered ops are left untouched, so
+// jumps into the middle of a sequence still run them one by one:
+//   LD x / GT..LT y / JMP label
+//   LD x / AND..DIV y / ST z
+//   LD x / ST y
+//   AND..LT( x / )
+//   AND|OR|XOR( x / (AND|OR|XOR)[(] y / ... / ) / ...  same operation, no N
+//
+// BOOLEAN RUNGS
+// a balanced sequence starting with LD of a bit and made only of AND/OR/XOR[N][(]
+// over bits, ) and NOT is compiled to sum of products: the rung is true when, for
+// any term, every word read satisfies (word & mask) == value. evaluation reads each
+// word once and has no stack traffic nor per contact dispatch. rungs needing more
+// than VM_RUNG_WORDS words or VM_RUNG_TERMS terms are left to the other fusions.
+
+#define VM_RUNG_WORDS 4
+#define VM_RUNG_TERMS 32
+
+typedef struct vm_rung_term {
+    uint64_t mask[VM_RUNG_WORDS];  // bits tested per word
+    uint64_t value[VM_RUNG_WORDS]; // required value of the tested bits
+} vm_rung_term_t;
+
+typedef struct vm_rung {
+     struct vm_rung *next;                // vm->rungs list
+     const uint64_t *word[VM_RUNG_WORDS]; // unused words point to a zero word
+           uint32_t terms;                //
+     vm_rung_term_t term[];               //
+} vm_rung_t;
+
+// INCREMENTAL EXECUTION
+// vm_segment() splits the program in segments: at LD outside parenthesis, at jump
+// and CAL targets and after JMP/CAL/RET. the words the segments read are watched:
+// once per scan vm_execute() compares them with their values at the previous scan
+// (like the edge images) into a changed set, one bit per word (words past 64 share
+// bits), and a segment writing a word another one reads adds it while it runs.
+// the first op of a segment tests its read set against the changes since it last
+// ran with a single mask: if none changed, the segment is skipped and the
+// accumulator it left is restored. segments that can't be skipped safely always
+// run: control flow, timers, blinkers, edges, counters, a location also written by
+// another segment, a start that depends on the accumulator or the stack, a
+// superinstruction crossing the end. their writes count as changed every scan.
+// those starting with LD, and a body that is a single fused rung, are not wrapped
+// at all: the check would cost as much as the body. locations the program writes
+// must not be written from outside, vm_dirty() forces a full scan after such a
+// write. call after vm_fuse(): vm_fuse() and vm_load() drop segments. vm_select()
+// marks them dirty, only the goto interpreter skips.
+
+#define VM_SEG_HISTORY 8 // scans of changes kept for segments jumped over
+
+typedef struct vm_seg_watch {
+    const uint64_t *w;     // word read (reals: their bits)
+          uint64_t mask;   // bits read
+          uint64_t last;   // value at the start of the last scan
+} vm_seg_watch_t;
+
+typedef struct vm_segment {
+      const void *handler;  // first op handler
+        uint32_t end;       // first op after the segment
+        uint64_t reads;     // watched words read, bit n % 64 of vm->seg_watch[n]
+        uint64_t writes;    // watched words written that other segments read
+        uint64_t seen;      // scan it last ran or was skipped
+      vm_value_t acc;       // accumulator at the end of last run
+            bool always;    // can't be skipped
+            bool valid;     // last run completed
+} vm_segment_t;
+
+// ONLINE CHANGE
+// vm_stage() loads a program in a shadow vm sharing the areas of a running one:
+// decoded and verified against the same area sizes, then fused or segmented as
+// the caller wants, without touching the running vm. storing the shadow in
+// vm->pending publishes it. the next vm_execute() takes it, swaps the programs
+// before the scan and clears the shadow pending field: the shadow then holds the
+// previous program, release it with vm_deinit(). the scan pays one load while
+// nothing is pending. areas are indexed by operand address, so memory, timers,
+// blinkers, counters and edge history carry over in place. native engines don't
+// follow the swap: the vm goes back to the interpreter. see librelogic_swap.h
+
+// PRE-DECODED PROGRAM
+// vm_load() translates the instruction words once: each vm_op_t holds the handler
+// address, the operand resolved to a pointer into the vm areas, the bit mask and
+// the modifiers. The scan loop does no decoding at all.
+// r/f operands read the edge images vm_execute() computes once at scan start, so
+// they are plain bit or word reads.
+
+typedef enum VM_KINDS {
+    K_NONE,     // no operand
+    K_BIT,      // bit of word: arg.w & mask
+    K_WORD,     // word: arg.w
+    K_REAL,     // real: arg.r
+    K_TIMER_Q,  // timer output: arg.t->q
+    K_TIMER_EN, // timer input: arg.t->en
+    K_BLINK,    // blinker output: arg.b->q
+    K_PULSE,    // counter: arg.w, pulse history in pulse
+} vm_kinds_t;
+
+typedef enum VM_FLAGS {
+    F_COND    = 0x01, // C
+    F_NEG_INS = 0x02, // N
+    F_NEG_ARG = 0x04, // G
+    F_RETURN  = 0x08, // R
+    F_PUSH    = 0x10, // (
+} vm_flags_t;
+
+typedef struct vm_op {
+      const void *handler;  // dispatch address
+    union {
+        uint64_t *w;        //
+          double *r;        //
+      vm_timer_t *t;        //
+    vm_blinker_t *b;        //
+    } arg;                  // resolved operand
+    union {
+         uint8_t *pulse;    // counters: pulse history
+        uint32_t target;    // JMP/CAL: program address
+ const vm_rung_t *rung;     // boolean rung (LD of a bit)
+    };
+        uint64_t mask;      // bit mask (0: whole word)
+         uint8_t kind;      // vm_kinds_t
+         uint8_t flags;     // vm_flags_t
+         uint8_t il;        // il_commands_t
+        uint16_t len;       // superinstruction: ops covered
+} vm_op_t;
+
+// PROFILER
+// built with -DVM_PROFILE, vm_execute() counts every dispatch of a vm with a profile
+// attached (vm->profile, len = code_len): per opcode, per program address and the
+// cycles from one dispatch to the next. a superinstruction counts for its first op,
+// attach before vm_fuse() for exact per instruction figures.
+// address code_len counts completed scans. see librelogic_profile.h
+
+typedef struct vm_profile {
+    uint64_t op[32];    // dispatches per il_commands_t
+    uint64_t *pc;       // dispatches per address (len + 1)
+    uint64_t *cycles;   // cycles per address (len + 1)
+    uint32_t len;       // program length
+} vm_profile_t;
+
+typedef struct vm {
+      vm_value_t acc;              // accumulator
+        uint64_t *i;               // inputs
+        uint64_t *i_prev;          // inputs at previous scan (edges)
+        uint64_t *i_rise;          // rising edges image: i & ~i_prev
+        uint64_t *i_fall;          // falling edges image: i_prev & ~i
+          double *i_real;          // real inputs
+        uint64_t *m;               // memory / counters
+         uint8_t *m_pulse;         // counters pulse history (M)
+          double *m_real;          // real memory
+        uint64_t *c;               // commands
+        uint64_t *q;               // outputs
+          double *q_real;          // real outputs
+      vm_timer_t *t;               // timers
+    vm_blinker_t *b;               // blinkers
+        uint32_t size[VM_AREAS];   // elements per area
+      vm_stack_t stack[VM_STACK_DEPTH];
+        uint32_t calls[VM_CALL_DEPTH];
+        uint32_t stack_depth;      // verified maximum parenthesis depth
+        uint32_t call_depth;       // verified maximum CAL nesting
+         vm_op_t *code;            // pre-decoded program (code_len + halt)
+        uint32_t code_len;         //
+         uint8_t engine;           // vm_engines_t
+         uint8_t (*native)(struct vm *vm); // compiled program, runs the scan body
+            void *native_ctx;      // native engine state, may be NULL
+        uint64_t time;             // ms, set by caller before each scan
+        uint64_t instructions;     // dispatched by the interpreter since vm_init()
+    vm_profile_t *profile;         // VM_PROFILE builds, may be NULL
+       vm_rung_t *rungs;           // compiled by vm_fuse()
+      vm_wheel_t wheel;            // running timers and blinkers
+    vm_segment_t *segs;            // vm_segment(), NULL: every op runs
+        uint32_t segs_len;         //
+        uint32_t *seg_at;          // segment starting at each address
+        uint64_t segs_skipped;     // since vm_segment()
+  vm_seg_watch_t *seg_watch;       // words read by the segments
+        uint32_t seg_watches;      //
+        uint64_t seg_fixed;        // watched words written by segments that always run
+        uint64_t seg_scan;         // scans since vm_segment()
+        uint64_t seg_changed[VM_SEG_HISTORY]; // by scan: watched words changed at its start or written
+        uint64_t seg_written[VM_SEG_HISTORY]; // by scan: watched words written during it
+        uint64_t *generation;      // odd while a scan runs (seqlock for readers), may be NULL
+     struct vm *pending;           // staged vm, its program runs from next scan
+            void *mem;             // areas storage
+            bool mem_extern;       // storage from vm_init_at(), not freed
+            bool code_extern;      // code from vm_load_at(), not freed
+} vm_t;
+
+extern const uint8_t vm_operand_area[OP_END]; // vm_areas_t of each operand
+extern int (*vm_trace)(const char *fmt, ...);  // DBG_PRINT sink, NULL: tracing off
+
+uint8_t vm_init(vm_t *vm, const uint32_t size[VM_AREAS]);
+uint8_t vm_init_at(vm_t *vm, const uint32_t size[VM_AREAS], void *storage);
+ size_t vm_mem_len(const uint32_t size[VM_AREAS]);
+   void vm_deinit(vm_t *vm);
+uint8_t vm_load(vm_t *vm, const uint32_t *vm_program, uint32_t prg_len);
+uint8_t vm_load_at(vm_t *vm, const uint32_t *vm_program, uint32_t prg_len, void *storage);
+ size_t vm_code_len(uint32_t prg_len);
+uint8_t vm_stage(const vm_t *vm, vm_t *next, const uint32_t *vm_program, uint32_t prg_len);
+   void vm_fuse(vm_t *vm);
+uint8_t vm_segment(vm_t *vm);
+   void vm_dirty(vm_t *vm);
+uint8_t vm_select(vm_t *vm, uint8_t engine, uint8_t (*native)(vm_t *vm));
+uint8_t vm_execute(vm_t *vm);
+   void vm_timer_resolution(vm_t *vm, uint64_t res);
+uint8_t vm_blinker_set(vm_t *vm, uint32_t n, uint64_t period);
+uint8_t vm_run_interp(vm_t *vm);
+uint8_t vm_run_switch(vm_t *vm);
+uint8_t vm_run_call(vm_t *vm);
+
+// T: timer input, a rising edge restarts timer n. the wheel is updated at next scan
+static inline void vm_timer_input(vm_t *vm, uint32_t n, bool en) {
+    vm_timer_t *t = &vm->t[n];
+
+    if (en == t->en)
+        return;
+    if (en)
+        t->start = vm->time;
+    t->en = en;
+    if (!vm->wheel.node[n].queued) {
+        vm->wheel.node[n].queued = true;
+        vm->wheel.queue[vm->wheel.queued++] = n;
+    }
+}
 
 #endif /* LIBRELOGIC_NEWVM_H_ */
@@ -0,0 +1,489 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_parallel.h"
+
+#define PARALLEL_NONE UINT32_MAX
+
+// word touched by an instruction
+typedef struct parallel_access {
+    const void *loc;     //
+      uint32_t block;    //
+          bool write;    //
+} parallel_access_t;
+
+static inline void parallel_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline void parallel_futex(uint32_t *addr, int op, uint32_t val) {
+    syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+////////////////////// SPLIT //////////////////////
+
+static uint32_t parallel_root(uint32_t *parent, uint32_t b) {
+    while (parent[b] != b)
+        b = parent[b] = parent[parent[b]];
+
+    return b;
+}
+
+// the lowest block stays root: sections are numbered in program order
+static void parallel_union(uint32_t *parent, uint32_t a, uint32_t b) {
+    a = parallel_root(parent, a);
+    b = parallel_root(parent, b);
+    if (a < b)
+        parent[b] = a;
+    else
+        parent[a] = b;
+}
+
+static void parallel_join(uint32_t *parent, uint32_t from, uint32_t to) {
+    for (; from < to; from++)
+        parallel_union(parent, from, from + 1);
+}
+
+static int parallel_access_cmp(const void *a, const void *b) {
+    const void *la = ((const parallel_access_t*) a)->loc, *lb = ((const parallel_access_t*) b)->loc;
+
+    return la < lb ? -1 : la > lb;
+}
+
+// words accessed by op (at most 2), returns their number
+static uint32_t parallel_op_access(const vm_t *vm, const vm_op_t *op, parallel_access_t *acc, uint32_t block) {
+    bool write = op->il == IL_ST || op->il == IL_S || op->il == IL_R;
+
+    if (!write && op->il != IL_LD && (op->il < IL_AND || op->il > IL_LT || op->il == IL_NOT))
+        return 0;
+
+    acc[0].block = acc[1].block = block;
+    acc[0].write = write;
+    switch (op->kind) {
+        case K_BIT:
+        case K_WORD:
+        case K_PULSE:
+            acc[0].loc = op->arg.w;
+            return 1;
+        case K_REAL:
+            acc[0].loc = op->arg.r;
+            return 1;
+        case K_TIMER_Q:
+        case K_TIMER_EN:
+            acc[0].loc = op->arg.t;
+            if (!write)
+                return 1;
+            // T coil: queues the timer in the wheel
+            acc[1].loc = &vm->wheel;
+            acc[1].write = true;
+            return 2;
+        case K_BLINK:
+            acc[0].loc = op->arg.b;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// union-find of the program blocks, returns the number of blocks
+static uint32_t parallel_blocks(const vm_t *vm, uint32_t *block_at, uint32_t **parent) {
+    const vm_op_t *code = vm->code;
+    parallel_access_t *acc;
+    uint32_t pc, n, k, end, blocks = 0, accs = 0;
+    int depth = 0;
+    bool write;
+
+    for (pc = 0; pc < vm->code_len; pc++) {
+        if (pc == 0 || (code[pc].il == IL_LD && depth == 0))
+            ++blocks;
+        block_at[pc] = blocks - 1;
+        if (code[pc].flags & F_PUSH)
+            ++depth;
+        else if (code[pc].il == IL_POP)
+            --depth;
+    }
+    block_at[vm->code_len] = blocks - 1;
+
+    *parent = malloc(blocks * sizeof(uint32_t));
+    acc = malloc(2 * vm->code_len * sizeof(parallel_access_t));
+    if (*parent == NULL || acc == NULL) {
+        free(*parent);
+        free(acc);
+        return 0;
+    }
+    for (n = 0; n < blocks; n++)
+        (*parent)[n] = n;
+
+    for (pc = 0; pc < vm->code_len; pc++) {
+        n = block_at[pc];
+        switch (code[pc].il) {
+            case IL_JMP:
+                k = block_at[code[pc].target];
+                // with the blocks it skips
+                parallel_join(*parent, n < k ? n : k, n < k ? k : n);
+                break;
+            case IL_CAL:
+                k = block_at[code[pc].target];
+                // subroutine: up to the first unconditional RET
+                for (end = code[pc].target; end < vm->code_len; end++)
+                    if ((code[end].flags & F_RETURN) && !(code[end].flags & F_COND))
+                        break;
+                parallel_union(*parent, n, k);
+                parallel_join(*parent, k, block_at[end]);
+                break;
+        }
+        // RET can end the scan
+        if (code[pc].flags & F_RETURN)
+            parallel_join(*parent, n, blocks - 1);
+
+        accs += parallel_op_access(vm, &code[pc], &acc[accs], n);
+    }
+
+    // a word written by a block: every block reading or writing it
+    qsort(acc, accs, sizeof(parallel_access_t), parallel_access_cmp);
+    for (n = 0; n < accs; n = end) {
+        write = false;
+        for (end = n; end < accs && acc[end].loc == acc[n].loc; end++)
+            write |= acc[end].write;
+        if (write)
+            for (k = n + 1; k < end; k++)
+                parallel_union(*parent, acc[n].block, acc[k].block);
+    }
+    free(acc);
+
+    return blocks;
+}
+
+// section of the blocks under root, in program order. jumps are relocated
+static uint8_t parallel_section(parallel_t *par, parallel_section_t *sec, const uint32_t *block_at,
+        uint32_t *parent, uint32_t root, uint32_t *map) {
+    const vm_t *vm = par->vm;
+    vm_op_t *op;
+    uint32_t pc, len = 0;
+
+    for (pc = 0; pc < vm->code_len; pc++)
+        if (parallel_root(parent, block_at[pc]) == root)
+            map[pc] = len++;
+    map[vm->code_len] = len;
+
+    if ((sec->code = malloc((len + 1) * sizeof(vm_op_t))) == NULL)
+        return PARALLEL_ERR_MEMORY;
+    sec->len = len;
+    sec->status = VM_OK;
+
+    for (pc = 0, op = sec->code; pc < vm->code_len; pc++) {
+        if (parallel_root(parent, block_at[pc]) != root)
+            continue;
+        if (op == sec->code)
+            sec->first = pc;
+        *op = vm->code[pc];
+        // segment heads
+        if (vm->seg_at != NULL && vm->seg_at[pc] != UINT32_MAX)
+            op->handler = vm->segs[vm->seg_at[pc]].handler;
+        if (op->il == IL_JMP || op->il == IL_CAL)
+            op->target = map[op->target];
+        ++op;
+    }
+    *op = vm->code[vm->code_len];
+
+    sec->ctx = *vm;
+    sec->ctx.code = sec->code;
+    sec->ctx.code_len = len;
+    sec->ctx.engine = VM_ENGINE_INTERP;
+    sec->ctx.native = NULL;
+    sec->ctx.native_ctx = NULL;
+    sec->ctx.profile = NULL;
+    sec->ctx.rungs = NULL;
+    sec->ctx.segs = NULL;
+    sec->ctx.seg_at = NULL;
+    sec->ctx.segs_len = 0;
+    sec->ctx.seg_watch = NULL;
+    sec->ctx.seg_watches = 0;
+    sec->ctx.generation = NULL;
+    sec->ctx.instructions = 0;
+
+    return PARALLEL_OK;
+}
+
+// longest sections first, each one to the least loaded lane
+static uint8_t parallel_lanes(parallel_t *par, uint32_t threads) {
+    uint32_t *order, n, k, best, tmp;
+
+    par->lanes = threads + 1 < par->sections ? threads + 1 : par->sections;
+    par->lane = calloc(par->lanes, sizeof(parallel_lane_t));
+    order = malloc(par->sections * sizeof(uint32_t));
+    if (par->lane == NULL || order == NULL)
+        goto error;
+    for (n = 0; n < par->lanes; n++) {
+        par->lane[n].par = par;
+        if ((par->lane[n].section = malloc(par->sections * sizeof(uint32_t))) == NULL)
+            goto error;
+    }
+
+    for (n = 0; n < par->sections; n++)
+        order[n] = n;
+    for (n = 1; n < par->sections; n++)
+        for (k = n; k > 0 && par->section[order[k]].len > par->section[order[k - 1]].len; k--) {
+            tmp = order[k];
+            order[k] = order[k - 1];
+            order[k - 1] = tmp;
+        }
+
+    for (n = 0; n < par->sections; n++) {
+        for (best = 0, k = 1; k < par->lanes; k++)
+            if (par->lane[k].len < par->lane[best].len)
+                best = k;
+        par->lane[best].section[par->lane[best].sections++] = order[n];
+        par->lane[best].len += par->section[order[n]].len;
+    }
+
+    free(order);
+    return PARALLEL_OK;
+
+    error:
+    free(order);
+    return PARALLEL_ERR_MEMORY;
+}
+
+uint8_t parallel_init(parallel_t *par, vm_t *vm, uint32_t threads) {
+    uint32_t *block_at, *parent = NULL, *map, blocks, n, pc;
+    uint8_t status = PARALLEL_ERR_MEMORY;
+
+    memset(par, 0, sizeof(parallel_t));
+    if (vm == NULL || vm->code == NULL || vm->code_len == 0 || threads > PARALLEL_MAX_THREADS)
+        return PARALLEL_ERR_PARAM;
+    par->vm = vm;
+    par->timers = PARALLEL_NONE;
+
+    block_at = malloc((vm->code_len + 1) * sizeof(uint32_t));
+    map = malloc((vm->code_len + 1) * sizeof(uint32_t));
+    if (block_at == NULL || map == NULL || (blocks = parallel_blocks(vm, block_at, &parent)) == 0)
+        goto end;
+
+    for (n = 0; n < blocks; n++)
+        par->sections += parallel_root(parent, n) == n;
+    if ((par->section = calloc(par->sections, sizeof(parallel_section_t))) == NULL)
+        goto end;
+
+    for (n = 0, pc = 0; n < blocks; n++) {
+        if (parallel_root(parent, n) != n)
+            continue;
+        if ((status = parallel_section(par, &par->section[pc], block_at, parent, n, map)) != PARALLEL_OK)
+            goto end;
+        if (n == parallel_root(parent, blocks - 1))
+            par->last = pc;
+        ++pc;
+    }
+
+    for (n = 0; n < par->sections; n++)
+        for (pc = 0; pc < par->section[n].len; pc++)
+            if (par->section[n].code[pc].kind == K_TIMER_EN && par->section[n].code[pc].il != IL_LD
+                    && (par->section[n].code[pc].il < IL_AND || par->section[n].code[pc].il > IL_LT))
+                par->timers = n;
+
+    status = parallel_lanes(par, threads);
+
+    end:
+    free(block_at);
+    free(parent);
+    free(map);
+    if (status != PARALLEL_OK)
+        parallel_free(par);
+    return status;
+}
+
+void parallel_free(parallel_t *par) {
+    uint32_t n;
+
+    parallel_stop(par);
+    for (n = 0; par->section != NULL && n < par->sections; n++)
+        free(par->section[n].code);
+    for (n = 0; par->lane != NULL && n < par->lanes; n++)
+        free(par->lane[n].section);
+    free(par->section);
+    free(par->lane);
+    memset(par, 0, sizeof(parallel_t));
+}
+
+////////////////////// SCAN //////////////////////
+
+static void parallel_lane_run(parallel_lane_t *lane) {
+    const vm_t *vm = lane->par->vm;
+    parallel_section_t *sec;
+    uint32_t n;
+
+    for (n = 0; n < lane->sections; n++) {
+        sec = &lane->par->section[lane->section[n]];
+        sec->ctx.time = vm->time;
+        sec->ctx.acc = vm->acc;
+        sec->ctx.wheel.queued = vm->wheel.queued;
+        sec->ctx.instructions = 0;
+        sec->status = vm_run_interp(&sec->ctx);
+    }
+}
+
+// next epoch after seen: spin, then sleep on the futex
+static uint32_t parallel_wait(parallel_t *par, uint32_t seen) {
+    uint32_t e, n;
+
+    for (n = 0; n < PARALLEL_SPIN; n++) {
+        if ((e = __atomic_load_n(&par->epoch, __ATOMIC_ACQUIRE)) != seen)
+            return e;
+        parallel_pause();
+    }
+
+    __atomic_add_fetch(&par->sleepers, 1, __ATOMIC_SEQ_CST);
+    while ((e = __atomic_load_n(&par->epoch, __ATOMIC_SEQ_CST)) == seen)
+        parallel_futex(&par->epoch, FUTEX_WAIT_PRIVATE, seen);
+    __atomic_sub_fetch(&par->sleepers, 1, __ATOMIC_SEQ_CST);
+
+    return e;
+}
+
+static void* parallel_worker(void *arg) {
+    parallel_lane_t *lane = arg;
+    parallel_t *par = lane->par;
+
+    for (;;) {
+        lane->epoch = parallel_wait(par, lane->epoch);
+        if (!__atomic_load_n(&par->run, __ATOMIC_ACQUIRE))
+            break;
+        parallel_lane_run(lane);
+        __atomic_sub_fetch(&par->pending, 1, __ATOMIC_ACQ_REL);
+    }
+
+    return NULL;
+}
+
+// vm->native: the timers and edges are already updated by vm_execute()
+static uint8_t parallel_scan(vm_t *vm) {
+    parallel_t *par = vm->native_ctx;
+    uint8_t status = VM_OK;
+    uint32_t n;
+
+    __atomic_store_n(&par->pending, par->lanes - 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&par->epoch, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&par->sleepers, __ATOMIC_SEQ_CST) != 0)
+        parallel_futex(&par->epoch, FUTEX_WAKE_PRIVATE, INT_MAX);
+
+    parallel_lane_run(&par->lane[0]);
+
+    // barrier: every section done before the outputs are read
+    for (n = 0; __atomic_load_n(&par->pending, __ATOMIC_ACQUIRE) != 0; n++)
+        if (n < PARALLEL_SPIN)
+            parallel_pause();
+        else
+            sched_yield();
+
+    // one halt per scan, as serial
+    for (n = 0; n < par->sections; n++) {
+        vm->instructions += par->section[n].ctx.instructions - (n != par->last && par->section[n].status == VM_OK);
+        if (status == VM_OK)
+            status = par->section[n].status;
+    }
+    if (par->timers != PARALLEL_NONE)
+        vm->wheel.queued = par->section[par->timers].ctx.wheel.queued;
+    vm->acc = par->section[par->last].ctx.acc;
+
+    return status;
+}
+
+uint8_t parallel_start(parallel_t *par, const int *cpus, int priority) {
+    struct sched_param param;
+    pthread_attr_t attr;
+    cpu_set_t set;
+    parallel_lane_t *lane;
+    uint32_t n;
+    int err;
+
+    if (par->vm == NULL || par->run)
+        return PARALLEL_ERR_PARAM;
+
+    par->run = true;
+    par->threads = 0;
+    for (n = 1; n < par->lanes; n++) {
+        lane = &par->lane[n];
+        lane->epoch = par->epoch;
+        pthread_attr_init(&attr);
+        if (cpus != NULL) {
+            CPU_ZERO(&set);
+            CPU_SET(cpus[n - 1], &set);
+            lane->pinned = pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0;
+        }
+        if (priority > 0) {
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            param.sched_priority = priority;
+            pthread_attr_setschedparam(&attr, &param);
+        }
+        err = pthread_create(&lane->thread, &attr, parallel_worker, lane);
+        pthread_attr_destroy(&attr);
+        lane->rt = err == 0 && priority > 0;
+        // not permitted: default policy, no affinity
+        if (err != 0) {
+            lane->pinned = false;
+            if (pthread_create(&lane->thread, NULL, parallel_worker, lane) != 0) {
+                parallel_stop(par);
+                return PARALLEL_ERR_THREAD;
+            }
+        }
+        ++par->threads;
+    }
+
+    par->vm->native_ctx = par;
+    vm_select(par->vm, VM_ENGINE_PARALLEL, parallel_scan);
+
+    return PARALLEL_OK;
+}
+
+void parallel_stop(parallel_t *par) {
+    uint32_t n;
+
+    if (!par->run)
+        return;
+
+    __atomic_store_n(&par->run, false, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&par->epoch, 1, __ATOMIC_SEQ_CST);
+    parallel_futex(&par->epoch, FUTEX_WAKE_PRIVATE, INT_MAX);
+    for (n = 0; n < par->threads; n++)
+        pthread_join(par->lane[n + 1].thread, NULL);
+    par->threads = 0;
+
+    if (par->vm->native_ctx == par) {
+        vm_select(par->vm, VM_ENGINE_INTERP, NULL);
+        par->vm->native_ctx = NULL;
+    }
+}
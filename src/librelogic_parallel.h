@@ -0,0 +1,96 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_PARALLEL_H_
+#define LIBRELOGIC_PARALLEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "librelogic_newvm.h"
+
+// PARALLEL SECTIONS
+// parallel_init() splits a loaded program in sections that share no written
+// location and parallel_start() runs them concurrently within each vm_execute().
+// the program is cut in blocks at LD outside parenthesis; a section joins the
+// blocks connected by a jump (with every block the jump skips), a CAL and its
+// subroutine, everything after a RET (it can end the scan) and the blocks that
+// write a word another one reads or writes. T coils share the timers queue: they
+// are all in one section. blocks keep program order inside their section, so
+// every location sees the same reads and writes as in a serial scan.
+// sections are packed by length in threads + 1 lanes: lane 0 runs on the thread
+// calling vm_execute(), the others on worker threads pinned to the given cpus
+// that spin PARALLEL_SPIN times, then sleep until the next scan. vm_execute()
+// returns after every lane finished (outputs complete). a runtime error stops
+// its section only: the other ones finish the scan, the status is the one of the
+// first failing section. call again after vm_load() or vm_fuse().
+
+#define PARALLEL_MAX_THREADS 64
+#define PARALLEL_SPIN        20000
+
+typedef enum PARALLEL_STATUS {
+    PARALLEL_OK,         //
+    PARALLEL_ERR_PARAM,  // no program, too many threads or running
+    PARALLEL_ERR_MEMORY, // can't allocate sections
+    PARALLEL_ERR_THREAD, // can't create worker thread
+} parallel_status_t;
+
+typedef struct parallel_section {
+        vm_t ctx;     // shared areas, own program, accumulator and stacks
+     vm_op_t *code;   // blocks of the section, then halt
+    uint32_t first;   // address of the first block in the program
+    uint32_t len;     // ops
+     uint8_t status;  // last scan
+} parallel_section_t;
+
+typedef struct parallel_lane {
+    struct parallel *par;      //
+           uint32_t *section;  // sections run by the lane
+           uint32_t sections;  //
+           uint64_t len;       // ops
+           uint32_t epoch;     // last scan run
+          pthread_t thread;    // lanes > 0
+               bool pinned;    // affinity set
+               bool rt;        // running SCHED_FIFO
+} parallel_lane_t;
+
+typedef struct parallel {
+                  vm_t *vm;         //
+    parallel_section_t *section;    // in program order
+              uint32_t sections;    //
+       parallel_lane_t *lane;       //
+              uint32_t lanes;       //
+              uint32_t timers;      // section with T coils (sections: none)
+              uint32_t last;        // section ending the program, its accumulator is the result
+              uint32_t threads;     // started workers
+              uint32_t epoch;       // scans released (futex)
+              uint32_t pending;     // lanes running the scan
+              uint32_t sleepers;    // workers waiting on epoch
+                  bool run;         // cleared by parallel_stop()
+} parallel_t;
+
+uint8_t parallel_init(parallel_t *par, vm_t *vm, uint32_t threads);
+   void parallel_free(parallel_t *par);
+// cpus: one per worker (threads), may be NULL. priority > 0: SCHED_FIFO workers
+uint8_t parallel_start(parallel_t *par, const int *cpus, int priority);
+   void parallel_stop(parallel_t *par);
+
+#endif /* LIBRELOGIC_PARALLEL_H_ */
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_procimg.h"
+
+#define PROCIMG_ALIGN(x) (((x) + 63) & ~((size_t) 63))
+
+// producer: snapshot in back buffer becomes the newest one
+static void procimg_publish(procimg_tb_t *tb) {
+    tb->buf[tb->back].seq = ++tb->seq;
+    tb->back = __atomic_exchange_n(&tb->middle, tb->back | PROCIMG_FRESH, __ATOMIC_ACQ_REL) & 3;
+}
+
+// consumer: take the newest snapshot if there is one
+static bool procimg_consume(procimg_tb_t *tb) {
+    if (!(__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & PROCIMG_FRESH))
+        return false;
+
+    tb->front = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL) & 3;
+
+    return true;
+}
+
+// buffers of tb from mem (NULL: size only), returns their length
+static size_t procimg_tb_layout(procimg_tb_t *tb, uint8_t *mem, uint32_t words, uint32_t reals) {
+    size_t len = 0;
+    uint32_t n;
+
+    tb->words = words;
+    tb->reals = reals;
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+    for (n = 0; n < 3; n++) {
+        if (mem != NULL) {
+            tb->buf[n].w = (uint64_t*) (mem + len);
+            tb->buf[n].r = (double*) (mem + len + PROCIMG_ALIGN(words * sizeof(uint64_t)));
+        }
+        len += PROCIMG_ALIGN(words * sizeof(uint64_t)) + PROCIMG_ALIGN(reals * sizeof(double));
+    }
+
+    return len;
+}
+
+uint8_t procimg_init(procimg_t *img, const vm_t *vm) {
+    size_t len;
+
+    memset(img, 0, sizeof(procimg_t));
+
+    // sizes first, then the buffers
+    len = procimg_tb_layout(&img->in, NULL, vm->size[VM_I], vm->size[VM_I_REAL]);
+    len += procimg_tb_layout(&img->out, NULL, vm->size[VM_Q], vm->size[VM_Q_REAL]);
+    img->mem = aligned_alloc(64, len ? len : 64);
+    if (img->mem == NULL)
+        return PROCIMG_ERR_MEMORY;
+    memset(img->mem, 0, len);
+
+    len = procimg_tb_layout(&img->in, img->mem, vm->size[VM_I], vm->size[VM_I_REAL]);
+    procimg_tb_layout(&img->out, (uint8_t*) img->mem + len, vm->size[VM_Q], vm->size[VM_Q_REAL]);
+
+    return PROCIMG_OK;
+}
+
+void procimg_free(procimg_t *img) {
+    free(img->mem);
+    memset(img, 0, sizeof(procimg_t));
+}
+
+procimg_snapshot_t* procimg_input_back(procimg_t *img) {
+    return &img->in.buf[img->in.back];
+}
+
+void procimg_input_publish(procimg_t *img) {
+    procimg_publish(&img->in);
+}
+
+const procimg_snapshot_t* procimg_output(procimg_t *img, bool *fresh) {
+    bool f = procimg_consume(&img->out);
+
+    if (fresh != NULL)
+        *fresh = f;
+
+    return &img->out.buf[img->out.front];
+}
+
+// no new snapshot: the vm keeps the last inputs
+void procimg_inputs(vm_t *vm, void *ctx) {
+    procimg_t *img = ctx;
+    procimg_snapshot_t *s;
+
+    if (!procimg_consume(&img->in))
+        return;
+
+    s = &img->in.buf[img->in.front];
+    memcpy(vm->i, s->w, img->in.words * sizeof(uint64_t));
+    memcpy(vm->i_real, s->r, img->in.reals * sizeof(double));
+}
+
+void procimg_outputs(vm_t *vm, void *ctx) {
+    procimg_t *img = ctx;
+    procimg_snapshot_t *s = &img->out.buf[img->out.back];
+
+    memcpy(s->w, vm->q, img->out.words * sizeof(uint64_t));
+    memcpy(s->r, vm->q_real, img->out.reals * sizeof(double));
+    procimg_publish(&img->out);
+}
@@ -0,0 +1,79 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_PROCIMG_H_
+#define LIBRELOGIC_PROCIMG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "librelogic_newvm.h"
+
+// PROCESS IMAGE
+// inputs (i, if) and outputs (q, qf) cross between I/O driver threads and the scan
+// through lock-free triple buffers: the producer fills its back buffer and swaps
+// it with the middle one, the consumer swaps the middle one with its front buffer
+// when it holds a newer snapshot. nobody waits and nobody sees a half written
+// image. one producer and one consumer per direction: the input driver publishes
+// to the scan, the scan publishes to the output driver.
+// procimg_inputs()/procimg_outputs() have the sched_task_t callbacks signature,
+// ctx is the procimg_t.
+
+#define PROCIMG_FRESH 0x4 // middle buffer holds a snapshot not consumed yet
+
+typedef enum PROCIMG_STATUS {
+    PROCIMG_OK,         //
+    PROCIMG_ERR_MEMORY, // can't allocate buffers
+} procimg_status_t;
+
+typedef struct procimg_snapshot {
+    uint64_t *w;   // i / q
+      double *r;   // if / qf
+    uint64_t seq;  // publication number, 0: never published
+} procimg_snapshot_t;
+
+typedef struct procimg_tb {
+    procimg_snapshot_t buf[3];  //
+               uint8_t middle;  // buffer index | PROCIMG_FRESH, atomic
+               uint8_t back;    // producer buffer
+               uint8_t front;   // consumer buffer
+              uint64_t seq;     // snapshots published
+              uint32_t words;   //
+              uint32_t reals;   //
+} procimg_tb_t;
+
+typedef struct procimg {
+    procimg_tb_t in;   // driver -> scan: i, if
+    procimg_tb_t out;  // scan -> driver: q, qf
+            void *mem; //
+} procimg_t;
+
+                 uint8_t procimg_init(procimg_t *img, const vm_t *vm);
+                    void procimg_free(procimg_t *img);
+// input driver: fill the whole back buffer (it holds an old snapshot), then publish
+      procimg_snapshot_t* procimg_input_back(procimg_t *img);
+                    void procimg_input_publish(procimg_t *img);
+// output driver: newest outputs, valid until next call. fresh: not seen before
+const procimg_snapshot_t* procimg_output(procimg_t *img, bool *fresh);
+// scan: newest inputs to the vm before vm_execute(), outputs after
+                    void procimg_inputs(vm_t *vm, void *img);
+                    void procimg_outputs(vm_t *vm, void *img);
+
+#endif /* LIBRELOGIC_PROCIMG_H_ */
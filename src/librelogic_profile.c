@@ -0,0 +1,144 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+#include "librelogic_profile.h"
+
+#define PROFILE_TOP 10
+
+uint8_t profile_init(vm_profile_t *prof, uint32_t code_len) {
+    memset(prof, 0, sizeof(vm_profile_t));
+
+    prof->pc = calloc(code_len + 1, sizeof(uint64_t));
+    prof->cycles = calloc(code_len + 1, sizeof(uint64_t));
+    if (prof->pc == NULL || prof->cycles == NULL) {
+        profile_free(prof);
+        return PROFILE_ERR_MEMORY;
+    }
+    prof->len = code_len;
+
+    return PROFILE_OK;
+}
+
+void profile_reset(vm_profile_t *prof) {
+    memset(prof->op, 0, sizeof(prof->op));
+    memset(prof->pc, 0, (prof->len + 1) * sizeof(uint64_t));
+    memset(prof->cycles, 0, (prof->len + 1) * sizeof(uint64_t));
+}
+
+void profile_free(vm_profile_t *prof) {
+    free(prof->pc);
+    free(prof->cycles);
+    memset(prof, 0, sizeof(vm_profile_t));
+}
+
+static uint32_t profile_line(const il_program_t *prg, uint32_t pc) {
+    return prg->lines != NULL ? prg->lines[pc] : pc + 1;
+}
+
+// label range holding pc: labels are in address order
+static const char* profile_label(const il_program_t *prg, uint32_t pc) {
+    uint32_t lo = 0, hi = prg->labels_qty, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (prg->labels[mid].line - 1 <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo ? prg->labels[lo - 1].label : "(start)";
+}
+
+void profile_report(FILE *f, const vm_profile_t *prof, const il_program_t *prg) {
+    uint32_t top[PROFILE_TOP], tops = 0, n, k, pc, end;
+    uint64_t total = 0, count, cycles;
+    char buf[64];
+
+    for (pc = 0; pc < prof->len; pc++)
+        total += prof->cycles[pc];
+    if (total == 0)
+        total = 1;
+
+    fprintf(f, "scans: %lu\n\nopcode      dispatches\n", (long unsigned int) prof->pc[prof->len]);
+    for (n = 0; n < 32; n++)
+        if (prof->op[n])
+            fprintf(f, "%-8s %13lu\n", il_commands_str[n], (long unsigned int) prof->op[n]);
+
+    fprintf(f, "\nlabel                addresses     lines          dispatches         cycles      %%\n");
+    for (n = 0; n <= prg->labels_qty; n++) {
+        pc = n ? prg->labels[n - 1].line - 1 : 0;
+        end = n < prg->labels_qty ? prg->labels[n].line - 1 : prof->len;
+        if (pc >= end)
+            continue;
+        for (count = 0, cycles = 0, k = pc; k < end; k++) {
+            count += prof->pc[k];
+            cycles += prof->cycles[k];
+        }
+        fprintf(f, "%-20s %5lu-%-5lu  %5lu-%-5lu  %13lu  %13lu  %5.1f\n", n ? prg->labels[n - 1].label : "(start)",
+                (long unsigned int) pc, (long unsigned int) end - 1, (long unsigned int) profile_line(prg, pc),
+                (long unsigned int) profile_line(prg, end - 1), (long unsigned int) count,
+                (long unsigned int) cycles, 100.0 * cycles / total);
+    }
+
+    // hottest addresses by cycles, insertion into a small sorted list
+    for (pc = 0; pc < prof->len; pc++) {
+        if (prof->pc[pc] == 0)
+            continue;
+        for (k = tops; k > 0 && prof->cycles[top[k - 1]] < prof->cycles[pc]; k--)
+            if (k < PROFILE_TOP)
+                top[k] = top[k - 1];
+        if (k < PROFILE_TOP) {
+            top[k] = pc;
+            if (tops < PROFILE_TOP)
+                ++tops;
+        }
+    }
+
+    fprintf(f, "\naddress  line  instruction              dispatches         cycles      %%  label\n");
+    for (n = 0; n < tops; n++) {
+        pc = top[n];
+        dump_instr(prg->code[pc], buf);
+        fprintf(f, "%7lu %5lu  %-20s  %13lu  %13lu  %5.1f  %s\n", (long unsigned int) pc,
+                (long unsigned int) profile_line(prg, pc), buf, (long unsigned int) prof->pc[pc],
+                (long unsigned int) prof->cycles[pc], 100.0 * prof->cycles[pc] / total, profile_label(prg, pc));
+    }
+}
+
+// folded stacks for flamegraph.pl: name;label;line instruction cycles
+void profile_folded(FILE *f, const vm_profile_t *prof, const il_program_t *prg, const char *name) {
+    uint32_t pc;
+    char buf[64];
+
+    for (pc = 0; pc < prof->len; pc++) {
+        if (prof->cycles[pc] == 0)
+            continue;
+        dump_instr(prg->code[pc], buf);
+        fprintf(f, "%s;%s;%lu %s %lu\n", name, profile_label(prg, pc), (long unsigned int) profile_line(prg, pc),
+                buf, (long unsigned int) prof->cycles[pc]);
+    }
+}
@@ -0,0 +1,46 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_PROFILE_H_
+#define LIBRELOGIC_PROFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+
+// PROFILE REPORTS
+// allocate a vm_profile_t for a loaded program, attach it as vm->profile and run
+// scans on a vm_execute() built with -DVM_PROFILE. reports map addresses back to
+// source lines and to the label ranges (rungs) of the assembled program.
+
+typedef enum PROFILE_STATUS {
+    PROFILE_OK,         //
+    PROFILE_ERR_MEMORY, //
+} profile_status_t;
+
+uint8_t profile_init(vm_profile_t *prof, uint32_t code_len);
+   void profile_reset(vm_profile_t *prof);
+   void profile_free(vm_profile_t *prof);
+   void profile_report(FILE *f, const vm_profile_t *prof, const il_program_t *prg);
+   void profile_folded(FILE *f, const vm_profile_t *prof, const il_program_t *prg, const char *name);
+
+#endif /* LIBRELOGIC_PROFILE_H_ */
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_record.h"
+
+#define RECORD_VARINT 10 // max varint bytes
+
+static inline uint8_t* record_varint(uint8_t *p, uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+        *p++ = (v & 0x7f) | 0x80;
+    *p++ = v;
+
+    return p;
+}
+
+// i words, then the bits of the if words
+static inline uint64_t record_word(const vm_t *vm, uint32_t n) {
+    uint64_t w;
+
+    if (n < vm->size[VM_I])
+        return vm->i[n];
+    memcpy(&w, &vm->i_real[n - vm->size[VM_I]], sizeof(w));
+
+    return w;
+}
+
+static inline void record_le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline uint32_t replay_le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// len bytes at ring position pos
+static inline void record_put(record_t *rec, uint64_t pos, const uint8_t *src, size_t len) {
+    size_t off = pos & (rec->ring_len - 1), first = rec->ring_len - off < len ? rec->ring_len - off : len;
+
+    memcpy(rec->ring + off, src, first);
+    memcpy(rec->ring, src + first, len - first);
+}
+
+uint32_t record_checksum(const vm_t *vm, uint8_t status) {
+    uint64_t h = 0xcbf29ce484222325ull ^ status, w;
+    uint32_t n;
+
+    for (n = 0; n < vm->size[VM_Q]; n++)
+        h = (h ^ vm->q[n]) * 0x100000001b3ull;
+    for (n = 0; n < vm->size[VM_Q_REAL]; n++) {
+        memcpy(&w, &vm->q_real[n], sizeof(w));
+        h = (h ^ w) * 0x100000001b3ull;
+    }
+
+    return h ^ (h >> 32);
+}
+
+// drains the ring until record_close() and the ring is empty
+static void* record_writer(void *arg) {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = RECORD_POLL };
+    record_t *rec = arg;
+    uint64_t head, tail = rec->tail;
+    size_t off, len;
+    bool run;
+
+    for (;;) {
+        // run first: once cleared, head is final
+        run = __atomic_load_n(&rec->run, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (!run)
+                break;
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        off = tail & (rec->ring_len - 1);
+        len = head - tail < rec->ring_len - off ? head - tail : rec->ring_len - off;
+        if (rec->status == RECORD_OK && fwrite(rec->ring + off, 1, len, rec->f) != len)
+            rec->status = RECORD_ERR_FILE;
+        tail += len;
+        __atomic_store_n(&rec->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+uint8_t record_open(record_t *rec, const char *path, const vm_t *vm, size_t ring_len) {
+    uint8_t h[sizeof(record_header_t)];
+
+    memset(rec, 0, sizeof(record_t));
+    if (ring_len == 0)
+        ring_len = RECORD_RING;
+    if (ring_len & (ring_len - 1))
+        return RECORD_ERR_MEMORY;
+    rec->vm = vm;
+    rec->ring_len = ring_len;
+    rec->words = vm->size[VM_I] + vm->size[VM_I_REAL];
+
+    rec->ring = malloc(ring_len);
+    rec->rec = malloc(rec->words * 2 * RECORD_VARINT + 1);
+    rec->prev = calloc(rec->words + 1, sizeof(uint64_t));
+    if (rec->ring == NULL || rec->rec == NULL || rec->prev == NULL) {
+        record_close(rec);
+        return RECORD_ERR_MEMORY;
+    }
+
+    record_le32(h + offsetof(record_header_t, magic), RECORD_MAGIC);
+    record_le32(h + offsetof(record_header_t, version), RECORD_VERSION);
+    record_le32(h + offsetof(record_header_t, inputs), vm->size[VM_I]);
+    record_le32(h + offsetof(record_header_t, reals), vm->size[VM_I_REAL]);
+    rec->f = fopen(path, "wb");
+    if (rec->f == NULL || fwrite(h, sizeof(h), 1, rec->f) != 1) {
+        record_close(rec);
+        return RECORD_ERR_FILE;
+    }
+
+    rec->run = true;
+    if (pthread_create(&rec->thread, NULL, record_writer, rec) != 0) {
+        rec->run = false;
+        record_close(rec);
+        return RECORD_ERR_THREAD;
+    }
+
+    return RECORD_OK;
+}
+
+void record_scan(record_t *rec, uint8_t status) {
+    const vm_t *vm = rec->vm;
+    uint8_t prefix[3 * RECORD_VARINT], sum[4], *p = rec->rec, *q;
+    uint32_t n, last = 0, changed = 0, s = record_checksum(vm, status);
+    uint64_t x, dt, head = rec->head;
+    bool back = vm->time < rec->time;
+    size_t body, len;
+
+    // not representable: the scan is lost like on a full ring
+    dt = back ? rec->time - vm->time : vm->time - rec->time;
+    if (dt >> 62) {
+        ++rec->dropped;
+        ++rec->lost;
+        return;
+    }
+
+    for (n = 0; n < rec->words; n++)
+        if ((x = record_word(vm, n) ^ rec->prev[n]) != 0) {
+            p = record_varint(p, n - last);
+            p = record_varint(p, x);
+            last = n;
+            ++changed;
+        }
+    body = p - rec->rec;
+
+    q = record_varint(prefix, dt << 2 | back << 1 | (rec->lost != 0));
+    if (rec->lost != 0)
+        q = record_varint(q, rec->lost);
+    q = record_varint(q, changed);
+    record_le32(sum, s);
+    len = (q - prefix) + body + sizeof(sum);
+
+    // ring full: dropped, the reader keeps the previous image
+    if (len > rec->ring_len - (head - __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE))) {
+        ++rec->dropped;
+        ++rec->lost;
+        return;
+    }
+    record_put(rec, head, prefix, q - prefix);
+    record_put(rec, head + (q - prefix), rec->rec, body);
+    record_put(rec, head + (q - prefix) + body, sum, sizeof(sum));
+    __atomic_store_n(&rec->head, head + len, __ATOMIC_RELEASE);
+
+    memcpy(rec->prev, vm->i, vm->size[VM_I] * sizeof(uint64_t));
+    memcpy(rec->prev + vm->size[VM_I], vm->i_real, vm->size[VM_I_REAL] * sizeof(double));
+    rec->time = vm->time;
+    rec->lost = 0;
+    rec->backwards += back;
+    ++rec->scans;
+    rec->bytes += len;
+}
+
+uint8_t record_close(record_t *rec) {
+    uint8_t status;
+
+    if (rec->run) {
+        __atomic_store_n(&rec->run, false, __ATOMIC_RELEASE);
+        pthread_join(rec->thread, NULL);
+    }
+    status = rec->status;
+    if (rec->f != NULL && fclose(rec->f) != 0 && status == RECORD_OK)
+        status = RECORD_ERR_FILE;
+    free(rec->ring);
+    free(rec->rec);
+    free(rec->prev);
+    memset(rec, 0, sizeof(record_t));
+
+    return status;
+}
+
+////////////////////// REPLAY //////////////////////
+
+static bool replay_varint(FILE *f, uint64_t *v) {
+    uint32_t shift = 0;
+    int c;
+
+    *v = 0;
+    do {
+        if ((c = getc_unlocked(f)) == EOF || shift > 63)
+            return false;
+        *v |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return true;
+}
+
+uint8_t replay_open(replay_t *rp, const char *path, vm_t *vm) {
+    uint8_t h[sizeof(record_header_t)];
+
+    memset(rp, 0, sizeof(replay_t));
+    rp->f = fopen(path, "rb");
+    if (rp->f == NULL)
+        return RECORD_ERR_FILE;
+    if (fread(h, sizeof(h), 1, rp->f) != 1 || replay_le32(h + offsetof(record_header_t, magic)) != RECORD_MAGIC
+            || replay_le32(h + offsetof(record_header_t, version)) != RECORD_VERSION
+            || replay_le32(h + offsetof(record_header_t, inputs)) != vm->size[VM_I]
+            || replay_le32(h + offsetof(record_header_t, reals)) != vm->size[VM_I_REAL]) {
+        replay_close(rp);
+        return RECORD_ERR_FORMAT;
+    }
+    rp->inputs = vm->size[VM_I];
+    rp->reals = vm->size[VM_I_REAL];
+
+    // the recorder starts from a cleared image
+    memset(vm->i, 0, vm->size[VM_I] * sizeof(uint64_t));
+    memset(vm->i_real, 0, vm->size[VM_I_REAL] * sizeof(double));
+
+    return RECORD_OK;
+}
+
+uint8_t replay_next(replay_t *rp, vm_t *vm) {
+    uint64_t head, dropped = 0, changed, gap, x, w, idx = 0;
+    uint8_t sum[4];
+    int c;
+
+    if ((c = getc_unlocked(rp->f)) == EOF)
+        return RECORD_END;
+    ungetc(c, rp->f);
+
+    if (!replay_varint(rp->f, &head) || ((head & 1) && !replay_varint(rp->f, &dropped))
+            || !replay_varint(rp->f, &changed))
+        return RECORD_ERR_FORMAT;
+    for (; changed > 0; changed--) {
+        if (!replay_varint(rp->f, &gap) || !replay_varint(rp->f, &x) || (idx += gap) >= rp->inputs + rp->reals)
+            return RECORD_ERR_FORMAT;
+        if (idx < rp->inputs) {
+            vm->i[idx] ^= x;
+        } else {
+            memcpy(&w, &vm->i_real[idx - rp->inputs], sizeof(w));
+            w ^= x;
+            memcpy(&vm->i_real[idx - rp->inputs], &w, sizeof(w));
+        }
+    }
+    if (fread(sum, sizeof(sum), 1, rp->f) != 1)
+        return RECORD_ERR_FORMAT;
+
+    rp->sum = replay_le32(sum);
+    rp->time = head & 2 ? rp->time - (head >> 2) : rp->time + (head >> 2);
+    rp->gaps += dropped;
+    if (dropped != 0 && rp->gap_at == 0)
+        rp->gap_at = rp->scans + 1;
+    vm->time = rp->time;
+
+    return RECORD_OK;
+}
+
+bool replay_check(replay_t *rp, const vm_t *vm, uint8_t status) {
+    ++rp->scans;
+    // scans missing before: a difference proves nothing
+    if (rp->gap_at != 0) {
+        ++rp->unchecked;
+        return true;
+    }
+    if (record_checksum(vm, status) == rp->sum)
+        return true;
+
+    ++rp->diverged;
+    if (rp->first == 0)
+        rp->first = rp->scans;
+    return false;
+}
+
+uint8_t replay_run(replay_t *rp, vm_t *vm) {
+    uint8_t status;
+
+    while ((status = replay_next(rp, vm)) == RECORD_OK)
+        replay_check(rp, vm, vm_execute(vm));
+
+    return status == RECORD_END ? RECORD_OK : status;
+}
+
+void replay_close(replay_t *rp) {
+    if (rp->f != NULL)
+        fclose(rp->f);
+    memset(rp, 0, sizeof(replay_t));
+}
@@ -0,0 +1,134 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_RECORD_H_
+#define LIBRELOGIC_RECORD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "librelogic_newvm.h"
+
+// SCAN RECORD / REPLAY
+// record_scan(), called after each vm_execute(), appends the scan inputs (i and
+// if areas), vm->time and a checksum of the outputs (q, qf and the scan status) to
+// a trace file. inputs are delta encoded against the previous record: only the
+// words that changed are stored, as index gap and xor, both varints. a scan with
+// no input change and a period under 32 ms takes 6 bytes.
+// the scan thread encodes into a ring buffer, a writer thread drains it to the
+// file: when the ring is full the record is dropped and the next one carries the
+// number of scans dropped before it, recording never waits.
+// replay_run() feeds the records to vm_execute() as fast as possible and counts
+// the scans whose output checksum differs. the scans dropped never run on replay,
+// so from the first gap on the state can't match: checksums are no longer compared
+// and the scans are counted as unchecked. replay starts from a fresh vm with the
+// same program: outside writes other than the inputs and vm->time (memory,
+// commands, vm_blinker_set()) are not recorded.
+//
+// file: [header: magic, version, inputs, reals as little endian uint32] then per scan:
+//   varint  |dt| << 2 | back << 1 | gap
+//                          dt: vm->time - previous record time, back: dt < 0,
+//                          gap: scans dropped before. |dt| >= 2^62: dropped
+//   varint  dropped        if gap
+//   varint  n              changed words, i words then if words (their bits)
+//   n x     varint gap, varint xor
+//   uint32  checksum       little endian, fnv-1a folded to 32 bits
+
+#define RECORD_MAGIC   0x4352544c // "LTRC"
+#define RECORD_VERSION 3
+#define RECORD_RING    (1 << 20)  // bytes, default ring buffer
+#define RECORD_POLL    1000000    // ns, writer sleep when the ring is empty
+
+typedef enum RECORD_STATUS {
+    RECORD_OK,         //
+    RECORD_END,        // no more scans
+    RECORD_ERR_FILE,   // can't open, write or read the file
+    RECORD_ERR_FORMAT, // not a trace, truncated or other area sizes
+    RECORD_ERR_MEMORY, // can't allocate buffers
+    RECORD_ERR_THREAD, // can't create writer thread
+} record_status_t;
+
+typedef struct record_header {
+    uint32_t magic;    //
+    uint32_t version;  //
+    uint32_t inputs;   // size[VM_I]
+    uint32_t reals;    // size[VM_I_REAL]
+} record_header_t;
+
+typedef struct record {
+     const vm_t *vm;        //
+           FILE *f;         //
+        uint8_t *ring;      //
+         size_t ring_len;   // power of two
+       uint64_t head;       // written by the scan thread
+       uint64_t tail;       // written by the writer
+        uint8_t *rec;       // record being encoded
+       uint64_t *prev;      // image of the last record
+       uint32_t words;      // inputs + reals
+       uint64_t time;       // of the last record
+       uint64_t lost;       // scans dropped since the last record
+    // statistics
+       uint64_t scans;      // recorded
+       uint64_t dropped;    // ring full or time step too large
+       uint64_t backwards;  // records with vm->time going back
+       uint64_t bytes;      // recorded
+        uint8_t status;     // writer
+    // writer
+      pthread_t thread;     //
+           bool run;        //
+} record_t;
+
+typedef struct replay {
+        FILE *f;            //
+    uint32_t inputs;        //
+    uint32_t reals;         //
+    uint64_t time;          // of the last record
+    uint32_t sum;           // expected checksum of the last record
+    // statistics
+    uint64_t scans;         //
+    uint64_t diverged;      // checksum differs
+    uint64_t first;         // first diverged scan + 1, 0: none
+    uint64_t gaps;          // scans dropped while recording
+    uint64_t gap_at;        // scan after the first gap, 0: none
+    uint64_t unchecked;     // scans from the first gap on
+} replay_t;
+
+// ring_len: power of two, 0: RECORD_RING
+ uint8_t record_open(record_t *rec, const char *path, const vm_t *vm, size_t ring_len);
+// scan thread, after vm_execute()
+    void record_scan(record_t *rec, uint8_t status);
+// drains the ring, returns the writer status
+ uint8_t record_close(record_t *rec);
+uint32_t record_checksum(const vm_t *vm, uint8_t status);
+
+// vm inputs cleared, area sizes must match the trace
+ uint8_t replay_open(replay_t *rp, const char *path, vm_t *vm);
+// inputs and vm->time of the next scan
+ uint8_t replay_next(replay_t *rp, vm_t *vm);
+// false: outputs differ from the recorded scan. true after a gap: not compared
+    bool replay_check(replay_t *rp, const vm_t *vm, uint8_t status);
+// every remaining scan, unpaced. RECORD_OK at end of trace
+ uint8_t replay_run(replay_t *rp, vm_t *vm);
+    void replay_close(replay_t *rp);
+
+#endif /* LIBRELOGIC_RECORD_H_ */
@@ -0,0 +1,198 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_metrics.h"
+#include "librelogic_sched.h"
+
+#define NS 1000000000ull
+
+static inline uint64_t sched_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS + ts.tv_nsec;
+}
+
+static inline void sched_sleep(uint64_t t) {
+    struct timespec ts = { .tv_sec = t / NS, .tv_nsec = t % NS };
+
+    // restarted on signals, the wakeup is absolute
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+static inline void sched_max(uint64_t *max, uint64_t v) {
+    if (v > *max)
+        __atomic_store_n(max, v, __ATOMIC_RELAXED);
+}
+
+static inline void sched_inc(uint64_t *cnt, uint64_t n) {
+    __atomic_store_n(cnt, *cnt + n, __ATOMIC_RELAXED);
+}
+
+static void* sched_task(void *arg) {
+    sched_t *s = ((void**) arg)[0];
+    sched_task_t *task = ((void**) arg)[1];
+    metrics_task_t *m = task->metrics;
+    uint64_t release = s->start, wake, end, late, t0 = 0;
+    uint8_t status;
+
+    free(arg);
+    while (__atomic_load_n(&s->run, __ATOMIC_ACQUIRE)) {
+        sched_sleep(release);
+        wake = sched_now();
+        if (!__atomic_load_n(&s->run, __ATOMIC_ACQUIRE))
+            break;
+        sched_max(&task->latency_max, wake - release);
+
+        // scan: inputs, program, outputs
+        if (m != NULL)
+            t0 = metrics_now();
+        if (task->inputs != NULL)
+            task->inputs(task->vm, task->ctx);
+        task->vm->time = (release - s->start) / 1000000;
+        status = vm_execute(task->vm);
+        if (task->outputs != NULL)
+            task->outputs(task->vm, task->ctx);
+        end = sched_now();
+
+        __atomic_store_n(&task->status, status, __ATOMIC_RELAXED);
+        if (status != VM_OK)
+            sched_inc(&task->errors, 1);
+        sched_inc(&task->scans, 1);
+        sched_max(&task->scan_max, end - wake);
+        if (end > release + task->deadline)
+            sched_inc(&task->deadline_misses, 1);
+        if (m != NULL) {
+            metrics_record(&m->scan, metrics_now() - t0);
+            metrics_record(&m->jitter, wake - release);
+            __atomic_store_n(&m->scans, task->scans, __ATOMIC_RELAXED);
+            __atomic_store_n(&m->deadline_misses, task->deadline_misses, __ATOMIC_RELAXED);
+            __atomic_store_n(&m->errors, task->errors, __ATOMIC_RELAXED);
+            __atomic_store_n(&m->instructions, task->vm->instructions, __ATOMIC_RELAXED);
+        }
+
+        // next release, skipping the ones already past
+        release += task->period;
+        if (end > release) {
+            late = (end - release) / task->period + 1;
+            sched_inc(&task->overruns, late);
+            release += late * task->period;
+            if (m != NULL)
+                __atomic_store_n(&m->overruns, task->overruns, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+void sched_init(sched_t *s) {
+    memset(s, 0, sizeof(sched_t));
+}
+
+uint8_t sched_add(sched_t *s, vm_t *vm, uint64_t period, uint64_t deadline, int priority,
+                  void (*inputs)(vm_t*, void*), void (*outputs)(vm_t*, void*), void *ctx) {
+    sched_task_t *task;
+
+    if (s->started || s->tasks == SCHED_MAX_TASKS || period == 0 || deadline > period)
+        return SCHED_ERR_PARAM;
+
+    task = &s->task[s->tasks++];
+    memset(task, 0, sizeof(sched_task_t));
+    task->vm = vm;
+    task->period = period;
+    task->deadline = deadline ? deadline : period;
+    task->priority = priority;
+    task->inputs = inputs;
+    task->outputs = outputs;
+    task->ctx = ctx;
+
+    return SCHED_OK;
+}
+
+uint8_t sched_start(sched_t *s) {
+    struct sched_param param;
+    pthread_attr_t attr;
+    uint32_t n;
+    void **arg;
+    int err;
+
+    if (s->started)
+        return SCHED_ERR_PARAM;
+
+    // common release time for every task, first scans at start
+    s->start = sched_now();
+    s->run = true;
+    s->started = true;
+    s->threads = 0;
+
+    for (n = 0; n < s->tasks; n++) {
+        arg = malloc(2 * sizeof(void*));
+        if (arg == NULL)
+            goto error;
+        arg[0] = s;
+        arg[1] = &s->task[n];
+
+        err = -1;
+        if (s->task[n].priority > 0) {
+            pthread_attr_init(&attr);
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            param.sched_priority = s->task[n].priority;
+            pthread_attr_setschedparam(&attr, &param);
+            err = pthread_create(&s->task[n].thread, &attr, sched_task, arg);
+            pthread_attr_destroy(&attr);
+            s->task[n].rt = err == 0;
+        }
+        // not permitted: default policy
+        if (err != 0 && pthread_create(&s->task[n].thread, NULL, sched_task, arg) != 0) {
+            free(arg);
+            goto error;
+        }
+        ++s->threads;
+    }
+
+    return SCHED_OK;
+
+    error:
+    sched_stop(s);
+    return SCHED_ERR_THREAD;
+}
+
+void sched_stop(sched_t *s) {
+    uint32_t n;
+
+    if (!s->started)
+        return;
+
+    __atomic_store_n(&s->run, false, __ATOMIC_RELEASE);
+    for (n = 0; n < s->threads; n++)
+        pthread_join(s->task[n].thread, NULL);
+    s->started = false;
+}
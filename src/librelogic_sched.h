@@ -0,0 +1,87 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_SCHED_H_
+#define LIBRELOGIC_SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_metrics.h"
+
+// CYCLIC SCAN SCHEDULER
+// every task runs one loaded vm periodically on its own thread: sleep to an
+// absolute CLOCK_MONOTONIC wakeup, read inputs, vm_execute(), write outputs.
+// vm->time is the task release time in ms since sched_start(). a scan that ends
+// after its deadline is a deadline miss; a wakeup later than the next release is
+// an overrun, the missed releases are skipped and counted (never run late scans
+// back to back). priority > 0 runs the thread SCHED_FIFO (needs CAP_SYS_NICE,
+// otherwise the task runs with the default policy and rt is false).
+// with task.metrics set, scan time and jitter histograms and the counters are
+// published to a metrics segment as well.
+
+#define SCHED_MAX_TASKS 16
+
+typedef enum SCHED_STATUS {
+    SCHED_OK,         //
+    SCHED_ERR_PARAM,  // bad period/deadline, too many tasks or scheduler running
+    SCHED_ERR_THREAD, // can't create task thread
+} sched_status_t;
+
+typedef struct sched_task {
+                vm_t *vm;                                 // loaded program
+            uint64_t period;                              // ns
+            uint64_t deadline;                            // ns after release, <= period
+                 int priority;                            // SCHED_FIFO priority, 0: default policy
+                void (*inputs)(vm_t *vm, void *ctx);      // before scan, may be NULL
+                void (*outputs)(vm_t *vm, void *ctx);     // after scan, may be NULL
+                void *ctx;                                //
+      metrics_task_t *metrics;                            // histograms, set before sched_start(), may be NULL
+           pthread_t thread;                              //
+                bool rt;                                  // running SCHED_FIFO
+    // statistics, updated by the task thread
+            uint64_t scans;                               //
+            uint64_t overruns;                            // releases skipped
+            uint64_t deadline_misses;                     //
+            uint64_t errors;                              // scans not VM_OK
+             uint8_t status;                              // last vm_execute() result
+            uint64_t scan_max;                            // ns
+            uint64_t latency_max;                         // wakeup - release, ns
+} sched_task_t;
+
+typedef struct sched {
+    sched_task_t task[SCHED_MAX_TASKS];   //
+        uint32_t tasks;                   //
+        uint32_t threads;                 // started task threads
+        uint64_t start;                   // CLOCK_MONOTONIC ns
+            bool run;                     // cleared by sched_stop()
+            bool started;                 //
+} sched_t;
+
+   void sched_init(sched_t *s);
+uint8_t sched_add(sched_t *s, vm_t *vm, uint64_t period, uint64_t deadline, int priority,
+                  void (*inputs)(vm_t*, void*), void (*outputs)(vm_t*, void*), void *ctx);
+uint8_t sched_start(sched_t *s);
+   void sched_stop(sched_t *s);
+
+#endif /* LIBRELOGIC_SCHED_H_ */
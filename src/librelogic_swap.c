@@ -0,0 +1,106 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+#include "librelogic_swap.h"
+
+void swap_init(swap_t *swap, vm_t *vm) {
+    memset(swap, 0, sizeof(swap_t));
+    swap->vm = vm;
+}
+
+uint8_t swap_stage(swap_t *swap, const uint32_t *vm_program, uint32_t prg_len, uint8_t options) {
+    if (swap->state != SWAP_IDLE)
+        return SWAP_ERR_BUSY;
+
+    if ((swap->status = vm_stage(swap->vm, &swap->next, vm_program, prg_len)) != VM_OK) {
+        vm_deinit(&swap->next);
+        return SWAP_ERR_LOAD;
+    }
+    if (options & SWAP_FUSE)
+        vm_fuse(&swap->next);
+    // out of memory: every op runs
+    if (options & SWAP_SEGMENT)
+        vm_segment(&swap->next);
+    swap->state = SWAP_STAGED;
+
+    return SWAP_OK;
+}
+
+uint8_t swap_stage_il(swap_t *swap, const char *src, size_t len, uint8_t options, il_program_t *prg) {
+    if (swap->state != SWAP_IDLE)
+        return SWAP_ERR_BUSY;
+    if (!compile_il_buffer(src, len, prg))
+        return SWAP_ERR_ASSEMBLE;
+
+    return swap_stage(swap, prg->code, prg->code_len, options);
+}
+
+uint8_t swap_publish(swap_t *swap) {
+    vm_t *none = NULL;
+
+    if (swap->state != SWAP_STAGED)
+        return SWAP_ERR_STATE;
+
+    // cleared by the scan thread once installed
+    swap->next.pending = &swap->next;
+    if (!__atomic_compare_exchange_n(&swap->vm->pending, &none, &swap->next, false, __ATOMIC_RELEASE,
+            __ATOMIC_RELAXED)) {
+        swap->next.pending = NULL;
+        return SWAP_ERR_BUSY;
+    }
+    swap->state = SWAP_PUBLISHED;
+
+    return SWAP_OK;
+}
+
+bool swap_reclaim(swap_t *swap) {
+    if (swap->state != SWAP_PUBLISHED || __atomic_load_n(&swap->next.pending, __ATOMIC_ACQUIRE) != NULL)
+        return false;
+
+    vm_deinit(&swap->next);
+    swap->state = SWAP_IDLE;
+    ++swap->swaps;
+
+    return true;
+}
+
+void swap_free(swap_t *swap) {
+    vm_t *next = &swap->next;
+
+    if (swap->state == SWAP_PUBLISHED) {
+        // taken by the scan thread: the install ends before its scan starts
+        if (!__atomic_compare_exchange_n(&swap->vm->pending, &next, NULL, false, __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED)) {
+            while (!swap_reclaim(swap))
+                sched_yield();
+            return;
+        }
+    }
+    if (swap->state != SWAP_IDLE)
+        vm_deinit(&swap->next);
+    swap->state = SWAP_IDLE;
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+ LibreLogic : a free PLC library
+ Copyright (C) 2022, Antonis K. (kalamara AT ceid DOT upatras DOT gr)
+
+ New VM: 2022 Emiliano Augusto Gonzalez ( egonzalez . hiperion @ gmail . com )
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRELOGIC_SWAP_H_
+#define LIBRELOGIC_SWAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "librelogic_newvm.h"
+#include "librelogic_assem_disassem.h"
+
+// ONLINE PROGRAM CHANGE
+// replaces the program of a running vm between two scans. from any thread but
+// the scan one: swap_stage() (or swap_stage_il() from source) builds and verifies
+// the new program in a shadow vm, swap_publish() makes the next vm_execute() run
+// it. the scan thread installs it itself at the scan boundary, so once it did
+// (swap_reclaim() returns true) nothing refers to the previous program any more
+// and swap_reclaim() releases it. swap_free() withdraws a program not installed
+// yet. one swap in flight per vm: swap_publish() fails while another is pending.
+// area sizes can't change online, the new program is verified against them.
+
+typedef enum SWAP_STATUS {
+    SWAP_OK,           //
+    SWAP_ERR_BUSY,     // a program is staged or pending
+    SWAP_ERR_STATE,    // nothing staged / published
+    SWAP_ERR_ASSEMBLE, // il source errors, see program diagnostics
+    SWAP_ERR_LOAD,     // vm_stage() failed, see swap->status
+} swap_status_t;
+
+typedef enum SWAP_STATES {
+    SWAP_IDLE,      //
+    SWAP_STAGED,    // next holds the new program
+    SWAP_PUBLISHED, // in vm->pending or installed, next holds the previous program once installed
+} swap_states_t;
+
+typedef enum SWAP_OPTIONS {
+    SWAP_FUSE    = 0x01, // vm_fuse() the new program
+    SWAP_SEGMENT = 0x02, // vm_segment() the new program
+} swap_options_t;
+
+typedef struct swap {
+       vm_t *vm;      // running vm
+       vm_t next;     // shadow vm
+    uint8_t state;    // swap_states_t
+    uint8_t status;   // last vm_stage() result
+   uint64_t swaps;    // programs installed and reclaimed
+} swap_t;
+
+   void swap_init(swap_t *swap, vm_t *vm);
+uint8_t swap_stage(swap_t *swap, const uint32_t *vm_program, uint32_t prg_len, uint8_t options);
+// prg: assembled program and diagnostics, free with il_program_free()
+uint8_t swap_stage_il(swap_t *swap, const char *src, size_t len, uint8_t options, il_program_t *prg);
+uint8_t swap_publish(swap_t *swap);
+// true: the published program runs, the previous one is released
+   bool swap_reclaim(swap_t *swap);
+// withdraws or reclaims, waits for an install in progress
+   void swap_free(swap_t *swap);
+
+#endif /* LIBRELOGIC_SWAP_H_ */
@@ -18,21 +18,694 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "librelogic_newvm.h"
 #include "librelogic_assem_disassem.h"
+#include "librelogic_image.h"
+#include "librelogic_batch.h"
+#include "librelogic_jit.h"
+#include "librelogic_aot.h"
+#include "librelogic_sched.h"
+#include "librelogic_metrics.h"
+#include "librelogic_profile.h"
+#include "librelogic_procimg.h"
+#include "librelogic_export.h"
+#include "librelogic_parallel.h"
+#include "librelogic_host.h"
+#include "librelogic_swap.h"
+#include "librelogic_checkpoint.h"
+#include "librelogic_record.h"
 
-int main(void) {
-    compile_il("test.il");
-    printf("\n--------------------------------\n");
-    printf("--------------------------------\n\n");
-    compile_il("test2.il");
+#ifndef AOT_INCLUDE
+#define AOT_INCLUDE "src"
+#endif
 
-    return EXIT_SUCCESS;
+static const uint32_t vm_size[VM_AREAS] = {
+        [VM_I]      = 8,
+        [VM_I_REAL] = 8,
+        [VM_M]      = 8,
+        [VM_M_REAL] = 8,
+        [VM_C]      = 8,
+        [VM_Q]      = 8,
+        [VM_Q_REAL] = 8,
+        [VM_T]      = 8,
+        [VM_B]      = 8,
+};
+
+static int trace(const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+
+    return n;
+}
+
+// assemble, print diagnostics on error
+static bool compile(char *file, il_program_t *prg) {
+    uint32_t n;
+
+    if (compile_il(file, prg))
+        return true;
+
+    for (n = 0; n < prg->diags_qty; n++)
+        printf("%s:%lu:%lu: error: %s%s%s\n", file, (long unsigned int) prg->diags[n].line,
+                (long unsigned int) prg->diags[n].col, il_diag_str(prg->diags[n].code),
+                prg->diags[n].text ? ": " : "", prg->diags[n].text ? prg->diags[n].text : "");
+    il_program_free(prg);
+
+    return false;
+}
+
+static void run(char *file, vm_t *vm) {
+    il_program_t prg;
+    image_t img;
+    char path[512];
+    uint8_t status;
+
+    if (!compile(file, &prg))
+        return;
+
+    snprintf(path, sizeof(path), "%s.img", file);
+    status = image_write(path, &prg);
+    il_program_free(&prg);
+    if (status != IMAGE_OK) {
+        printf("ERROR: can't write image %s (%d)\n", path, status);
+        return;
+    }
+
+    status = image_load(path, &img);
+    if (status != IMAGE_OK) {
+        printf("ERROR: can't load image %s (%d)\n", path, status);
+        return;
+    }
+
+    status = vm_load(vm, img.code, img.header->code_len);
+    if (status == VM_OK) {
+        vm_fuse(vm);
+        status = vm_execute(vm);
+    }
+    printf("\nscan: status = %d / acc = 0x%016lx / q0 = 0x%016lx / m0 = %lu / m1 = %lu\n", status,
+            (long unsigned int) vm->acc.w, (long unsigned int) vm->q[0], (long unsigned int) vm->m[0],
+            (long unsigned int) vm->m[1]);
+
+    image_unload(&img);
 }
 
+// every combination of %i0/0..7 %i1/0..2 as one instance
+static void run_batch(char *file) {
+    il_program_t prg;
+    batch_t b;
+    uint32_t n, bit, on = 0;
+    uint8_t status;
+    bool val;
 
+    if (!compile(file, &prg))
+        return;
+
+    if (batch_init(&b, 2048, vm_size) != BATCH_OK) {
+        il_program_free(&prg);
+        return;
+    }
+
+    status = batch_load(&b, prg.code, prg.code_len);
+    if (status == BATCH_OK) {
+        for (n = 0; n < 2048 && status == BATCH_OK; n++)
+            for (bit = 0; bit < 11 && status == BATCH_OK; bit++)
+                status = batch_set(&b, VM_I, n, bit / 8, bit % 8, (n >> bit) & 1);
+        if (status == BATCH_OK)
+            status = batch_execute(&b);
+        for (n = 0; n < 2048 && status == BATCH_OK; n++)
+            if ((status = batch_get(&b, VM_Q, n, 0, 0, &val)) == BATCH_OK)
+                on += val;
+    }
+    printf("\nbatch: status = %d / instances = %d / q0/0 set = %d\n", status, b.instances, on);
+
+    batch_deinit(&b);
+    il_program_free(&prg);
+}
 
+// same scan on interpreter, jit and aot
+static void run_engines(char *file, uint64_t i0) {
+    static const char *engine[3] = { "interp", "jit   ", "aot   " };
+    char c_file[512], so_file[512];
+    il_program_t prg;
+    vm_t vm[3];
+    jit_t jit;
+    aot_t aot = { 0 };
+    uint8_t status[3], n;
+
+    if (!compile(file, &prg))
+        return;
+
+    for (n = 0; n < 3; n++) {
+        vm_init(&vm[n], vm_size);
+        vm[n].i[0] = i0;
+        status[n] = vm_load(&vm[n], prg.code, prg.code_len);
+    }
+
+    if (jit_compile(&jit, &vm[1]) == JIT_OK)
+        vm_select(&vm[1], VM_ENGINE_JIT, jit.fn);
+    else
+        printf("jit: unsupported program, interpreter\n");
+
+    // dlopen() needs a path to not search the library path
+    snprintf(c_file, sizeof(c_file), "%s.c", file);
+    snprintf(so_file, sizeof(so_file), "%s%s.so", strchr(file, '/') ? "" : "./", file);
+    if (aot_translate(c_file, &prg, "il_scan") == AOT_OK && aot_build(c_file, so_file, AOT_INCLUDE) == AOT_OK
+            && aot_load(&aot, so_file, "il_scan") == AOT_OK)
+        vm_select(&vm[2], VM_ENGINE_AOT, aot.fn);
+    else
+        printf("aot: unsupported program, interpreter\n");
+
+    for (n = 0; n < 3; n++) {
+        if (status[n] == VM_OK)
+            status[n] = vm_execute(&vm[n]);
+        printf("\n%s: status = %d / acc = 0x%016lx / q0 = 0x%016lx / m0 = %lu", engine[n], status[n],
+                (long unsigned int) vm[n].acc.w, (long unsigned int) vm[n].q[0], (long unsigned int) vm[n].m[0]);
+    }
+    printf("\n");
+
+    jit_free(&jit);
+    aot_unload(&aot);
+    for (n = 0; n < 3; n++)
+        vm_deinit(&vm[n]);
+    il_program_free(&prg);
+}
 
+// INT64_MIN / -1 wraps to INT64_MIN instead of trapping, on every engine
+static const char div_src[] = "LD %m0\nDIV %m1\nST %m2\n";
+
+static void run_div(const char *c_file, const char *so_file) {
+    static const char *engine[3] = { "interp", "jit   ", "aot   " };
+    il_program_t prg;
+    uint8_t status[3], n;
+    vm_t vm[3];
+    jit_t jit;
+    aot_t aot = { 0 };
+
+    if (!compile_il_buffer(div_src, strlen(div_src), &prg)) {
+        printf("ERROR: can't assemble div demo\n");
+        il_program_free(&prg);
+        return;
+    }
+    for (n = 0; n < 3; n++) {
+        vm_init(&vm[n], vm_size);
+        vm[n].m[0] = (uint64_t) INT64_MIN;
+        vm[n].m[1] = (uint64_t) -1;
+        status[n] = vm_load(&vm[n], prg.code, prg.code_len);
+    }
+
+    if (jit_compile(&jit, &vm[1]) == JIT_OK)
+        vm_select(&vm[1], VM_ENGINE_JIT, jit.fn);
+    else
+        printf("jit: unsupported program, interpreter\n");
+    if (aot_translate(c_file, &prg, "il_scan") == AOT_OK && aot_build(c_file, so_file, AOT_INCLUDE) == AOT_OK
+            && aot_load(&aot, so_file, "il_scan") == AOT_OK)
+        vm_select(&vm[2], VM_ENGINE_AOT, aot.fn);
+    else
+        printf("aot: unsupported program, interpreter\n");
+
+    for (n = 0; n < 3; n++) {
+        if (status[n] == VM_OK)
+            status[n] = vm_execute(&vm[n]);
+        printf("div %s: status = %d / m2 = 0x%016lx\n", engine[n], status[n], (long unsigned int) vm[n].m[2]);
+    }
+
+    jit_free(&jit);
+    aot_unload(&aot);
+    for (n = 0; n < 3; n++)
+        vm_deinit(&vm[n]);
+    il_program_free(&prg);
+}
+
+// a dead rung nested deeper than the reachable code, fused
+static const char fuse_src[] = "LD %i0/0\nJMP skip\nLD %i0/1\nAND( %i0/2\nAND( %i0/3\nAND( %i0/4\n)\n)\n)\n"
+        "ST %q0/0\nskip:ST %q0/1\n";
+
+static void run_fuse(void) {
+    il_program_t prg;
+    uint8_t status;
+    vm_t vm;
+
+    if (!compile_il_buffer(fuse_src, strlen(fuse_src), &prg)) {
+        printf("ERROR: can't assemble fuse demo\n");
+        il_program_free(&prg);
+        return;
+    }
+    vm_init(&vm, vm_size);
+    vm.i[0] = 1;
+    if ((status = vm_load(&vm, prg.code, prg.code_len)) == VM_OK) {
+        vm_fuse(&vm);
+        status = vm_execute(&vm);
+    }
+    printf("fuse dead rung: status = %d / stack depth = %u / q0 = 0x%016lx\n", status, vm.stack_depth,
+            (long unsigned int) vm.q[0]);
+
+    vm_deinit(&vm);
+    il_program_free(&prg);
+}
+
+// 1 ms fast task and 100 ms slow task for 300 ms, metrics in shared memory.
+// %i0 comes from an input snapshot, q0 is read back from the output snapshots
+static void run_sched(char *fast, uint64_t fast_i0, char *slow, uint64_t slow_i0) {
+    char *file[2] = { fast, slow };
+    uint64_t i0[2] = { fast_i0, slow_i0 };
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 300000000 };
+    il_program_t prg;
+    metrics_t metrics = { 0 }, monitor;
+    metrics_task_t *task;
+    procimg_t img[2];
+    procimg_snapshot_t *in;
+    sched_t s;
+    vm_t vm[2];
+    uint32_t n;
+
+    sched_init(&s);
+    memset(vm, 0, sizeof(vm));
+    memset(img, 0, sizeof(img));
+    for (n = 0; n < 2; n++) {
+        vm_init(&vm[n], vm_size);
+        if (procimg_init(&img[n], &vm[n]) != PROCIMG_OK)
+            goto end;
+        in = procimg_input_back(&img[n]);
+        in->w[0] = i0[n];
+        procimg_input_publish(&img[n]);
+        if (!compile(file[n], &prg))
+            goto end;
+        if (vm_load(&vm[n], prg.code, prg.code_len) != VM_OK) {
+            il_program_free(&prg);
+            goto end;
+        }
+        il_program_free(&prg);
+        vm_fuse(&vm[n]);
+        sched_add(&s, &vm[n], n ? 100000000 : 1000000, 0, n ? 1 : 2, procimg_inputs, procimg_outputs, &img[n]);
+    }
+
+    if (metrics_create(&metrics, "/librelogic_demo", s.tasks) == METRICS_OK)
+        for (n = 0; n < s.tasks; n++)
+            s.task[n].metrics = metrics_task(&metrics, n, file[n]);
+
+    if (sched_start(&s) != SCHED_OK) {
+        printf("ERROR: can't start scheduler\n");
+        goto end;
+    }
+    nanosleep(&ts, NULL);
+    sched_stop(&s);
+
+    for (n = 0; n < s.tasks; n++)
+        printf("task %s: rt = %d / scans = %lu / overruns = %lu / deadline misses = %lu / status = %d / "
+                "scan max = %lu ns / latency max = %lu ns / q0 = 0x%016lx\n", file[n], s.task[n].rt,
+                (long unsigned int) s.task[n].scans, (long unsigned int) s.task[n].overruns,
+                (long unsigned int) s.task[n].deadline_misses, s.task[n].status,
+                (long unsigned int) s.task[n].scan_max, (long unsigned int) s.task[n].latency_max,
+                (long unsigned int) procimg_output(&img[n], NULL)->w[0]);
+
+    // as an external monitor would see it
+    if (metrics_attach(&monitor, "/librelogic_demo") == METRICS_OK) {
+        for (n = 0; n < monitor.shm->tasks; n++) {
+            task = &monitor.shm->task[n];
+            printf("metrics %s: scans = %lu / instructions = %lu / scan p50 = %lu p99 = %lu p99.9 = %lu max = %lu ns"
+                    " / jitter p50 = %lu p99 = %lu max = %lu ns\n", task->name, (long unsigned int) task->scans,
+                    (long unsigned int) task->instructions, (long unsigned int) metrics_percentile(&task->scan, 0.5),
+                    (long unsigned int) metrics_percentile(&task->scan, 0.99),
+                    (long unsigned int) metrics_percentile(&task->scan, 0.999), (long unsigned int) task->scan.max,
+                    (long unsigned int) metrics_percentile(&task->jitter, 0.5),
+                    (long unsigned int) metrics_percentile(&task->jitter, 0.99), (long unsigned int) task->jitter.max);
+        }
+        metrics_close(&monitor);
+    }
+
+    end:
+    metrics_close(&metrics);
+    for (n = 0; n < 2; n++) {
+        procimg_free(&img[n]);
+        vm_deinit(&vm[n]);
+    }
+}
+
+// vm areas in shared memory, read back as an HMI would
+static void run_export(char *file, uint64_t i0) {
+    il_program_t prg;
+    export_t exp = { 0 }, hmi;
+    uint64_t gen, q0, m0;
+    bool read;
+    vm_t vm;
+
+    memset(&vm, 0, sizeof(vm));
+    if (export_create(&exp, "/librelogic_export", &vm, vm_size) != EXPORT_OK) {
+        printf("ERROR: can't create export segment\n");
+        return;
+    }
+    if (!compile(file, &prg))
+        goto end;
+    if (vm_load(&vm, prg.code, prg.code_len) == VM_OK) {
+        vm.i[0] = i0;
+        vm_execute(&vm);
+    }
+    il_program_free(&prg);
+
+    if (export_attach(&hmi, "/librelogic_export") == EXPORT_OK) {
+        // a reader gives up after 10 ms instead of hanging on a stalled scan
+        do {
+            if (!(read = export_begin_wait(&hmi, 10000000, &gen)))
+                break;
+            q0 = *(const uint64_t*) export_operand(&hmi, OP_OUTPUT, 0);
+            m0 = *(const uint64_t*) export_operand(&hmi, OP_MEMORY, 0);
+        } while (export_retry(&hmi, gen));
+        if (!read)
+            printf("ERROR: export %s: scan still running\n", file);
+        else
+            printf("export %s: generation = %lu / q0 = 0x%016lx / m0 = %lu\n", file, (long unsigned int) gen,
+                    (long unsigned int) q0, (long unsigned int) m0);
+        export_close(&hmi);
+    }
+
+    end:
+    vm_deinit(&vm);
+    export_close(&exp);
+}
+
+// two machine cells in one program: a conveyor (i0, q0) and a pump filling up to
+// a level (i1, m1..m3, q1). they share no location, so they run as two sections
+static const char parallel_src[] =
+        "LD %i0/0\n"
+        "AND !%i0/1\n"
+        "OR %q0/0\n"
+        "AND !%i0/2\n"
+        "ST %q0/0\n"
+        "LD %i1/0\n"
+        "AND !%q1/1\n"
+        "JMP!? idle\n"
+        "LD %m1\n"
+        "ADD %m2\n"
+        "ST %m1\n"
+        "idle: LD %m1\n"
+        "GT %m3\n"
+        "ST %q1/1\n";
+
+static void run_parallel(void) {
+    il_program_t prg;
+    parallel_t par;
+    uint8_t status = VM_OK;
+    uint32_t n;
+    vm_t vm;
+
+    if (!compile_il_buffer(parallel_src, strlen(parallel_src), &prg)) {
+        printf("ERROR: can't assemble parallel demo\n");
+        il_program_free(&prg);
+        return;
+    }
+    vm_init(&vm, vm_size);
+    if (vm_load(&vm, prg.code, prg.code_len) != VM_OK || parallel_init(&par, &vm, 1) != PARALLEL_OK) {
+        printf("ERROR: can't load parallel demo\n");
+        goto end;
+    }
+    if (parallel_start(&par, NULL, 0) == PARALLEL_OK) {
+        vm.i[0] = 0x1;
+        vm.i[1] = 0x1;
+        vm.m[2] = 1;
+        vm.m[3] = 2;
+        for (n = 0; n < 4 && status == VM_OK; n++)
+            status = vm_execute(&vm);
+        printf("parallel: sections = %u / lanes = %u / status = %d / q0 = 0x%016lx / q1 = 0x%016lx / m1 = %lu\n",
+                par.sections, par.lanes, status, (long unsigned int) vm.q[0], (long unsigned int) vm.q[1],
+                (long unsigned int) vm.m[1]);
+    }
+    parallel_free(&par);
+
+    end:
+    vm_deinit(&vm);
+    il_program_free(&prg);
+}
 
+// %i0 of a hosted program
+static void host_inputs(vm_t *vm, void *ctx) {
+    vm->i[0] = *(const uint64_t*) ctx;
+}
+
+// four copies of a program on two workers, 1 ms period for 100 ms
+static void run_host(char *file, uint64_t i0) {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000 };
+    host_program_t *p;
+    il_program_t prg;
+    uint8_t status;
+    host_t host;
+    uint32_t n;
+
+    if (!compile(file, &prg))
+        return;
+    if (host_init(&host, 2, NULL, 0, 1 << 20) != HOST_OK) {
+        printf("ERROR: can't start host workers\n");
+        il_program_free(&prg);
+        return;
+    }
+    for (n = 0; n < 4; n++)
+        if (host_add(&host, prg.code, prg.code_len, vm_size, host_inputs, NULL, &i0, &status) != HOST_OK) {
+            printf("ERROR: can't add %s to host (%d)\n", file, status);
+            goto end;
+        }
+    if (host_start(&host, 1000000) != HOST_OK)
+        goto end;
+    nanosleep(&ts, NULL);
+    host_stop(&host);
+
+    for (n = 0; n < host.programs; n++) {
+        p = host.program[n];
+        printf("host %s #%u: worker = %u / scans = %lu / stolen = %lu / overruns = %lu / status = %d / "
+                "q0 = 0x%016lx\n", file, n, p->worker, (long unsigned int) p->scans, (long unsigned int) p->stolen,
+                (long unsigned int) p->overruns, p->status, (long unsigned int) p->vm.q[0]);
+    }
+
+    end:
+    host_free(&host);
+    il_program_free(&prg);
+}
+
+// a counter adding %m2 each scan, changed online to add %m3 and drive %q0/0
+static const char swap_src[2][64] = {
+        "LD %m0\nADD %m2\nST %m0\n",
+        "LD %m0\nADD %m3\nST %m0\nGT %m4\nST %q0/0\n",
+};
+
+static void run_swap(void) {
+    il_program_t prg;
+    uint8_t status = VM_OK;
+    swap_t swap;
+    uint32_t n;
+    vm_t vm;
+
+    vm_init(&vm, vm_size);
+    swap_init(&swap, &vm);
+    vm.m[2] = 1;
+    vm.m[3] = 10;
+    vm.m[4] = 20;
+    for (n = 0; n < 2 && status == VM_OK; n++) {
+        memset(&prg, 0, sizeof(prg));
+        if (swap_stage_il(&swap, swap_src[n], strlen(swap_src[n]), SWAP_FUSE, &prg) != SWAP_OK
+                || swap_publish(&swap) != SWAP_OK) {
+            printf("ERROR: can't stage program %u (%d)\n", n, swap.status);
+            il_program_free(&prg);
+            break;
+        }
+        il_program_free(&prg);
+        for (uint32_t scan = 0; scan < 3 && status == VM_OK; scan++)
+            status = vm_execute(&vm);
+        swap_reclaim(&swap);
+        printf("swap %u: swaps = %lu / status = %d / m0 = %lu / q0 = 0x%016lx\n", n,
+                (long unsigned int) swap.swaps, status, (long unsigned int) vm.m[0], (long unsigned int) vm.q[0]);
+    }
+
+    swap_free(&swap);
+    vm_deinit(&vm);
+}
+
+// a scan counter kept across a restart: 5 scans, close, reopen, 1 scan
+static const char checkpoint_src[] = "LD %m0\nADD %m2\nST %m0\n";
+
+static void run_checkpoint(const char *path) {
+    checkpoint_t cp;
+    il_program_t prg;
+    uint32_t run, n;
+    uint8_t status;
+    vm_t vm;
+
+    if (!compile_il_buffer(checkpoint_src, strlen(checkpoint_src), &prg)) {
+        printf("ERROR: can't assemble checkpoint demo\n");
+        il_program_free(&prg);
+        return;
+    }
+    unlink(path);
+    for (run = 0; run < 2; run++) {
+        if ((status = checkpoint_open(&cp, path, &vm, vm_size, 2)) != CHECKPOINT_OK) {
+            printf("ERROR: can't open checkpoint %s (%d)\n", path, status);
+            break;
+        }
+        if (!cp.restored)
+            vm.m[2] = 1;
+        if (vm_load(&vm, prg.code, prg.code_len) == VM_OK)
+            for (n = 0; n < (run ? 1 : 5); n++) {
+                vm.time = cp.time + n;
+                vm_execute(&vm);
+                checkpoint_scan(&cp);
+            }
+        status = checkpoint_save(&cp);
+        printf("checkpoint run %u: restored = %d / seq = %lu / written = %lu / status = %d / m0 = %lu\n", run,
+                cp.restored, (long unsigned int) cp.seq, (long unsigned int) cp.written, status,
+                (long unsigned int) vm.m[0]);
+        vm_deinit(&vm);
+        checkpoint_close(&cp);
+    }
+
+    unlink(path);
+    il_program_free(&prg);
+}
+
+// 100 scans with changing inputs recorded, then replayed on a fresh vm
+static void run_record(char *file, const char *path) {
+    il_program_t prg;
+    record_t rec, done;
+    replay_t rp;
+    uint8_t status;
+    uint32_t n;
+    vm_t vm;
+
+    if (!compile(file, &prg))
+        return;
+    vm_init(&vm, vm_size);
+    if (vm_load(&vm, prg.code, prg.code_len) != VM_OK || record_open(&rec, path, &vm, 0) != RECORD_OK) {
+        printf("ERROR: can't record %s\n", file);
+        goto end;
+    }
+    for (n = 0; n < 100; n++) {
+        vm.i[0] = (n / 10) * 0x25;
+        vm.i[1] = n & 4;
+        vm.time = n * 10;
+        record_scan(&rec, vm_execute(&vm));
+    }
+    // statistics are cleared by record_close()
+    done = rec;
+    status = record_close(&rec);
+    printf("record %s: scans = %lu / bytes = %lu / dropped = %lu / status = %d\n", file,
+            (long unsigned int) done.scans, (long unsigned int) done.bytes, (long unsigned int) done.dropped, status);
+    vm_deinit(&vm);
+
+    vm_init(&vm, vm_size);
+    if (vm_load(&vm, prg.code, prg.code_len) != VM_OK || replay_open(&rp, path, &vm) != RECORD_OK) {
+        printf("ERROR: can't replay %s\n", path);
+        goto end;
+    }
+    status = replay_run(&rp, &vm);
+    printf("replay %s: scans = %lu / diverged = %lu / first = %lu / unchecked = %lu / status = %d / q0 = 0x%016lx\n",
+            file, (long unsigned int) rp.scans, (long unsigned int) rp.diverged, (long unsigned int) rp.first,
+            (long unsigned int) rp.unchecked, status, (long unsigned int) vm.q[0]);
+    replay_close(&rp);
+
+    end:
+    unlink(path);
+    vm_deinit(&vm);
+    il_program_free(&prg);
+}
+
+#ifdef VM_PROFILE
+// 100 unfused scans, report and folded stacks in <file>.folded
+static void run_profile(char *file, uint64_t i0) {
+    il_program_t prg;
+    vm_profile_t prof;
+    char path[512];
+    vm_t vm;
+    FILE *f;
+    uint32_t n;
+
+    if (!compile(file, &prg))
+        return;
+    vm_init(&vm, vm_size);
+    if (vm_load(&vm, prg.code, prg.code_len) != VM_OK || profile_init(&prof, prg.code_len) != PROFILE_OK)
+        goto end;
+
+    vm.profile = &prof;
+    for (n = 0; n < 100; n++) {
+        vm.i[0] = i0;
+        vm_execute(&vm);
+    }
+    profile_report(stdout, &prof, &prg);
+
+    snprintf(path, sizeof(path), "%s.folded", file);
+    f = fopen(path, "w");
+    if (f != NULL) {
+        profile_folded(f, &prof, &prg, file);
+        fclose(f);
+    }
+    profile_free(&prof);
+
+    end:
+    vm_deinit(&vm);
+    il_program_free(&prg);
+}
+#endif
+
+int main(void) {
+    vm_t vm;
+
+    if (getenv("LIBRELOGIC_TRACE") != NULL)
+        vm_trace = trace;
+
+    if (vm_init(&vm, vm_size) != VM_OK)
+        return EXIT_FAILURE;
+
+    vm.i[0] = 0x10;
+    vm.i[1] = 0x00;
+    run("test.il", &vm);
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    vm.i[0] = 48;
+    vm.i[1] = 0x00;
+    run("test2.il", &vm);
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_batch("test.il");
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_engines("test.il", 0x10);
+    run_engines("test2.il", 48);
+    run_div("div.il.c", "./div.il.so");
+    run_fuse();
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_sched("test.il", 0x10, "test2.il", 48);
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_export("test2.il", 48);
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_parallel();
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_host("test2.il", 48);
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_swap();
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_checkpoint("test.ckpt");
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_record("test.il", "test.trace");
+#ifdef VM_PROFILE
+    printf("\n--------------------------------\n");
+    printf("--------------------------------\n\n");
+    run_profile("test2.il", 48);
+#endif
+
+    vm_deinit(&vm);
+
+    return EXIT_SUCCESS;
+}